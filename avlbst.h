@@ -6,37 +6,101 @@
 #include <cstdlib>
 #include <cstdint>
 #include <algorithm>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <system_error>
 #include "bst.h"
 
 struct KeyError { };
 
 /**
-* A special kind of node for an AVL tree, which adds the balance as a data member, plus
-* other additional helper functions. You do NOT need to implement any functionality or
-* add additional data members or helper functions.
+* Default conflict policy for AVLTree's set operations: when both trees
+* hold a key, the other tree's value is kept. A policy is called as
+* resolve(key, mine, theirs) and returns the value to keep.
 */
-template <typename Key, typename Value>
-class AVLNode : public Node<Key, Value>
+struct TakeOther
+{
+    template<typename Key, typename Value>
+    Value operator()(const Key&, Value&, Value& theirs) const
+    {
+        return std::move(theirs);
+    }
+};
+
+/**
+* Wraps a set operation's resolve so that a throw cannot tear the tree
+* apart halfway (or reach the top of a worker thread): the first
+* exception is kept, the key keeps the value it had in this tree, the
+* operation runs to the end, and rethrow() raises it on the calling
+* thread afterwards.
+*/
+template<typename Resolve>
+class ResolveGuard
 {
 public:
-    // Constructor/destructor.
-    AVLNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent);
-    virtual ~AVLNode();
+    explicit ResolveGuard(Resolve& resolve) : resolve_(resolve) { }
 
-    // Getter/setter for the node's height.
+    template<typename Key, typename Value>
+    Value operator()(const Key& key, Value& mine, Value& theirs)
+    {
+        try {
+            return resolve_(key, mine, theirs);
+        }
+        catch(...) {
+            std::lock_guard<std::mutex> guard(lock_);
+            if(!error_) {
+                error_ = std::current_exception();
+            }
+        }
+        return std::move(mine);
+    }
+
+    void rethrow() const
+    {
+        if(error_) {
+            std::rethrow_exception(error_);
+        }
+    }
+
+private:
+    Resolve& resolve_;
+    std::mutex lock_;
+    std::exception_ptr error_;
+};
+
+/**
+* A special kind of node for an AVL tree, which adds the balance, plus
+* other additional helper functions. The balance needs no storage of its own:
+* it lives in the three low bits of the parent link, which are always zero
+* because the node is 8-byte aligned. Three bits (not two) because balances
+* pass through +/-2 while a rotation is pending.
+*/
+template <typename Key, typename Value, typename Augment = NoAugment>
+class alignas(8) AVLNode : public BasicNode<Key, Value, AVLNode<Key, Value, Augment> >, public Augment
+{
+public:
+    static const std::uintptr_t kParentTagMask = 7;
+
+    // Constructors.
+    AVLNode(const Key& key, const Value& value, AVLNode<Key, Value, Augment>* parent);
+    template<typename... Args>
+    explicit AVLNode(InPlaceItem tag, Args&&... args);
+
+    // Getter/setter for the node's balance (right height - left height),
+    // which must stay within [-2, 2].
     int8_t getBalance () const;
     void setBalance (int8_t balance);
     void updateBalance(int8_t diff);
+    void setSubtreeHeights(int leftHeight, int rightHeight);
 
-    // Getters for parent, left, and right. These need to be redefined since they
-    // return pointers to AVLNodes - not plain Nodes. See the Node class in bst.h
-    // for more information.
-    virtual AVLNode<Key, Value>* getParent() const override;
-    virtual AVLNode<Key, Value>* getLeft() const override;
-    virtual AVLNode<Key, Value>* getRight() const override;
+    // See Node.
+    void copyNodeData(const AVLNode<Key, Value, Augment>& other);
+    void swapNodeData(AVLNode<Key, Value, Augment>& other);
+    void pull();
 
-protected:
-    int8_t balance_;    // effectively a signed char
+    // getParent/getLeft/getRight come from BasicNode and already return
+    // AVLNode pointers, so no overrides or casts are needed.
 };
 
 /*
@@ -48,18 +112,20 @@ protected:
 /**
 * An explicit constructor to initialize the elements by calling the base class constructor
 */
-template<class Key, class Value>
-AVLNode<Key, Value>::AVLNode(const Key& key, const Value& value, AVLNode<Key, Value> *parent) :
-    Node<Key, Value>(key, value, parent), balance_(0)
+template<class Key, class Value, class Augment>
+AVLNode<Key, Value, Augment>::AVLNode(const Key& key, const Value& value, AVLNode<Key, Value, Augment> *parent) :
+    BasicNode<Key, Value, AVLNode<Key, Value, Augment> >(key, value, parent)
 {
 
 }
 
 /**
-* A destructor which does nothing.
+* In-place constructor; see the matching Node constructor.
 */
-template<class Key, class Value>
-AVLNode<Key, Value>::~AVLNode()
+template<class Key, class Value, class Augment>
+template<typename... Args>
+AVLNode<Key, Value, Augment>::AVLNode(InPlaceItem tag, Args&&... args) :
+    BasicNode<Key, Value, AVLNode<Key, Value, Augment> >(tag, std::forward<Args>(args)...)
 {
 
 }
@@ -67,58 +133,62 @@ AVLNode<Key, Value>::~AVLNode()
 /**
 * A getter for the balance of a AVLNode.
 */
-template<class Key, class Value>
-int8_t AVLNode<Key, Value>::getBalance() const
+template<class Key, class Value, class Augment>
+int8_t AVLNode<Key, Value, Augment>::getBalance() const
 {
-    return balance_;
+    // Sign-extend the 3-bit two's complement tag.
+    int8_t bits = static_cast<int8_t>(this->parent_ & kParentTagMask);
+    return bits >= 4 ? static_cast<int8_t>(bits - 8) : bits;
 }
 
 /**
 * A setter for the balance of a AVLNode.
 */
-template<class Key, class Value>
-void AVLNode<Key, Value>::setBalance(int8_t balance)
+template<class Key, class Value, class Augment>
+void AVLNode<Key, Value, Augment>::setBalance(int8_t balance)
 {
-    balance_ = balance;
+    this->parent_ = (this->parent_ & ~kParentTagMask) |
+                    (static_cast<std::uintptr_t>(balance) & kParentTagMask);
 }
 
 /**
 * Adds diff to the balance of a AVLNode.
 */
-template<class Key, class Value>
-void AVLNode<Key, Value>::updateBalance(int8_t diff)
+template<class Key, class Value, class Augment>
+void AVLNode<Key, Value, Augment>::updateBalance(int8_t diff)
 {
-    balance_ += diff;
+    setBalance(static_cast<int8_t>(getBalance() + diff));
 }
 
 /**
-* An overridden function for getting the parent since a static_cast is necessary to make sure
-* that our node is a AVLNode.
+* Sets the balance from the heights of the two subtrees; used when a
+* tree is assembled bottom-up rather than by insertion.
 */
-template<class Key, class Value>
-AVLNode<Key, Value> *AVLNode<Key, Value>::getParent() const
+template<class Key, class Value, class Augment>
+void AVLNode<Key, Value, Augment>::setSubtreeHeights(int leftHeight, int rightHeight)
 {
-    return static_cast<AVLNode<Key, Value>*>(this->parent_);
+    setBalance(static_cast<int8_t>(rightHeight - leftHeight));
 }
 
-/**
-* Overridden for the same reasons as above.
-*/
-template<class Key, class Value>
-AVLNode<Key, Value> *AVLNode<Key, Value>::getLeft() const
+template<class Key, class Value, class Augment>
+void AVLNode<Key, Value, Augment>::copyNodeData(const AVLNode<Key, Value, Augment>& other)
 {
-    return static_cast<AVLNode<Key, Value>*>(this->left_);
+    BasicNode<Key, Value, AVLNode<Key, Value, Augment> >::copyNodeData(other);
+    static_cast<Augment&>(*this) = static_cast<const Augment&>(other);
 }
 
-/**
-* Overridden for the same reasons as above.
-*/
-template<class Key, class Value>
-AVLNode<Key, Value> *AVLNode<Key, Value>::getRight() const
+template<class Key, class Value, class Augment>
+void AVLNode<Key, Value, Augment>::swapNodeData(AVLNode<Key, Value, Augment>& other)
 {
-    return static_cast<AVLNode<Key, Value>*>(this->right_);
+    BasicNode<Key, Value, AVLNode<Key, Value, Augment> >::swapNodeData(other);
+    std::swap(static_cast<Augment&>(*this), static_cast<Augment&>(other));
 }
 
+template<class Key, class Value, class Augment>
+void AVLNode<Key, Value, Augment>::pull()
+{
+    Augment::pull(this);
+}
 
 /*
   -----------------------------------------------
@@ -127,61 +197,544 @@ AVLNode<Key, Value> *AVLNode<Key, Value>::getRight() const
 */
 
 
-template <class Key, class Value>
-class AVLTree : public BinarySearchTree<Key, Value>
+/**
+* A self-balancing AVL tree built on top of BinarySearchTree. Nodes are
+* NodeT, an AVLNode with an optional augmentation (e.g. SubtreeSize),
+* obtained from Alloc like in the base class. Rotations and joins pull
+* the augmentation of every node whose subtree they change.
+*/
+template <class Key, class Value,
+          class Alloc = std::allocator<std::pair<const Key, Value> >,
+          class NodeT = AVLNode<Key, Value>,
+          class Compare = std::less<Key> >
+class AVLTree : public BinarySearchTree<Key, Value, Alloc, NodeT, Compare>
 {
 public:
-    virtual void insert (const std::pair<const Key, Value> &new_item) override; // TODO
-    virtual void remove(const Key& key) override;  // TODO
+    explicit AVLTree(const Alloc& alloc = Alloc());
+    explicit AVLTree(const Compare& comp, const Alloc& alloc = Alloc());
+
+    // Inserts (or overwrites, like insert) every item of [first, last).
+    template<typename InputIt>
+    void insert_batch(InputIt first, InputIt last, unsigned threads = 1);
+    // Replaces the contents with the items of [first, last), in any order.
+    template<typename InputIt>
+    void build_parallel(InputIt first, InputIt last, unsigned threads = 1);
+
+    // Set algebra with another tree of the same type. Keys found in both
+    // take the value resolve(key, mine, theirs) returns. The rvalue
+    // overloads reuse other's nodes when the allocators compare equal.
+    // If resolve throws, the operation still completes (keys it failed
+    // on keep this tree's value) and the first exception is rethrown.
+    template<typename Resolve = TakeOther>
+    void union_with(const AVLTree& other, Resolve resolve = Resolve(), unsigned threads = 1);
+    template<typename Resolve = TakeOther>
+    void union_with(AVLTree&& other, Resolve resolve = Resolve(), unsigned threads = 1);
+    template<typename Resolve = TakeOther>
+    void intersect_with(const AVLTree& other, Resolve resolve = Resolve(), unsigned threads = 1);
+    template<typename Resolve = TakeOther>
+    void intersect_with(AVLTree&& other, Resolve resolve = Resolve(), unsigned threads = 1);
+    void difference(const AVLTree& other, unsigned threads = 1);
+    void difference(AVLTree&& other, unsigned threads = 1);
+
+    // Moves every key >= key into the returned tree, keeping the rest.
+    AVLTree split(const Key& key);
+    // Takes all of other's nodes; the key ranges must not overlap.
+    void concat(AVLTree& other);
+    void concat(AVLTree&& other);
+
+    // True by the AVL invariant, which every update restores; the full
+    // check is still there as verifyBalance().
+    virtual bool isBalanced() const override;
+    virtual int height() const override;
 protected:
-    virtual void nodeSwap(Node<Key,Value>* n1, Node<Key,Value>* n2) override;
+    virtual void insertFixup(NodeT* node) override;
+    virtual void removeFixup(NodeT* parent, bool fromLeft) override;
     // Add helper functions here
-    void rotateLeft(AVLNode<Key, Value>* node);
-    void rotateRight(AVLNode<Key, Value>* node);
-    void rebalance(AVLNode<Key, Value>* node);
+    static NodeT* rotateLeft(NodeT* node);
+    static NodeT* rotateRight(NodeT* node);
+    static NodeT* rebalanceSubtree(NodeT* node);
+    void rebalance(NodeT* node);
 
+    // Join-based building blocks. They work on detached subtrees (root
+    // parent is nullptr) whose heights are passed along with them, so a
+    // join costs O(|leftHeight - rightHeight| + 1) and a split O(log n).
+    static int subtreeHeight(NodeT* node);
+    static NodeT* joinSubtrees(NodeT* left, int leftHeight,
+                                             NodeT* mid,
+                                             NodeT* right, int rightHeight,
+                                             int& height);
+    void splitSubtree(NodeT* root, int height, const Key& key,
+                      NodeT*& left, int& leftHeight,
+                      NodeT*& found,
+                      NodeT*& right, int& rightHeight) const;
+    static NodeT* growFixup(NodeT* child, NodeT* top, bool& grew);
+    static void detachChildren(NodeT* root, int height,
+                               NodeT*& left, int& leftHeight,
+                               NodeT*& right, int& rightHeight);
+    static NodeT* splitLast(NodeT* root, int height,
+                                          NodeT*& last, int& newHeight);
+    static NodeT* concatSubtrees(NodeT* left, int leftHeight,
+                                               NodeT* right, int rightHeight,
+                                               int& height);
+    static NodeT* linkSorted(NodeT** nodes, std::size_t count, int& height, unsigned forks = 0);
+    static std::size_t splitSize(NodeT* root, std::true_type);
+    static std::size_t splitSize(NodeT* root, std::false_type);
+
+    // Stable parallel merge sort for build_parallel. The sorted run ends
+    // up in to if toOther is set and in from otherwise.
+    typedef std::pair<Key, Value> BuildItem;
+    void sortItems(BuildItem* from, BuildItem* to, std::size_t count,
+                   bool toOther, unsigned forks) const;
+    void mergeItems(BuildItem* left, std::size_t leftCount,
+                    BuildItem* right, std::size_t rightCount,
+                    BuildItem* out, unsigned forks) const;
+
+    // The set operations proper, on detached subtrees. Nodes that drop
+    // out (duplicates, removed keys) are handed back in garbage as
+    // subtree roots, to be freed by the calling thread. Up to 2^forks
+    // threads share the work.
+    template<typename Resolve>
+    NodeT* unionSubtrees(NodeT* mine, int mineHeight,
+                         NodeT* theirs, int theirsHeight,
+                         Resolve& resolve, unsigned forks,
+                         std::vector<NodeT*>& garbage, int& height) const;
+    template<typename Resolve>
+    NodeT* intersectSubtrees(NodeT* mine, int mineHeight,
+                             NodeT* theirs, int theirsHeight,
+                             Resolve& resolve, unsigned forks,
+                             std::vector<NodeT*>& garbage, int& height) const;
+    NodeT* differenceSubtrees(NodeT* mine, int mineHeight,
+                              NodeT* theirs, int theirsHeight,
+                              unsigned forks,
+                              std::vector<NodeT*>& garbage, int& height) const;
+    template<typename LeftFn, typename RightFn>
+    static void forkJoin(bool fork, LeftFn leftFn, RightFn rightFn);
+    static unsigned forksFor(unsigned threads);
+
+    NodeT* adoptNodes(const AVLTree& other);
+    NodeT* adoptNodes(AVLTree&& other);
+    void freeGarbage(std::vector<NodeT*>& garbage);
+
+    // Subtrees shorter than this are not worth a thread of their own.
+    static const int kForkHeight = 10;
+    // Nor are ranges of fewer items than this to sort or merge.
+    static const std::size_t kForkItems = 1 << 14;
 };
 
-/*
- * Recall: If key is already in the tree, you should 
- * overwrite the current value with the updated value.
- */
-template<class Key, class Value>
-void AVLTree<Key, Value>::insert (const std::pair<const Key, Value> &new_item)
-{
-    // TODO
-    // Create a new AVLNode.
-    AVLNode<Key, Value>* newNode = new AVLNode<Key, Value>(new_item.first, new_item.second, nullptr);
-    if(this->root_ == nullptr) {
-        this->root_ = newNode;
-        return;
+/**
+* Constructs an empty tree that draws its nodes from alloc.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+AVLTree<Key, Value, Alloc, NodeT, Compare>::AVLTree(const Alloc& alloc) :
+    BinarySearchTree<Key, Value, Alloc, NodeT, Compare>(alloc)
+{
+
+}
+
+/**
+* Constructs an empty tree ordered by comp that draws its nodes from alloc.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+AVLTree<Key, Value, Alloc, NodeT, Compare>::AVLTree(const Compare& comp, const Alloc& alloc) :
+    BinarySearchTree<Key, Value, Alloc, NodeT, Compare>(comp, alloc)
+{
+}
+
+/**
+* Inserts every item of [first, last), overwriting existing keys like
+* insert() does (if the batch repeats a key, its last occurrence wins).
+* Instead of one descent per item, the batch is sorted, linked into a
+* tree of its own and united with this one (see unionSubtrees) in
+* O(m log(n/m + 1)) for m items.
+*
+* With threads > 1 the merge hands disjoint parts of the tree to up to
+* that many threads. All nodes are allocated up front on the calling
+* thread and the leftovers freed afterwards, so the allocator is never
+* used concurrently. If allocation fails the tree is left unchanged.
+* Value's move assignment, used on keys that already exist, must not
+* throw.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+template<typename InputIt>
+void AVLTree<Key, Value, Alloc, NodeT, Compare>::insert_batch(InputIt first, InputIt last, unsigned threads)
+{
+    std::vector<NodeT*> nodes;
+    try {
+        for(; first != last; ++first) {
+            nodes.push_back(this->createNode(InPlaceItem(), *first));
+        }
     }
-    
-    // Perform standard BST insertion.
-    AVLNode<Key, Value>* parent = nullptr;
-    AVLNode<Key, Value>* current = static_cast<AVLNode<Key, Value>*>(this->root_);
-    while(current != nullptr) {
-        parent = current;
-        if(new_item.first < current->getKey())
-            current = current->getLeft();
-        else if(new_item.first > current->getKey())
-            current = current->getRight();
+    catch(...) {
+        for(std::size_t i = 0; i < nodes.size(); ++i) {
+            this->destroyNode(nodes[i]);
+        }
+        throw;
+    }
+
+    // Sort by key; among equal keys keep only the last one given.
+    const Compare& comp = this->comp_;
+    std::stable_sort(nodes.begin(), nodes.end(),
+                     [&comp](NodeT* a, NodeT* b) {
+                         return comp(a->getKey(), b->getKey());
+                     });
+    std::size_t count = 0;
+    for(std::size_t i = 0; i < nodes.size(); ++i) {
+        if(i + 1 < nodes.size() && !comp(nodes[i]->getKey(), nodes[i + 1]->getKey())) {
+            this->destroyNode(nodes[i]);
+        }
         else {
-            // Key already exists: update the value and clean up.
-            current->setValue(new_item.second);
-            delete newNode;
-            return;
+            nodes[count++] = nodes[i];
         }
     }
-    newNode->setParent(parent);
-    if(new_item.first < parent->getKey())
-        parent->setLeft(newNode);
-    else
-        parent->setRight(newNode);
-    
-    // Propagate balance updates upward.
-    AVLNode<Key, Value>* child = newNode;
-    current = parent;
+    if(count == 0) {
+        return;
+    }
+
+    int batchHeight;
+    NodeT* batch = linkSorted(&nodes[0], count, batchHeight);
+    std::vector<NodeT*> garbage;
+    TakeOther takeOther;
+    int height;
+    this->resetFinger();
+    this->root_ = unionSubtrees(this->root_, subtreeHeight(this->root_), batch, batchHeight,
+                                takeOther, forksFor(threads), garbage, height);
+    // Keys that already existed kept their node; free the batch copies.
+    freeGarbage(garbage);
+}
+
+/**
+* Replaces the contents with the items of [first, last), which need not
+* be sorted; where a key repeats, its last occurrence wins. The items are
+* copied out and merge sorted, the surviving nodes allocated in key order
+* (so neighbours in the tree are neighbours in memory, as after
+* bulk_load) and linked bottom-up into a balanced tree in O(n), without
+* a single descent or rotation.
+*
+* With threads > 1 the sort, the merges and the linking of subtrees are
+* shared by up to that many threads; allocation stays on the calling
+* thread like in insert_batch. Needs room for two copies of the items
+* while sorting. If anything throws the tree keeps its old contents.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+template<typename InputIt>
+void AVLTree<Key, Value, Alloc, NodeT, Compare>::build_parallel(InputIt first, InputIt last, unsigned threads)
+{
+    std::vector<BuildItem> items;
+    for(; first != last; ++first) {
+        items.push_back(BuildItem(*first));
+    }
+    if(items.empty()) {
+        this->clear();
+        return;
+    }
+
+    unsigned forks = forksFor(threads);
+    {
+        std::vector<BuildItem> buffer(items);
+        sortItems(&items[0], &buffer[0], items.size(), false, forks);
+    }
+
+    // Among equal keys the sort kept input order, so keep the last one.
+    std::vector<NodeT*> nodes;
+    try {
+        for(std::size_t i = 0; i < items.size(); ++i) {
+            if(i + 1 < items.size() && !this->comp_(items[i].first, items[i + 1].first)) {
+                continue;
+            }
+            nodes.push_back(this->createNode(InPlaceItem(), std::move(items[i])));
+        }
+    }
+    catch(...) {
+        for(std::size_t i = 0; i < nodes.size(); ++i) {
+            this->destroyNode(nodes[i]);
+        }
+        throw;
+    }
+    std::vector<BuildItem>().swap(items);
+
+    int height;
+    NodeT* built = linkSorted(&nodes[0], nodes.size(), height, forks);
+    this->clear();
+    this->root_ = built;
+}
+
+/**
+* Merges a copy of other into this tree in O(m log(n/m + 1)); see
+* unionSubtrees. resolve must be safe to call from several threads at
+* once when threads > 1. A throwing resolve goes through ResolveGuard:
+* the tree ends up whole and the exception is rethrown here.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+template<typename Resolve>
+void AVLTree<Key, Value, Alloc, NodeT, Compare>::union_with(const AVLTree& other, Resolve resolve, unsigned threads)
+{
+    NodeT* theirs = adoptNodes(other);
+    std::vector<NodeT*> garbage;
+    ResolveGuard<Resolve> guarded(resolve);
+    int height;
+    this->resetFinger();
+    this->root_ = unionSubtrees(this->root_, subtreeHeight(this->root_), theirs, subtreeHeight(theirs),
+                                guarded, forksFor(threads), garbage, height);
+    freeGarbage(garbage);
+    guarded.rethrow();
+}
+
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+template<typename Resolve>
+void AVLTree<Key, Value, Alloc, NodeT, Compare>::union_with(AVLTree&& other, Resolve resolve, unsigned threads)
+{
+    if(&other == this) {
+        return;
+    }
+    NodeT* theirs = adoptNodes(std::move(other));
+    std::vector<NodeT*> garbage;
+    ResolveGuard<Resolve> guarded(resolve);
+    int height;
+    this->resetFinger();
+    this->root_ = unionSubtrees(this->root_, subtreeHeight(this->root_), theirs, subtreeHeight(theirs),
+                                guarded, forksFor(threads), garbage, height);
+    freeGarbage(garbage);
+    guarded.rethrow();
+}
+
+/**
+* Keeps only the keys also present in other.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+template<typename Resolve>
+void AVLTree<Key, Value, Alloc, NodeT, Compare>::intersect_with(const AVLTree& other, Resolve resolve, unsigned threads)
+{
+    NodeT* theirs = adoptNodes(other);
+    std::vector<NodeT*> garbage;
+    ResolveGuard<Resolve> guarded(resolve);
+    int height;
+    this->resetFinger();
+    this->root_ = intersectSubtrees(this->root_, subtreeHeight(this->root_), theirs, subtreeHeight(theirs),
+                                    guarded, forksFor(threads), garbage, height);
+    freeGarbage(garbage);
+    guarded.rethrow();
+}
+
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+template<typename Resolve>
+void AVLTree<Key, Value, Alloc, NodeT, Compare>::intersect_with(AVLTree&& other, Resolve resolve, unsigned threads)
+{
+    if(&other == this) {
+        return;
+    }
+    NodeT* theirs = adoptNodes(std::move(other));
+    std::vector<NodeT*> garbage;
+    ResolveGuard<Resolve> guarded(resolve);
+    int height;
+    this->resetFinger();
+    this->root_ = intersectSubtrees(this->root_, subtreeHeight(this->root_), theirs, subtreeHeight(theirs),
+                                    guarded, forksFor(threads), garbage, height);
+    freeGarbage(garbage);
+    guarded.rethrow();
+}
+
+/**
+* Removes every key that is present in other.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+void AVLTree<Key, Value, Alloc, NodeT, Compare>::difference(const AVLTree& other, unsigned threads)
+{
+    if(&other == this) {
+        this->clear();
+        return;
+    }
+    // other's nodes are only looked at, but the walk takes them apart, so
+    // it needs a copy of its own.
+    NodeT* theirs = adoptNodes(other);
+    std::vector<NodeT*> garbage;
+    int height;
+    this->resetFinger();
+    this->root_ = differenceSubtrees(this->root_, subtreeHeight(this->root_), theirs, subtreeHeight(theirs),
+                                     forksFor(threads), garbage, height);
+    freeGarbage(garbage);
+}
+
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+void AVLTree<Key, Value, Alloc, NodeT, Compare>::difference(AVLTree&& other, unsigned threads)
+{
+    if(&other == this) {
+        this->clear();
+        return;
+    }
+    NodeT* theirs = adoptNodes(std::move(other));
+    std::vector<NodeT*> garbage;
+    int height;
+    this->resetFinger();
+    this->root_ = differenceSubtrees(this->root_, subtreeHeight(this->root_), theirs, subtreeHeight(theirs),
+                                     forksFor(threads), garbage, height);
+    freeGarbage(garbage);
+}
+
+/**
+* Splits the tree at key in O(log n): keys below it stay, keys from it up
+* move, nodes and all, into the returned tree, which shares this tree's
+* allocator. Nothing is copied. With SubtreeSize nodes both sizes are
+* read off the roots; otherwise the next size() call on either tree
+* counts it in O(n).
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+AVLTree<Key, Value, Alloc, NodeT, Compare> AVLTree<Key, Value, Alloc, NodeT, Compare>::split(const Key& key)
+{
+    NodeT* left;
+    NodeT* right;
+    NodeT* found;
+    int leftHeight, rightHeight;
+    splitSubtree(this->root_, subtreeHeight(this->root_), key, left, leftHeight, found, right, rightHeight);
+    if(found != nullptr) {
+        right = joinSubtrees(nullptr, 0, found, right, rightHeight, rightHeight);
+    }
+    typename std::is_base_of<SubtreeSize, NodeT>::type counted;
+    this->resetFinger();
+    this->root_ = left;
+    this->size_.store(splitSize(left, counted), std::memory_order_relaxed);
+    AVLTree<Key, Value, Alloc, NodeT, Compare> upper(this->comp_, this->alloc_);
+    upper.root_ = right;
+    upper.size_.store(splitSize(right, counted), std::memory_order_relaxed);
+    return upper;
+}
+
+/**
+* Joins other into this tree in O(log n) and leaves other empty. All of
+* other's keys must be above all of this tree's or all below them, else
+* std::invalid_argument is thrown and neither tree changes. If the two
+* allocators differ, other's items are moved into new nodes first (O(m)).
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+void AVLTree<Key, Value, Alloc, NodeT, Compare>::concat(AVLTree& other)
+{
+    if(&other == this || other.root_ == nullptr) {
+        return;
+    }
+    if(this->root_ != nullptr) {
+        NodeT* mine = this->root_;
+        NodeT* theirs = other.root_;
+        NodeT* myMin = mine;
+        NodeT* myMax = mine;
+        NodeT* theirMin = theirs;
+        NodeT* theirMax = theirs;
+        while(myMin->getLeft() != nullptr) myMin = myMin->getLeft();
+        while(myMax->getRight() != nullptr) myMax = myMax->getRight();
+        while(theirMin->getLeft() != nullptr) theirMin = theirMin->getLeft();
+        while(theirMax->getRight() != nullptr) theirMax = theirMax->getRight();
+        if(!this->comp_(myMax->getKey(), theirMin->getKey()) && !this->comp_(theirMax->getKey(), myMin->getKey())) {
+            throw std::invalid_argument("concat: key ranges overlap");
+        }
+    }
+    NodeT* theirs = adoptNodes(std::move(other));
+    this->resetFinger();
+    if(this->root_ == nullptr) {
+        this->root_ = theirs;
+        return;
+    }
+    int height;
+    if(this->comp_(this->root_->getKey(), theirs->getKey())) {
+        this->root_ = concatSubtrees(this->root_, subtreeHeight(this->root_), theirs, subtreeHeight(theirs), height);
+    }
+    else {
+        this->root_ = concatSubtrees(theirs, subtreeHeight(theirs), this->root_, subtreeHeight(this->root_), height);
+    }
+}
+
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+void AVLTree<Key, Value, Alloc, NodeT, Compare>::concat(AVLTree&& other)
+{
+    concat(other);
+}
+
+/**
+* Returns a detached copy of other's nodes drawn from this tree's allocator.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+NodeT* AVLTree<Key, Value, Alloc, NodeT, Compare>::adoptNodes(const AVLTree& other)
+{
+    return this->template cloneSubtree<false>(other.root_);
+}
+
+/**
+* Takes other's nodes as they are if this tree's allocator can free them,
+* otherwise moves its items into new nodes. other is left empty.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+NodeT* AVLTree<Key, Value, Alloc, NodeT, Compare>::adoptNodes(AVLTree&& other)
+{
+    NodeT* nodes;
+    if(this->alloc_ == other.alloc_) {
+        nodes = other.root_;
+        std::size_t mine = this->size_.load(std::memory_order_relaxed);
+        std::size_t theirs = other.size_.load(std::memory_order_relaxed);
+        bool unknown = mine == this->kSizeUnknown || theirs == this->kSizeUnknown;
+        this->size_.store(unknown ? this->kSizeUnknown : mine + theirs, std::memory_order_relaxed);
+        other.root_ = nullptr;
+        other.size_.store(0, std::memory_order_relaxed);
+        other.resetFinger();
+    }
+    else {
+        nodes = this->template cloneSubtree<true>(other.root_);
+        other.clear();
+    }
+    return nodes;
+}
+
+/**
+* The size of a part split off the tree: its root's subtree size when
+* the nodes keep one, else unknown.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+std::size_t AVLTree<Key, Value, Alloc, NodeT, Compare>::splitSize(NodeT* root, std::true_type)
+{
+    return root == nullptr ? 0 : root->subtreeSize();
+}
+
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+std::size_t AVLTree<Key, Value, Alloc, NodeT, Compare>::splitSize(NodeT* root, std::false_type)
+{
+    return root == nullptr ? 0 : BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::kSizeUnknown;
+}
+
+/**
+* The AVL invariant holds after every public operation.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+bool AVLTree<Key, Value, Alloc, NodeT, Compare>::isBalanced() const
+{
+    return true;
+}
+
+/**
+* O(log n), following the balance factors down the taller side.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+int AVLTree<Key, Value, Alloc, NodeT, Compare>::height() const
+{
+    return subtreeHeight(this->root_);
+}
+
+/**
+* Frees the subtrees collected by a set operation.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+void AVLTree<Key, Value, Alloc, NodeT, Compare>::freeGarbage(std::vector<NodeT*>& garbage)
+{
+    for(std::size_t i = 0; i < garbage.size(); ++i) {
+        this->destroySubtree(garbage[i]);
+    }
+    garbage.clear();
+}
+
+/**
+* Called once a new leaf has been linked in: walks up adjusting balance
+* factors until a subtree's height stops growing, rotating at most once.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+void AVLTree<Key, Value, Alloc, NodeT, Compare>::insertFixup(NodeT* node)
+{
+    NodeT* child = node;
+    NodeT* current = node->getParent();
     while(current != nullptr) {
         if(child == current->getLeft())
             current->updateBalance(-1);
@@ -200,82 +753,59 @@ void AVLTree<Key, Value>::insert (const std::pair<const Key, Value> &new_item)
         
         child = current;
         current = current->getParent();
-    
     }
 }
 
-/*
- * Recall: The writeup specifies that if a node has 2 children you
- * should swap with the predecessor and then remove.
- */
-template<class Key, class Value>
-void AVLTree<Key, Value>:: remove(const Key& key)
-{
-    // TODO
-    // Find the node to remove.
-    AVLNode<Key, Value>* nodeToRemove = static_cast<AVLNode<Key, Value>*>(this->internalFind(key));
-    if (nodeToRemove == nullptr)
-        return;  // Key not found.
-    
-    AVLNode<Key, Value>* parent = nodeToRemove->getParent();
-    
-    // If the node has two children, swap it with its predecessor.
-    if (nodeToRemove->getLeft() != nullptr && nodeToRemove->getRight() != nullptr) {
-        AVLNode<Key, Value>* pred = static_cast<AVLNode<Key, Value>*>(this->predecessor(nodeToRemove));
-        // Use the provided base class nodeSwap (which swaps pointers, not just key/value).
-        this->nodeSwap(nodeToRemove, pred);
-        // After swapping, update the parent pointer.
-        parent = nodeToRemove->getParent();
-    }
-    
-    // Now nodeToRemove has at most one child.
-    AVLNode<Key, Value>* child = (nodeToRemove->getLeft() != nullptr) ? nodeToRemove->getLeft() : nodeToRemove->getRight();
-    if(child != nullptr)
-        child->setParent(parent);
-    
-    if(parent == nullptr) {
-        // Removing the root.
-        this->root_ = child;
-        delete nodeToRemove;
-        return;
-    }
-    else if(nodeToRemove == parent->getLeft()) {
-        parent->setLeft(child);
-        parent->updateBalance(1);  // Removal from the left increases parent's balance.
-    }
-    else {
-        parent->setRight(child);
-        parent->updateBalance(-1); // Removal from the right decreases parent's balance.
-    }
-    
-    delete nodeToRemove;
-    
-    // Propagate balance updates upward.
-    AVLNode<Key, Value>* current = parent;
+/**
+* Called once a node has been unlinked from below parent (on the left if
+* fromLeft): walks up while subtree heights keep shrinking, rotating
+* wherever a balance factor reaches 2 or -2.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+void AVLTree<Key, Value, Alloc, NodeT, Compare>::removeFixup(NodeT* parent, bool fromLeft)
+{
+    NodeT* current = parent;
     while(current != nullptr) {
+        // Removal from the left increases the balance, from the right decreases it.
+        current->updateBalance(fromLeft ? 1 : -1);
+
         // If the absolute balance factor is 1, the height didn't change; stop.
         if(std::abs(current->getBalance()) == 1)
             break;
-        else if(std::abs(current->getBalance()) == 2)
+        if(std::abs(current->getBalance()) == 2) {
             rebalance(current);
-        
-        current = current->getParent();
+            current = current->getParent();  // root of the rotated subtree
+            // A rotation that leaves the new root tilted keeps the old height.
+            if(current->getBalance() != 0)
+                break;
+        }
+
+        NodeT* up = current->getParent();
+        if(up != nullptr)
+            fromLeft = (current == up->getLeft());
+        current = up;
     }
 }
-template<class Key, class Value>
-void AVLTree<Key, Value>::rotateLeft(AVLNode<Key, Value>* node)
+
+/**
+* Rotates the subtree at node to the left and returns its new root. The
+* link from node's parent, if any, is redirected; the tree's root_ is
+* not touched, so this also works on detached subtrees.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+NodeT* AVLTree<Key, Value, Alloc, NodeT, Compare>::rotateLeft(NodeT* node)
 {
-    AVLNode<Key, Value>* r = node->getRight();
+    NodeT* r = node->getRight();
     node->setRight(r->getLeft());
     if (r->getLeft() != nullptr)
         r->getLeft()->setParent(node);
     r->setParent(node->getParent());
-    if (node->getParent() == nullptr)
-        this->root_ = r;
-    else if (node == node->getParent()->getLeft())
-        node->getParent()->setLeft(r);
-    else
-        node->getParent()->setRight(r);
+    if (node->getParent() != nullptr) {
+        if (node == node->getParent()->getLeft())
+            node->getParent()->setLeft(r);
+        else
+            node->getParent()->setRight(r);
+    }
     r->setLeft(node);
     node->setParent(r);
     
@@ -283,65 +813,592 @@ void AVLTree<Key, Value>::rotateLeft(AVLNode<Key, Value>* node)
     int8_t rBalance = r->getBalance();
     node->setBalance(node->getBalance() - 1 - std::max(rBalance, (int8_t)0));
     r->setBalance(r->getBalance() - 1 + std::min(node->getBalance(), (int8_t)0));
+    node->pull();
+    r->pull();
+    return r;
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::rotateRight(AVLNode<Key, Value>* node)
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+NodeT* AVLTree<Key, Value, Alloc, NodeT, Compare>::rotateRight(NodeT* node)
 {
-    AVLNode<Key, Value>* l = node->getLeft();
+    NodeT* l = node->getLeft();
     node->setLeft(l->getRight());
     if (l->getRight() != nullptr)
         l->getRight()->setParent(node);
     l->setParent(node->getParent());
-    if (node->getParent() == nullptr)
-        this->root_ = l;
-    else if (node == node->getParent()->getRight())
-        node->getParent()->setRight(l);
-    else
-        node->getParent()->setLeft(l);
+    if (node->getParent() != nullptr) {
+        if (node == node->getParent()->getRight())
+            node->getParent()->setRight(l);
+        else
+            node->getParent()->setLeft(l);
+    }
     l->setRight(node);
     node->setParent(l);
     
     int8_t lBalance = l->getBalance();
     node->setBalance(node->getBalance() + 1 - std::min(lBalance, (int8_t)0));
     l->setBalance(l->getBalance() + 1 + std::max(node->getBalance(), (int8_t)0));
+    node->pull();
+    l->pull();
+    return l;
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::rebalance(AVLNode<Key, Value>* node)
+/**
+* Rebalances the subtree at node (balance 2 or -2) and returns its new
+* root, without touching root_.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+NodeT* AVLTree<Key, Value, Alloc, NodeT, Compare>::rebalanceSubtree(NodeT* node)
 {
     if (node->getBalance() == -2) {
         if (node->getLeft()->getBalance() <= 0)
-            rotateRight(node);        // Left-Left case.
-        else {
-            rotateLeft(node->getLeft()); // Left-Right case.
-            rotateRight(node);
-        }
+            return rotateRight(node);        // Left-Left case.
+        rotateLeft(node->getLeft());         // Left-Right case.
+        return rotateRight(node);
     }
     else if (node->getBalance() == 2) {
         if (node->getRight()->getBalance() >= 0)
-            rotateLeft(node);         // Right-Right case.
-        else {
-            rotateRight(node->getRight()); // Right-Left case.
-            rotateLeft(node);
+            return rotateLeft(node);         // Right-Right case.
+        rotateRight(node->getRight());       // Right-Left case.
+        return rotateLeft(node);
+    }
+    return node;
+}
+
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+void AVLTree<Key, Value, Alloc, NodeT, Compare>::rebalance(NodeT* node)
+{
+    NodeT* top = rebalanceSubtree(node);
+    if (top->getParent() == nullptr)
+        this->root_ = top;
+}
+
+/**
+* Height of a subtree, found by walking down its taller side: O(log n).
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+int AVLTree<Key, Value, Alloc, NodeT, Compare>::subtreeHeight(NodeT* node)
+{
+    int height = 0;
+    while(node != nullptr) {
+        ++height;
+        node = node->getBalance() > 0 ? node->getRight() : node->getLeft();
+    }
+    return height;
+}
+
+/**
+* The subtree rooted at child has just grown by one level: walks up
+* adjusting balances like insertFixup, but on a detached subtree whose
+* root is top. Unlike an insert, a join can leave the taller child with
+* balance 0, and then the rotation does not absorb the growth, so the walk
+* goes on. Returns the (possibly new) root; grew tells whether the whole
+* subtree ended up one level taller.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+NodeT* AVLTree<Key, Value, Alloc, NodeT, Compare>::growFixup(NodeT* child,
+                                                          NodeT* top, bool& grew)
+{
+    NodeT* current = child->getParent();
+    while(current != nullptr) {
+        current->updateBalance(child == current->getLeft() ? -1 : 1);
+        if(current->getBalance() == 0) {
+            grew = false;
+            return top;
+        }
+        if(std::abs(current->getBalance()) == 2) {
+            NodeT* heavy = current->getBalance() > 0 ? current->getRight() : current->getLeft();
+            bool stillGrown = (heavy->getBalance() == 0);
+            current = rebalanceSubtree(current);
+            if(current->getParent() == nullptr) {
+                top = current;
+            }
+            if(!stillGrown) {
+                grew = false;
+                return top;
+            }
         }
+        child = current;
+        current = current->getParent();
     }
+    grew = true;
+    return top;
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::nodeSwap(Node<Key,Value>* n1, Node<Key,Value>* n2)
+/**
+* Joins left < mid < right into one AVL subtree and returns its root;
+* mid is a detached node. The shorter side is hung off the spine of the
+* taller one where the heights meet, and the growth retraced from there.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+NodeT* AVLTree<Key, Value, Alloc, NodeT, Compare>::joinSubtrees(NodeT* left, int leftHeight,
+                                                             NodeT* mid,
+                                                             NodeT* right, int rightHeight,
+                                                             int& height)
 {
-    // First, call the base class version to swap the Node parts.
-    BinarySearchTree<Key, Value>::nodeSwap(n1, n2);
-    
-    // Then, cast to AVLNode pointers to swap the AVL-specific balance.
-    AVLNode<Key, Value>* avl1 = static_cast<AVLNode<Key, Value>*>(n1);
-    AVLNode<Key, Value>* avl2 = static_cast<AVLNode<Key, Value>*>(n2);
-    
-    int8_t tempB = avl1->getBalance();
-    avl1->setBalance(avl2->getBalance());
-    avl2->setBalance(tempB);
+    if(std::abs(leftHeight - rightHeight) <= 1) {
+        mid->setParent(nullptr);
+        mid->setLeft(left);
+        mid->setRight(right);
+        if(left != nullptr) left->setParent(mid);
+        if(right != nullptr) right->setParent(mid);
+        mid->setBalance(static_cast<int8_t>(rightHeight - leftHeight));
+        mid->pull();
+        height = 1 + std::max(leftHeight, rightHeight);
+        return mid;
+    }
+
+    bool tallLeft = leftHeight > rightHeight;
+    NodeT* top = tallLeft ? left : right;
+    NodeT* shortSide = tallLeft ? right : left;
+    int shortHeight = tallLeft ? rightHeight : leftHeight;
+
+    // Walk down the inner spine (right spine of left, or left spine of
+    // right) until the subtree there is no more than one level taller.
+    NodeT* parent = nullptr;
+    NodeT* spine = top;
+    int spineHeight = tallLeft ? leftHeight : rightHeight;
+    while(spineHeight > shortHeight + 1) {
+        int8_t balance = spine->getBalance();
+        spineHeight -= (tallLeft ? balance < 0 : balance > 0) ? 2 : 1;
+        parent = spine;
+        spine = tallLeft ? spine->getRight() : spine->getLeft();
+    }
+
+    mid->setParent(parent);
+    if(tallLeft) {
+        parent->setRight(mid);
+        mid->setLeft(spine);
+        mid->setRight(shortSide);
+        mid->setBalance(static_cast<int8_t>(shortHeight - spineHeight));
+    }
+    else {
+        parent->setLeft(mid);
+        mid->setLeft(shortSide);
+        mid->setRight(spine);
+        mid->setBalance(static_cast<int8_t>(spineHeight - shortHeight));
+    }
+    if(spine != nullptr) spine->setParent(mid);
+    if(shortSide != nullptr) shortSide->setParent(mid);
+
+    bool grew;
+    top = growFixup(mid, top, grew);
+    // Every spine node above mid gained the short side.
+    BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::pullPath(mid);
+    height = (tallLeft ? leftHeight : rightHeight) + (grew ? 1 : 0);
+    return top;
+}
+
+/**
+* Splits the subtree at root into the keys below key (left) and above it
+* (right), both detached. If key is present its node is detached and
+* returned in found, else found is nullptr.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+void AVLTree<Key, Value, Alloc, NodeT, Compare>::splitSubtree(NodeT* root, int height, const Key& key,
+                                             NodeT*& left, int& leftHeight,
+                                             NodeT*& found,
+                                             NodeT*& right, int& rightHeight) const
+{
+    if(root == nullptr) {
+        left = right = found = nullptr;
+        leftHeight = rightHeight = 0;
+        return;
+    }
+    NodeT* l;
+    NodeT* r;
+    int lh, rh;
+    detachChildren(root, height, l, lh, r, rh);
+
+    int order = this->compareKeys(key, root->getKey());
+    if(order < 0) {
+        NodeT* inner;
+        int innerHeight;
+        splitSubtree(l, lh, key, left, leftHeight, found, inner, innerHeight);
+        right = joinSubtrees(inner, innerHeight, root, r, rh, rightHeight);
+    }
+    else if(order > 0) {
+        NodeT* inner;
+        int innerHeight;
+        splitSubtree(r, rh, key, inner, innerHeight, found, right, rightHeight);
+        left = joinSubtrees(l, lh, root, inner, innerHeight, leftHeight);
+    }
+    else {
+        left = l;
+        leftHeight = lh;
+        right = r;
+        rightHeight = rh;
+        found = root;
+    }
+}
+
+/**
+* Unlinks the two subtrees of the detached node root (of the given
+* height) and reports their heights, read off root's balance.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+void AVLTree<Key, Value, Alloc, NodeT, Compare>::detachChildren(NodeT* root, int height,
+                                               NodeT*& left, int& leftHeight,
+                                               NodeT*& right, int& rightHeight)
+{
+    left = root->getLeft();
+    right = root->getRight();
+    leftHeight = height - 1 - (root->getBalance() > 0 ? 1 : 0);
+    rightHeight = height - 1 - (root->getBalance() < 0 ? 1 : 0);
+    if(left != nullptr) left->setParent(nullptr);
+    if(right != nullptr) right->setParent(nullptr);
+    root->setLeft(nullptr);
+    root->setRight(nullptr);
+    root->setParent(nullptr);
+    root->pull();
+}
+
+/**
+* Detaches the largest node of a non-empty subtree into last and returns
+* what remains.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+NodeT* AVLTree<Key, Value, Alloc, NodeT, Compare>::splitLast(NodeT* root, int height,
+                                                          NodeT*& last, int& newHeight)
+{
+    NodeT* l;
+    NodeT* r;
+    int lh, rh;
+    detachChildren(root, height, l, lh, r, rh);
+    if(r == nullptr) {
+        last = root;
+        newHeight = lh;
+        return l;
+    }
+    r = splitLast(r, rh, last, rh);
+    return joinSubtrees(l, lh, root, r, rh, newHeight);
+}
+
+/**
+* Joins two subtrees with every key of left below every key of right.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+NodeT* AVLTree<Key, Value, Alloc, NodeT, Compare>::concatSubtrees(NodeT* left, int leftHeight,
+                                                               NodeT* right, int rightHeight,
+                                                               int& height)
+{
+    if(left == nullptr) {
+        height = rightHeight;
+        return right;
+    }
+    if(right == nullptr) {
+        height = leftHeight;
+        return left;
+    }
+    NodeT* last;
+    left = splitLast(left, leftHeight, last, leftHeight);
+    return joinSubtrees(left, leftHeight, last, right, rightHeight, height);
+}
+
+/**
+* Links count detached nodes, sorted by key, into a balanced subtree.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+NodeT* AVLTree<Key, Value, Alloc, NodeT, Compare>::linkSorted(NodeT** nodes, std::size_t count, int& height,
+                                                           unsigned forks)
+{
+    if(count == 0) {
+        height = 0;
+        return nullptr;
+    }
+    std::size_t mid = count / 2;
+    int leftHeight, rightHeight;
+    NodeT* left = nullptr;
+    NodeT* right = nullptr;
+    bool fork = forks > 0 && count >> kForkHeight != 0;
+    unsigned childForks = forks > 0 ? forks - 1 : 0;
+    forkJoin(fork,
+             [&]() { left = linkSorted(nodes, mid, leftHeight, childForks); },
+             [&]() { right = linkSorted(nodes + mid + 1, count - mid - 1, rightHeight, childForks); });
+    return joinSubtrees(left, leftHeight, nodes[mid], right, rightHeight, height);
+}
+
+/**
+* Sorts the count items at from by key, stably, with up to 2^forks
+* threads: both halves are sorted into the other array and merged back.
+* to is scratch space of the same size holding constructed items.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+void AVLTree<Key, Value, Alloc, NodeT, Compare>::sortItems(BuildItem* from, BuildItem* to, std::size_t count,
+                                                        bool toOther, unsigned forks) const
+{
+    if(forks == 0 || count < kForkItems) {
+        const Compare& comp = this->comp_;
+        std::stable_sort(from, from + count,
+                         [&comp](const BuildItem& a, const BuildItem& b) {
+                             return comp(a.first, b.first);
+                         });
+        if(toOther) {
+            std::move(from, from + count, to);
+        }
+        return;
+    }
+    std::size_t mid = count / 2;
+    forkJoin(true,
+             [&]() { sortItems(from, to, mid, !toOther, forks - 1); },
+             [&]() { sortItems(from + mid, to + mid, count - mid, !toOther, forks - 1); });
+    if(toOther) {
+        mergeItems(from, mid, from + mid, count - mid, to, forks);
+    }
+    else {
+        mergeItems(to, mid, to + mid, count - mid, from, forks);
+    }
 }
 
+/**
+* Moves the merge of two sorted runs to out, taking from left first among
+* equal keys. Above kForkItems the larger run is cut in half, the other
+* at the matching key, and the two pieces merged on separate threads.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+void AVLTree<Key, Value, Alloc, NodeT, Compare>::mergeItems(BuildItem* left, std::size_t leftCount,
+                                                         BuildItem* right, std::size_t rightCount,
+                                                         BuildItem* out, unsigned forks) const
+{
+    const Compare& comp = this->comp_;
+    if(forks == 0 || leftCount + rightCount < kForkItems) {
+        std::merge(std::make_move_iterator(left), std::make_move_iterator(left + leftCount),
+                   std::make_move_iterator(right), std::make_move_iterator(right + rightCount),
+                   out,
+                   [&comp](const BuildItem& a, const BuildItem& b) {
+                       return comp(a.first, b.first);
+                   });
+        return;
+    }
+    // Equal keys from right must stay behind those from left.
+    std::size_t leftMid, rightMid;
+    if(leftCount >= rightCount) {
+        leftMid = leftCount / 2;
+        rightMid = std::lower_bound(right, right + rightCount, left[leftMid],
+                                    [&comp](const BuildItem& a, const BuildItem& b) {
+                                        return comp(a.first, b.first);
+                                    }) - right;
+    }
+    else {
+        rightMid = rightCount / 2;
+        leftMid = std::upper_bound(left, left + leftCount, right[rightMid],
+                                   [&comp](const BuildItem& a, const BuildItem& b) {
+                                       return comp(a.first, b.first);
+                                   }) - left;
+    }
+    forkJoin(true,
+             [&]() { mergeItems(left, leftMid, right, rightMid, out, forks - 1); },
+             [&]() { mergeItems(left + leftMid, leftCount - leftMid, right + rightMid, rightCount - rightMid,
+                                out + leftMid + rightMid, forks - 1); });
+}
+
+/**
+* Runs leftFn on a new thread and rightFn on this one when fork is set,
+* or both here. A thread that cannot be started is not an error.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+template<typename LeftFn, typename RightFn>
+void AVLTree<Key, Value, Alloc, NodeT, Compare>::forkJoin(bool fork, LeftFn leftFn, RightFn rightFn)
+{
+    std::thread worker;
+    if(fork) {
+        try {
+            worker = std::thread(leftFn);
+        }
+        catch(const std::system_error&) {
+            // Fall through and run it here.
+        }
+    }
+    rightFn();
+    if(worker.joinable()) {
+        worker.join();
+    }
+    else {
+        leftFn();
+    }
+}
+
+/**
+* Levels of fork-join recursion that keep threads (at most) busy.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+unsigned AVLTree<Key, Value, Alloc, NodeT, Compare>::forksFor(unsigned threads)
+{
+    unsigned forks = 0;
+    while((1u << forks) < threads && forks < 16) {
+        ++forks;
+    }
+    return forks;
+}
+
+/**
+* Union by divide and conquer (Blelloch, Ferizovic and Sun, "Just Join
+* for Parallel Ordered Sets"): split mine at the key of theirs' root,
+* unite the matching halves, and join the results around that root.
+* Work is O(m log(n/m + 1)) for the smaller size m. Where a key is in
+* both, mine's node stays (with the resolved value) and theirs goes to
+* garbage.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+template<typename Resolve>
+NodeT* AVLTree<Key, Value, Alloc, NodeT, Compare>::unionSubtrees(NodeT* mine, int mineHeight,
+                                                              NodeT* theirs, int theirsHeight,
+                                                              Resolve& resolve, unsigned forks,
+                                                              std::vector<NodeT*>& garbage,
+                                                              int& height) const
+{
+    if(theirs == nullptr) {
+        height = mineHeight;
+        return mine;
+    }
+    if(mine == nullptr) {
+        height = theirsHeight;
+        return theirs;
+    }
+    NodeT* tl;
+    NodeT* tr;
+    int tlh, trh;
+    bool fork = forks > 0 && std::min(mineHeight, theirsHeight) >= kForkHeight;
+    detachChildren(theirs, theirsHeight, tl, tlh, tr, trh);
+    NodeT* ml;
+    NodeT* mr;
+    NodeT* mid;
+    int mlh, mrh;
+    splitSubtree(mine, mineHeight, theirs->getKey(), ml, mlh, mid, mr, mrh);
+    if(mid != nullptr) {
+        Value kept = resolve(mid->getKey(), mid->getValue(), theirs->getValue());
+        mid->getValue() = std::move(kept);
+        garbage.push_back(theirs);
+    }
+    else {
+        mid = theirs;
+    }
+
+    std::vector<NodeT*> leftGarbage;
+    std::vector<NodeT*>& lg = fork ? leftGarbage : garbage;
+    unsigned sub = fork ? forks - 1 : 0;
+    forkJoin(fork,
+             [&]() { ml = unionSubtrees(ml, mlh, tl, tlh, resolve, sub, lg, mlh); },
+             [&]() { mr = unionSubtrees(mr, mrh, tr, trh, resolve, sub, garbage, mrh); });
+    garbage.insert(garbage.end(), leftGarbage.begin(), leftGarbage.end());
+    return joinSubtrees(ml, mlh, mid, mr, mrh, height);
+}
+
+/**
+* Intersection, same scheme as unionSubtrees: a key without a partner
+* on the other side is dropped, and the two halves are concatenated
+* without it.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+template<typename Resolve>
+NodeT* AVLTree<Key, Value, Alloc, NodeT, Compare>::intersectSubtrees(NodeT* mine, int mineHeight,
+                                                                  NodeT* theirs, int theirsHeight,
+                                                                  Resolve& resolve, unsigned forks,
+                                                                  std::vector<NodeT*>& garbage,
+                                                                  int& height) const
+{
+    if(mine == nullptr || theirs == nullptr) {
+        if(mine != nullptr) garbage.push_back(mine);
+        if(theirs != nullptr) garbage.push_back(theirs);
+        height = 0;
+        return nullptr;
+    }
+    NodeT* tl;
+    NodeT* tr;
+    int tlh, trh;
+    bool fork = forks > 0 && std::min(mineHeight, theirsHeight) >= kForkHeight;
+    detachChildren(theirs, theirsHeight, tl, tlh, tr, trh);
+    NodeT* ml;
+    NodeT* mr;
+    NodeT* mid;
+    int mlh, mrh;
+    splitSubtree(mine, mineHeight, theirs->getKey(), ml, mlh, mid, mr, mrh);
+    if(mid != nullptr) {
+        Value kept = resolve(mid->getKey(), mid->getValue(), theirs->getValue());
+        mid->getValue() = std::move(kept);
+    }
+    garbage.push_back(theirs);
+
+    std::vector<NodeT*> leftGarbage;
+    std::vector<NodeT*>& lg = fork ? leftGarbage : garbage;
+    unsigned sub = fork ? forks - 1 : 0;
+    forkJoin(fork,
+             [&]() { ml = intersectSubtrees(ml, mlh, tl, tlh, resolve, sub, lg, mlh); },
+             [&]() { mr = intersectSubtrees(mr, mrh, tr, trh, resolve, sub, garbage, mrh); });
+    garbage.insert(garbage.end(), leftGarbage.begin(), leftGarbage.end());
+    if(mid != nullptr) {
+        return joinSubtrees(ml, mlh, mid, mr, mrh, height);
+    }
+    return concatSubtrees(ml, mlh, mr, mrh, height);
+}
+
+/**
+* Difference (mine minus theirs), same scheme as unionSubtrees.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+NodeT* AVLTree<Key, Value, Alloc, NodeT, Compare>::differenceSubtrees(NodeT* mine, int mineHeight,
+                                                                   NodeT* theirs, int theirsHeight,
+                                                                   unsigned forks,
+                                                                   std::vector<NodeT*>& garbage,
+                                                                   int& height) const
+{
+    if(mine == nullptr || theirs == nullptr) {
+        if(theirs != nullptr) garbage.push_back(theirs);
+        height = mine != nullptr ? mineHeight : 0;
+        return mine;
+    }
+    NodeT* tl;
+    NodeT* tr;
+    int tlh, trh;
+    bool fork = forks > 0 && std::min(mineHeight, theirsHeight) >= kForkHeight;
+    detachChildren(theirs, theirsHeight, tl, tlh, tr, trh);
+    NodeT* ml;
+    NodeT* mr;
+    NodeT* mid;
+    int mlh, mrh;
+    splitSubtree(mine, mineHeight, theirs->getKey(), ml, mlh, mid, mr, mrh);
+    garbage.push_back(theirs);
+    if(mid != nullptr) {
+        garbage.push_back(mid);
+    }
+
+    std::vector<NodeT*> leftGarbage;
+    std::vector<NodeT*>& lg = fork ? leftGarbage : garbage;
+    unsigned sub = fork ? forks - 1 : 0;
+    forkJoin(fork,
+             [&]() { ml = differenceSubtrees(ml, mlh, tl, tlh, sub, lg, mlh); },
+             [&]() { mr = differenceSubtrees(mr, mrh, tr, trh, sub, garbage, mrh); });
+    garbage.insert(garbage.end(), leftGarbage.begin(), leftGarbage.end());
+    return concatSubtrees(ml, mlh, mr, mrh, height);
+}
+
+/**
+* An AVLTree whose nodes come from a private NodePool.
+*/
+template <class Key, class Value>
+using PooledAVLTree = AVLTree<Key, Value, PoolAllocator<std::pair<const Key, Value> > >;
+
+/**
+* An AVLTree that supports rank, select and count_range.
+*/
+template <class Key, class Value>
+using RankedAVLTree = AVLTree<Key, Value, std::allocator<std::pair<const Key, Value> >,
+                              AVLNode<Key, Value, SubtreeSize> >;
+
+/**
+* An AVLTree that answers aggregate(lo, hi) under Monoid, e.g.
+* AggregateAVLTree<int, long, SumMonoid<long> >.
+*/
+template <class Key, class Value, class Monoid>
+using AggregateAVLTree = AVLTree<Key, Value, std::allocator<std::pair<const Key, Value> >,
+                                 AVLNode<Key, Value, SubtreeAggregate<Monoid> > >;
+
+/**
+* An AVLTree ordered by Compare instead of operator<, e.g.
+* OrderedAVLTree<std::string, int, ThreeWayCompare>.
+*/
+template <class Key, class Value, class Compare>
+using OrderedAVLTree = AVLTree<Key, Value, std::allocator<std::pair<const Key, Value> >,
+                               AVLNode<Key, Value>, Compare>;
 
 #endif
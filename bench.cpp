@@ -0,0 +1,1609 @@
+#include <iostream>
+#include <vector>
+#include <map>
+#include <string>
+#include <cstdio>
+#include <cmath>
+#include <random>
+#include <chrono>
+#include <cstdlib>
+#include <cctype>
+#include <cstddef>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include "bst.h"
+#include "avlbst.h"
+#include "indexed_bst.h"
+#include "simd_index.h"
+#include "bplustree.h"
+#include "concurrent_avl.h"
+#include "sharded_map.h"
+#include "persistent_avl.h"
+
+using namespace std;
+
+// Micro-benchmarks for the search tree containers.
+// Usage: ./bench [suite ...] [n ...]   (default: every suite, sizes 100000 1000000)
+// e.g. ./bench compare 1000 10000 100000 1000000 10000000 (make bench-compare)
+// Output is CSV: suite,container,n,operation,ns_per_op,bytes_per_item
+
+typedef chrono::steady_clock Clock;
+
+// Keeps the optimizer from discarding lookup results.
+static volatile size_t sink;
+
+static double nsPerOp(Clock::time_point start, Clock::time_point stop, size_t ops)
+{
+    return chrono::duration<double, nano>(stop - start).count() / (ops ? ops : 1);
+}
+
+static void report(const string& suite, const string& container, size_t n,
+                   const string& op, double ns, double bytesPerItem)
+{
+    cout << suite << ',' << container << ',' << n << ',' << op << ','
+         << ns << ',' << bytesPerItem << endl;
+}
+
+// Bytes currently held through CountingAllocator.
+static size_t liveBytes = 0;
+
+/**
+* An allocator that forwards to std::allocator and tracks live bytes,
+* so the pointer-based trees can report their node footprint.
+*/
+template <typename T>
+struct CountingAllocator
+{
+    typedef T value_type;
+
+    CountingAllocator() {}
+    template <typename U>
+    CountingAllocator(const CountingAllocator<U>&) {}
+
+    T* allocate(size_t n)
+    {
+        liveBytes += n * sizeof(T);
+        return std::allocator<T>().allocate(n);
+    }
+    void deallocate(T* p, size_t n)
+    {
+        liveBytes -= n * sizeof(T);
+        std::allocator<T>().deallocate(p, n);
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const CountingAllocator<T>&, const CountingAllocator<U>&) { return true; }
+template <typename T, typename U>
+bool operator!=(const CountingAllocator<T>&, const CountingAllocator<U>&) { return false; }
+
+static vector<int> randomKeys(size_t n, unsigned seed)
+{
+    vector<int> keys(n);
+    for(size_t i = 0; i < n; ++i) {
+        keys[i] = static_cast<int>(i);
+    }
+    shuffle(keys.begin(), keys.end(), mt19937(seed));
+    return keys;
+}
+
+/**
+* Runs insert / find / iterate / remove over the given keys.
+* bytesOf(tree) reports the node storage held after all inserts.
+*/
+template <typename Tree, typename BytesOf>
+void runLayout(const string& suite, const string& name, const vector<int>& keys, BytesOf bytesOf)
+{
+    size_t n = keys.size();
+    vector<int> probe = randomKeys(n, 7);
+    Tree tree;
+
+    Clock::time_point t0 = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(make_pair(keys[i], keys[i]));
+    }
+    Clock::time_point t1 = Clock::now();
+    double bytes = static_cast<double>(bytesOf(tree)) / n;
+    report(suite, name, n, "insert", nsPerOp(t0, t1, n), bytes);
+
+    size_t found = 0;
+    t0 = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        found += (tree.find(probe[i]) != tree.end());
+    }
+    t1 = Clock::now();
+    sink = found;
+    report(suite, name, n, "find_hit", nsPerOp(t0, t1, n), bytes);
+
+    size_t sum = 0;
+    t0 = Clock::now();
+    for(typename Tree::iterator it = tree.begin(); it != tree.end(); ++it) {
+        sum += it->second;
+    }
+    t1 = Clock::now();
+    sink = sum;
+    report(suite, name, n, "iterate", nsPerOp(t0, t1, n), bytes);
+
+    t0 = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        tree.remove(probe[i]);
+    }
+    t1 = Clock::now();
+    report(suite, name, n, "remove", nsPerOp(t0, t1, n), bytes);
+}
+
+template <typename Tree>
+size_t countedBytes(const Tree&)
+{
+    return liveBytes;
+}
+
+template <typename Tree>
+size_t indexedBytes(const Tree& tree)
+{
+    return tree.memoryUsage();
+}
+
+/**
+* Pointer-linked nodes versus 32-bit index-linked slots, balanced and not.
+* The plain BST only gets random keys, which keeps it at O(log n) depth.
+*/
+static void benchNodeLayout(size_t n)
+{
+    typedef CountingAllocator<pair<const int, int> > Counting;
+    vector<int> keys = randomKeys(n, 1);
+    runLayout<BinarySearchTree<int, int, Counting> >("layout", "bst_pointer", keys, countedBytes<BinarySearchTree<int, int, Counting> >);
+    runLayout<IndexedBinarySearchTree<int, int> >("layout", "bst_index32", keys, indexedBytes<IndexedBinarySearchTree<int, int> >);
+    runLayout<AVLTree<int, int, Counting> >("layout", "avl_pointer", keys, countedBytes<AVLTree<int, int, Counting> >);
+    runLayout<IndexedAVLTree<int, int> >("layout", "avl_index32", keys, indexedBytes<IndexedAVLTree<int, int> >);
+}
+
+/**
+* Structural copy and O(n) teardown, against building the same tree
+* again by insertion.
+*/
+template <typename Tree>
+void runCopyClear(const string& name, const vector<int>& keys)
+{
+    size_t n = keys.size();
+    Tree tree;
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(make_pair(keys[i], keys[i]));
+    }
+
+    Clock::time_point t0 = Clock::now();
+    // Original (random) order: a sorted re-insert would degenerate the BST.
+    Tree rebuilt;
+    for(size_t i = 0; i < n; ++i) {
+        rebuilt.insert(make_pair(keys[i], keys[i]));
+    }
+    Clock::time_point t1 = Clock::now();
+    report("copy", name, n, "reinsert_copy", nsPerOp(t0, t1, n), 0);
+
+    t0 = Clock::now();
+    Tree copy(tree);
+    t1 = Clock::now();
+    report("copy", name, n, "clone", nsPerOp(t0, t1, n), 0);
+
+    t0 = Clock::now();
+    copy.clear();
+    t1 = Clock::now();
+    report("copy", name, n, "clear", nsPerOp(t0, t1, n), 0);
+
+    t0 = Clock::now();
+    Tree moved(std::move(rebuilt));
+    t1 = Clock::now();
+    report("copy", name, n, "move", nsPerOp(t0, t1, 1), 0);
+}
+
+static void benchCopyClear(size_t n)
+{
+    vector<int> keys = randomKeys(n, 1);
+    runCopyClear<BinarySearchTree<int, int> >("bst_pointer", keys);
+    runCopyClear<AVLTree<int, int> >("avl_pointer", keys);
+    runCopyClear<PooledAVLTree<int, int> >("avl_pooled", keys);
+}
+
+/**
+* Loading sorted input: n inserts against one bulk_load.
+*/
+template <typename Tree>
+void runSortedLoad(const string& name, size_t n)
+{
+    vector<pair<int, int> > items(n);
+    for(size_t i = 0; i < n; ++i) {
+        items[i] = make_pair(static_cast<int>(i), static_cast<int>(i));
+    }
+
+    Clock::time_point t0 = Clock::now();
+    Tree inserted;
+    for(size_t i = 0; i < n; ++i) {
+        inserted.insert(items[i]);
+    }
+    Clock::time_point t1 = Clock::now();
+    report("load", name, n, "sorted_insert", nsPerOp(t0, t1, n), 0);
+
+    t0 = Clock::now();
+    Tree loaded;
+    loaded.bulk_load(items.begin(), items.end());
+    t1 = Clock::now();
+    report("load", name, n, "bulk_load", nsPerOp(t0, t1, n), 0);
+}
+
+static void benchSortedLoad(size_t n)
+{
+    runSortedLoad<AVLTree<int, int> >("avl_pointer", n);
+    runSortedLoad<PooledAVLTree<int, int> >("avl_pooled", n);
+    runSortedLoad<BPlusTree<int, int> >("bplus_256", n);
+}
+
+/**
+* Applying a batch of m random updates to a tree of n items: one insert
+* per item against insert_batch with 1 and 4 threads.
+*/
+static void benchBatchInsert(size_t n)
+{
+    vector<int> keys = randomKeys(n, 1);
+    size_t sizes[] = { n / 100, n / 10, n };
+    for(size_t s = 0; s < 3; ++s) {
+        size_t m = sizes[s];
+        vector<pair<int, int> > batch(m);
+        mt19937 rng(5);
+        for(size_t i = 0; i < m; ++i) {
+            int key = static_cast<int>(rng() % (2 * n));
+            batch[i] = make_pair(key, key);
+        }
+        string name = "avl_pointer_m" + to_string(m);
+
+        AVLTree<int, int> single;
+        for(size_t i = 0; i < n; ++i) {
+            single.insert(make_pair(2 * keys[i], keys[i]));
+        }
+        AVLTree<int, int> batched1(single);
+        AVLTree<int, int> batched4(single);
+
+        Clock::time_point t0 = Clock::now();
+        for(size_t i = 0; i < m; ++i) {
+            single.insert(batch[i]);
+        }
+        Clock::time_point t1 = Clock::now();
+        report("batch", name, n, "insert_each", nsPerOp(t0, t1, m), 0);
+
+        t0 = Clock::now();
+        batched1.insert_batch(batch.begin(), batch.end());
+        t1 = Clock::now();
+        report("batch", name, n, "insert_batch_t1", nsPerOp(t0, t1, m), 0);
+
+        t0 = Clock::now();
+        batched4.insert_batch(batch.begin(), batch.end(), 4);
+        t1 = Clock::now();
+        report("batch", name, n, "insert_batch_t4", nsPerOp(t0, t1, m), 0);
+    }
+}
+
+/**
+* Union of two n-item trees with half their keys in common: iterating
+* one and inserting into the other, against union_with on 1 and 4
+* threads.
+*/
+static void benchSetAlgebra(size_t n)
+{
+    vector<int> keys = randomKeys(n, 1);
+    AVLTree<int, int> a;
+    AVLTree<int, int> b;
+    for(size_t i = 0; i < n; ++i) {
+        a.insert(make_pair(2 * keys[i], keys[i]));
+        b.insert(make_pair(3 * keys[i], keys[i]));
+    }
+
+    AVLTree<int, int> target(a);
+    Clock::time_point t0 = Clock::now();
+    for(AVLTree<int, int>::iterator it = b.begin(); it != b.end(); ++it) {
+        target.insert(*it);
+    }
+    Clock::time_point t1 = Clock::now();
+    report("setops", "avl_pointer", n, "union_insert_each", nsPerOp(t0, t1, n), 0);
+
+    unsigned threads[] = { 1, 4 };
+    for(size_t t = 0; t < 2; ++t) {
+        string suffix = "_t" + to_string(threads[t]);
+        AVLTree<int, int> u(a);
+        AVLTree<int, int> other(b);
+        t0 = Clock::now();
+        u.union_with(std::move(other), TakeOther(), threads[t]);
+        t1 = Clock::now();
+        report("setops", "avl_pointer", n, "union_with" + suffix, nsPerOp(t0, t1, n), 0);
+
+        AVLTree<int, int> i(a);
+        t0 = Clock::now();
+        i.intersect_with(b, TakeOther(), threads[t]);
+        t1 = Clock::now();
+        report("setops", "avl_pointer", n, "intersect_with" + suffix, nsPerOp(t0, t1, n), 0);
+
+        AVLTree<int, int> d(a);
+        t0 = Clock::now();
+        d.difference(b, threads[t]);
+        t1 = Clock::now();
+        report("setops", "avl_pointer", n, "difference" + suffix, nsPerOp(t0, t1, n), 0);
+    }
+}
+
+/**
+* Moving the top 1% of keys into another tree: remove and re-insert one
+* at a time, against split; then concat to put them back.
+*/
+static void benchSplitConcat(size_t n)
+{
+    vector<int> keys = randomKeys(n, 1);
+    AVLTree<int, int> tree;
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(make_pair(keys[i], keys[i]));
+    }
+    int boundary = static_cast<int>(n - n / 100);
+
+    AVLTree<int, int> byHand(tree);
+    AVLTree<int, int> upper;
+    Clock::time_point t0 = Clock::now();
+    for(int k = boundary; k < static_cast<int>(n); ++k) {
+        byHand.remove(k);
+        upper.insert(make_pair(k, k));
+    }
+    Clock::time_point t1 = Clock::now();
+    report("split", "avl_pointer", n, "move_top1pct_each", nsPerOp(t0, t1, 1), 0);
+
+    const size_t rounds = 1000;
+    double splitNs = 0;
+    double concatNs = 0;
+    for(size_t r = 0; r < rounds; ++r) {
+        int key = keys[r % n];
+        t0 = Clock::now();
+        AVLTree<int, int> high = tree.split(key);
+        t1 = Clock::now();
+        tree.concat(high);
+        Clock::time_point t2 = Clock::now();
+        splitNs += chrono::duration<double, nano>(t1 - t0).count();
+        concatNs += chrono::duration<double, nano>(t2 - t1).count();
+    }
+    report("split", "avl_pointer", n, "split", splitNs / rounds, 0);
+    report("split", "avl_pointer", n, "concat", concatNs / rounds, 0);
+}
+
+/**
+* Percentile and range-count queries: walking the iterator against
+* select/count_range on a SubtreeSize-augmented tree.
+*/
+static void benchOrderStatistics(size_t n)
+{
+    vector<int> keys = randomKeys(n, 1);
+    AVLTree<int, int> plain;
+    RankedAVLTree<int, int> ranked;
+    Clock::time_point t0 = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        plain.insert(make_pair(keys[i], keys[i]));
+    }
+    Clock::time_point t1 = Clock::now();
+    report("order", "avl_pointer", n, "insert", nsPerOp(t0, t1, n), 0);
+    t0 = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        ranked.insert(make_pair(keys[i], keys[i]));
+    }
+    t1 = Clock::now();
+    report("order", "avl_ranked", n, "insert", nsPerOp(t0, t1, n), 0);
+
+    size_t p99 = n * 99 / 100;
+    t0 = Clock::now();
+    AVLTree<int, int>::iterator it = plain.begin();
+    for(size_t i = 0; i < p99; ++i) {
+        ++it;
+    }
+    t1 = Clock::now();
+    sink = it->first;
+    report("order", "avl_pointer", n, "p99_by_iterating", nsPerOp(t0, t1, 1), 0);
+
+    const size_t queries = 10000;
+    size_t total = 0;
+    t0 = Clock::now();
+    for(size_t q = 0; q < queries; ++q) {
+        total += ranked.select(keys[q % n] % n)->first;
+    }
+    t1 = Clock::now();
+    sink = total;
+    report("order", "avl_ranked", n, "select", nsPerOp(t0, t1, queries), 0);
+
+    t0 = Clock::now();
+    for(size_t q = 0; q < queries; ++q) {
+        int lo = keys[q % n];
+        total += ranked.count_range(lo, lo + static_cast<int>(n / 10));
+    }
+    t1 = Clock::now();
+    sink = total;
+    report("order", "avl_ranked", n, "count_range", nsPerOp(t0, t1, queries), 0);
+}
+
+/**
+* Sum of values over a range holding 10% of the keys: scanning with the
+* iterator against aggregate() on a SumMonoid-augmented tree.
+*/
+static void benchRangeAggregate(size_t n)
+{
+    vector<int> keys = randomKeys(n, 1);
+    AVLTree<int, int> plain;
+    AggregateAVLTree<int, int, SumMonoid<int> > summed;
+    for(size_t i = 0; i < n; ++i) {
+        plain.insert(make_pair(keys[i], 1));
+        summed.insert(make_pair(keys[i], 1));
+    }
+    int width = static_cast<int>(n / 10);
+
+    const size_t scans = 10;
+    long total = 0;
+    Clock::time_point t0 = Clock::now();
+    for(size_t q = 0; q < scans; ++q) {
+        int lo = keys[q] % static_cast<int>(n - width);
+        for(AVLTree<int, int>::iterator it = plain.find(lo); it != plain.end() && it->first < lo + width; ++it) {
+            total += it->second;
+        }
+    }
+    Clock::time_point t1 = Clock::now();
+    sink = total;
+    report("aggregate", "avl_pointer", n, "sum_by_scan", nsPerOp(t0, t1, scans), 0);
+
+    const size_t queries = 10000;
+    t0 = Clock::now();
+    for(size_t q = 0; q < queries; ++q) {
+        int lo = keys[q % n] % static_cast<int>(n - width);
+        total += summed.aggregate(lo, lo + width);
+    }
+    t1 = Clock::now();
+    sink = total;
+    report("aggregate", "avl_sum", n, "aggregate", nsPerOp(t0, t1, queries), 0);
+}
+
+/**
+* Paginated range reads of 100 items: skipping forward from begin(),
+* seeking with lower_bound and iterating, and a scan cursor.
+*/
+static void benchRangeScan(size_t n)
+{
+    vector<int> keys = randomKeys(n, 1);
+    AVLTree<int, int> tree;
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(make_pair(keys[i], keys[i]));
+    }
+    const size_t page = 100;
+    const size_t pages = 1000;
+    pair<int, int> buffer[page];
+    long total = 0;
+
+    Clock::time_point t0 = Clock::now();
+    for(size_t q = 0; q < 10; ++q) {
+        int lo = keys[q] % static_cast<int>(n - page);
+        AVLTree<int, int>::iterator it = tree.begin();
+        while(it->first < lo) {
+            ++it;
+        }
+        for(size_t i = 0; i < page; ++i, ++it) {
+            total += it->second;
+        }
+    }
+    Clock::time_point t1 = Clock::now();
+    report("scan", "avl_pointer", n, "page_from_begin", nsPerOp(t0, t1, 10), 0);
+
+    t0 = Clock::now();
+    for(size_t q = 0; q < pages; ++q) {
+        int lo = keys[q % n] % static_cast<int>(n - page);
+        AVLTree<int, int>::iterator it = tree.lower_bound(lo);
+        for(size_t i = 0; i < page; ++i, ++it) {
+            buffer[i] = *it;
+        }
+        total += buffer[page - 1].second;
+    }
+    t1 = Clock::now();
+    report("scan", "avl_pointer", n, "page_lower_bound_iterator", nsPerOp(t0, t1, pages), 0);
+
+    t0 = Clock::now();
+    for(size_t q = 0; q < pages; ++q) {
+        int lo = keys[q % n] % static_cast<int>(n - page);
+        AVLTree<int, int>::scan_cursor cursor = tree.scan(lo);
+        total += cursor.next(buffer, page);
+        total += buffer[page - 1].second;
+    }
+    t1 = Clock::now();
+    sink = total;
+    report("scan", "avl_pointer", n, "page_scan_cursor", nsPerOp(t0, t1, pages), 0);
+}
+
+/**
+* Inserting sorted, reverse-sorted, jittered (sorted, then shuffled within
+* windows of 16) and random keys: plain insert, which tries the finger
+* first, against insert with an end() hint and with the previous result
+* as the hint.
+*/
+template <typename Tree>
+void runHintedInsert(const string& name, const string& order, const vector<int>& keys)
+{
+    size_t n = keys.size();
+
+    Clock::time_point t0 = Clock::now();
+    Tree plain;
+    for(size_t i = 0; i < n; ++i) {
+        plain.insert(make_pair(keys[i], keys[i]));
+    }
+    Clock::time_point t1 = Clock::now();
+    report("hinted", name, n, order + "_insert", nsPerOp(t0, t1, n), 0);
+
+    t0 = Clock::now();
+    Tree atEnd;
+    for(size_t i = 0; i < n; ++i) {
+        atEnd.insert(atEnd.end(), make_pair(keys[i], keys[i]));
+    }
+    t1 = Clock::now();
+    report("hinted", name, n, order + "_hint_end", nsPerOp(t0, t1, n), 0);
+
+    t0 = Clock::now();
+    Tree chained;
+    typename Tree::iterator hint = chained.end();
+    for(size_t i = 0; i < n; ++i) {
+        hint = chained.insert(hint, make_pair(keys[i], keys[i]));
+    }
+    t1 = Clock::now();
+    report("hinted", name, n, order + "_hint_prev", nsPerOp(t0, t1, n), 0);
+    sink = plain.begin()->second + atEnd.begin()->second + chained.begin()->second;
+}
+
+static void benchHintedInsert(size_t n)
+{
+    vector<int> sorted(n);
+    for(size_t i = 0; i < n; ++i) {
+        sorted[i] = static_cast<int>(i);
+    }
+    vector<int> reversed(sorted.rbegin(), sorted.rend());
+    vector<int> jittered(sorted);
+    mt19937 rng(7);
+    for(size_t i = 0; i < n; i += 16) {
+        shuffle(jittered.begin() + i, jittered.begin() + min(n, i + 16), rng);
+    }
+    vector<int> random = randomKeys(n, 1);
+
+    runHintedInsert<AVLTree<int, int> >("avl_pointer", "sorted", sorted);
+    runHintedInsert<AVLTree<int, int> >("avl_pointer", "reverse", reversed);
+    runHintedInsert<AVLTree<int, int> >("avl_pointer", "jittered", jittered);
+    runHintedInsert<AVLTree<int, int> >("avl_pointer", "random", random);
+    runHintedInsert<PooledAVLTree<int, int> >("avl_pooled", "sorted", sorted);
+    runHintedInsert<PooledAVLTree<int, int> >("avl_pooled", "jittered", jittered);
+}
+
+/**
+* Looking up string keys that share a long prefix: std::less, which costs
+* up to two string compares per level, against ThreeWayCompare, which
+* costs one, and a transparent lookup by const char* against building a
+* std::string per lookup. Both trees are filled in lockstep so neither
+* gets the better heap layout.
+*/
+template <typename Tree>
+void runStringFind(const string& name, const Tree& tree, const vector<string>& keys)
+{
+    size_t n = keys.size();
+    size_t found = 0;
+    Clock::time_point t0 = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        found += tree.find(keys[(i * 7919) % n]) != tree.end();
+    }
+    Clock::time_point t1 = Clock::now();
+    report("string_keys", name, n, "find", nsPerOp(t0, t1, n), 0);
+
+    t0 = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        found += tree.find(keys[(i * 7919) % n].c_str()) != tree.end();
+    }
+    t1 = Clock::now();
+    report("string_keys", name, n, "find_const_char", nsPerOp(t0, t1, n), 0);
+    sink = found;
+}
+
+static void benchStringKeys(size_t n)
+{
+    vector<int> ids = randomKeys(n, 3);
+    vector<string> keys(n);
+    for(size_t i = 0; i < n; ++i) {
+        keys[i] = "/var/lib/service/objects/" + to_string(ids[i]);
+    }
+    AVLTree<string, int> less;
+    OrderedAVLTree<string, int, ThreeWayCompare> threeWay;
+    for(size_t i = 0; i < n; ++i) {
+        less.insert(make_pair(keys[i], static_cast<int>(i)));
+        threeWay.insert(make_pair(keys[i], static_cast<int>(i)));
+    }
+    runStringFind("avl_less", less, keys);
+    runStringFind("avl_three_way", threeWay, keys);
+}
+
+/**
+* Read-only lookups: the live tree against its freeze() snapshot, for hits
+* in random order and for random misses.
+*/
+template <typename Tree>
+void runFrozenFind(const string& name, const Tree& tree, const vector<int>& keys)
+{
+    size_t n = keys.size();
+    size_t found = 0;
+    Clock::time_point t0 = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        found += tree.find(keys[(i * 7919) % n]) != tree.end();
+    }
+    Clock::time_point t1 = Clock::now();
+    report("frozen", name, n, "find_hit", nsPerOp(t0, t1, n), 0);
+
+    t0 = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        found += tree.find(keys[i] + 1) != tree.end();
+    }
+    t1 = Clock::now();
+    report("frozen", name, n, "find_miss", nsPerOp(t0, t1, n), 0);
+    sink = found;
+}
+
+static void benchFrozen(size_t n)
+{
+    // Even keys, so key + 1 always misses.
+    vector<int> keys = randomKeys(n, 5);
+    for(size_t i = 0; i < n; ++i) {
+        keys[i] *= 2;
+    }
+    AVLTree<int, int> live;
+    PooledAVLTree<int, int> pooled;
+    for(size_t i = 0; i < n; ++i) {
+        live.insert(make_pair(keys[i], keys[i]));
+        pooled.insert(make_pair(keys[i], keys[i]));
+    }
+    Clock::time_point t0 = Clock::now();
+    FrozenSearchTree<int, int> frozen = live.freeze();
+    Clock::time_point t1 = Clock::now();
+    report("frozen", "eytzinger", n, "freeze", nsPerOp(t0, t1, n),
+           static_cast<double>(frozen.memoryUsage()) / n);
+
+    runFrozenFind("avl_pointer", live, keys);
+    runFrozenFind("avl_pooled", pooled, keys);
+    runFrozenFind("eytzinger", frozen, keys);
+}
+
+/**
+* Integer-id lookups: the live tree, its Eytzinger snapshot and the SIMD
+* index, for 32- and 64-bit keys. Which compare instructions the index
+* uses depends on the build flags (see SIMDFLAGS in the Makefile).
+*/
+template <typename Key, typename Index>
+void runIntegralFind(const string& name, const Index& index, const vector<Key>& keys)
+{
+    size_t n = keys.size();
+    size_t found = 0;
+    Clock::time_point t0 = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        found += index.find(keys[(i * 7919) % n]) != index.end();
+    }
+    Clock::time_point t1 = Clock::now();
+    report("integral", name, n, "find_hit", nsPerOp(t0, t1, n), 0);
+    sink = found;
+}
+
+template <typename Key>
+void runIntegralKeys(const string& suffix, size_t n)
+{
+    vector<int> ids = randomKeys(n, 9);
+    vector<Key> keys(n);
+    for(size_t i = 0; i < n; ++i) {
+        // Spread the ids over the key range.
+        keys[i] = static_cast<Key>(ids[i]) * static_cast<Key>(2654435761u);
+    }
+    AVLTree<Key, int> live;
+    for(size_t i = 0; i < n; ++i) {
+        live.insert(make_pair(keys[i], static_cast<int>(i)));
+    }
+    FrozenSearchTree<Key, int> frozen = live.freeze();
+    Clock::time_point t0 = Clock::now();
+    SimdSearchIndex<Key, int> simd(live);
+    Clock::time_point t1 = Clock::now();
+    report("integral", "simd_" + suffix, n, "build", nsPerOp(t0, t1, n),
+           static_cast<double>(simd.memoryUsage()) / n);
+
+    runIntegralFind("avl_" + suffix, live, keys);
+    runIntegralFind("eytzinger_" + suffix, frozen, keys);
+    runIntegralFind("simd_" + suffix, simd, keys);
+}
+
+static void benchIntegralKeys(size_t n)
+{
+    runIntegralKeys<uint32_t>("u32", n);
+    runIntegralKeys<uint64_t>("u64", n);
+}
+
+/**
+* Cache-line-sized B+ tree nodes against the AVL tree, with random keys.
+* Meant to be run up to sizes well past the last-level cache, e.g.
+* ./bench bplustree 100000 1000000 10000000 100000000
+*/
+static void benchBPlusTree(size_t n)
+{
+    typedef CountingAllocator<pair<const int, int> > Counting;
+    vector<int> keys = randomKeys(n, 1);
+    runLayout<AVLTree<int, int, Counting> >("bplustree", "avl_pointer", keys, countedBytes<AVLTree<int, int, Counting> >);
+    runLayout<BPlusTree<int, int> >("bplustree", "bplus_256", keys, indexedBytes<BPlusTree<int, int> >);
+    runLayout<BPlusTree<int, int, less<int>, 1024> >("bplustree", "bplus_1024", keys,
+                                                   indexedBytes<BPlusTree<int, int, less<int>, 1024> >);
+}
+
+/**
+* The AVL tree behind one mutex, as the shared-tree baseline for the
+* concurrent suite.
+*/
+class LockedAVLTree
+{
+public:
+    void insert(const pair<const int, int>& item)
+    {
+        lock_guard<mutex> lock(mutex_);
+        tree_.insert(item);
+    }
+    void remove(int key)
+    {
+        lock_guard<mutex> lock(mutex_);
+        tree_.remove(key);
+    }
+    bool find(int key, int& value) const
+    {
+        lock_guard<mutex> lock(mutex_);
+        AVLTree<int, int>::iterator it = tree_.find(key);
+        if(it == tree_.end()) {
+            return false;
+        }
+        value = it->second;
+        return true;
+    }
+
+private:
+    AVLTree<int, int> tree_;
+    mutable mutex mutex_;
+};
+
+/**
+* readers threads each look up `lookups` random keys while one writer
+* keeps inserting and removing; reports lookups and writes per wall time.
+*/
+template <typename Tree>
+void runConcurrentReads(const string& name, size_t n, unsigned readers)
+{
+    Tree tree;
+    vector<int> keys = randomKeys(n, 3);
+    for(size_t i = 0; i < n; i += 2) {
+        tree.insert(make_pair(keys[i], keys[i]));
+    }
+    const size_t lookups = 200000;
+    atomic<bool> done(false);
+    size_t writes = 0;
+
+    Clock::time_point t0 = Clock::now();
+    thread writer([&] {
+        for(size_t i = 1; !done.load(memory_order_relaxed); i += 2) {
+            int key = keys[i % n];
+            if((i / n) % 2 == 0) {
+                tree.insert(make_pair(key, key));
+            }
+            else {
+                tree.remove(key);
+            }
+            ++writes;
+        }
+    });
+    vector<thread> threads;
+    for(unsigned r = 0; r < readers; ++r) {
+        threads.push_back(thread([&, r] {
+            size_t found = 0;
+            int value;
+            for(size_t i = 0; i < lookups; ++i) {
+                found += tree.find(keys[(i * 7919 + r * 104729) % n], value);
+            }
+            sink = found;
+        }));
+    }
+    for(size_t r = 0; r < threads.size(); ++r) {
+        threads[r].join();
+    }
+    Clock::time_point t1 = Clock::now();
+    done = true;
+    writer.join();
+
+    string label = name + "_r" + to_string(readers);
+    report("concurrent", label, n, "find", nsPerOp(t0, t1, lookups * readers), 0);
+    report("concurrent", label, n, "write", nsPerOp(t0, t1, writes), 0);
+}
+
+static void benchConcurrent(size_t n)
+{
+    unsigned readerCounts[] = { 1, 2, 4, 8 };
+    for(size_t i = 0; i < sizeof(readerCounts) / sizeof(readerCounts[0]); ++i) {
+        runConcurrentReads<LockedAVLTree>("avl_mutex", n, readerCounts[i]);
+        runConcurrentReads<ConcurrentAVLTree<int, int> >("avl_epoch", n, readerCounts[i]);
+    }
+}
+
+/**
+* Mixed traffic from 1 to 64 threads: 80% find, 10% insert, 10% remove,
+* a fixed total split between the threads. With hot set, 90% of the keys
+* fall in the lowest 1/64 of the range. If rebalance is set, a side
+* thread calls it every millisecond.
+*/
+template <typename Map>
+void runMixedThreads(const string& name, Map& map, size_t n, unsigned threads, bool hot,
+                     function<void()> rebalance = function<void()>())
+{
+    const size_t total = 400000;
+    atomic<bool> done(false);
+    thread balancer;
+    if(rebalance) {
+        balancer = thread([&] {
+            while(!done.load()) {
+                rebalance();
+                this_thread::sleep_for(chrono::milliseconds(1));
+            }
+        });
+    }
+    Clock::time_point t0 = Clock::now();
+    vector<thread> workers;
+    for(unsigned t = 0; t < threads; ++t) {
+        workers.push_back(thread([&, t] {
+            mt19937 rng(t + 1);
+            size_t found = 0;
+            int value;
+            for(size_t i = 0; i < total / threads; ++i) {
+                unsigned r = rng();
+                size_t range = (hot && r % 10 != 0) ? n / 64 + 1 : n;
+                int key = static_cast<int>((r >> 4) % range);
+                switch(r % 10) {
+                    case 0: map.insert(make_pair(key, key)); break;
+                    case 1: map.remove(key); break;
+                    default: found += map.find(key, value); break;
+                }
+            }
+            sink = found;
+        }));
+    }
+    for(size_t t = 0; t < workers.size(); ++t) {
+        workers[t].join();
+    }
+    Clock::time_point t1 = Clock::now();
+    done = true;
+    if(balancer.joinable()) {
+        balancer.join();
+    }
+    report("sharded", name + "_t" + to_string(threads), n, hot ? "mixed_hot" : "mixed",
+           nsPerOp(t0, t1, total / threads * threads), 0);
+}
+
+static void benchSharded(size_t n)
+{
+    const size_t shards = 64;
+    vector<int> boundaries;
+    for(size_t i = 1; i < shards; ++i) {
+        boundaries.push_back(static_cast<int>(n * i / shards));
+    }
+    for(unsigned threads = 1; threads <= 64; threads *= 2) {
+        LockedAVLTree locked;
+        ShardedAVLMap<int, int> sharded(boundaries);
+        ShardedAVLMap<int, int> hot(boundaries);
+        ShardedAVLMap<int, int> rebalanced(boundaries);
+        for(size_t i = 0; i < n; i += 2) {
+            pair<const int, int> item(static_cast<int>(i), static_cast<int>(i));
+            locked.insert(item);
+            sharded.insert(item);
+            hot.insert(item);
+            rebalanced.insert(item);
+        }
+        runMixedThreads("avl_mutex", locked, n, threads, false);
+        runMixedThreads("sharded_64", sharded, n, threads, false);
+        runMixedThreads("sharded_64", hot, n, threads, true);
+        runMixedThreads("sharded_64_rebalanced", rebalanced, n, threads, true,
+                        [&rebalanced] { rebalanced.rebalance(); });
+    }
+}
+
+/**
+* Getting a consistent view for a long scan: copying an AVLTree against
+* an O(1) persistent snapshot, and what the snapshots cost the writer
+* afterwards (a path copy per insert while one is alive).
+*/
+static void benchPersistent(size_t n)
+{
+    vector<int> keys = randomKeys(n, 11);
+    vector<int> more = randomKeys(n, 12);
+    AVLTree<int, int> avl;
+    PersistentAVLTree<int, int> persistent;
+
+    Clock::time_point t0 = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        avl.insert(make_pair(keys[i], keys[i]));
+    }
+    Clock::time_point t1 = Clock::now();
+    report("persistent", "avl_pointer", n, "insert", nsPerOp(t0, t1, n), 0);
+
+    t0 = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        persistent.insert(make_pair(keys[i], keys[i]));
+    }
+    t1 = Clock::now();
+    report("persistent", "persistent", n, "insert", nsPerOp(t0, t1, n), 0);
+
+    size_t found = 0;
+    t0 = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        found += persistent.find(more[i]) != persistent.end();
+    }
+    t1 = Clock::now();
+    report("persistent", "persistent", n, "find_hit", nsPerOp(t0, t1, n), 0);
+    sink = found;
+
+    t0 = Clock::now();
+    AVLTree<int, int> copy(avl);
+    t1 = Clock::now();
+    report("persistent", "avl_pointer", n, "consistent_view", nsPerOp(t0, t1, 1), 0);
+    sink = copy.find(keys[0]) != copy.end();
+
+    const size_t views = 1000;
+    t0 = Clock::now();
+    for(size_t i = 0; i < views; ++i) {
+        PersistentAVLTree<int, int> view = persistent.snapshot();
+        sink = view.size();
+    }
+    t1 = Clock::now();
+    report("persistent", "persistent", n, "consistent_view", nsPerOp(t0, t1, views), 0);
+
+    // Overwrites with a fresh snapshot every 1000 writes: each write
+    // copies its path at most once per snapshot.
+    PersistentAVLTree<int, int> held;
+    t0 = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        if(i % 1000 == 0) {
+            held = persistent.snapshot();
+        }
+        persistent.insert(make_pair(more[i], static_cast<int>(i)));
+    }
+    t1 = Clock::now();
+    report("persistent", "persistent", n, "insert_snapshotted", nsPerOp(t0, t1, n), 0);
+}
+
+/**
+* Building a tree from n unsorted items with repeats: one insert per item,
+* insert_batch into an empty tree, and build_parallel on 1 to 8 threads.
+*/
+static void benchParallelBuild(size_t n)
+{
+    vector<pair<int, int> > items(n);
+    mt19937 rng(13);
+    for(size_t i = 0; i < n; ++i) {
+        int key = static_cast<int>(rng() % (2 * n));
+        items[i] = make_pair(key, static_cast<int>(i));
+    }
+
+    Clock::time_point t0 = Clock::now();
+    {
+        AVLTree<int, int> tree;
+        for(size_t i = 0; i < n; ++i) {
+            tree.insert(items[i]);
+        }
+        sink = tree.begin() != tree.end();
+    }
+    Clock::time_point t1 = Clock::now();
+    report("build", "avl_pointer", n, "insert_each", nsPerOp(t0, t1, n), 0);
+
+    t0 = Clock::now();
+    {
+        AVLTree<int, int> tree;
+        tree.insert_batch(items.begin(), items.end());
+        sink = tree.begin() != tree.end();
+    }
+    t1 = Clock::now();
+    report("build", "avl_pointer", n, "insert_batch_t1", nsPerOp(t0, t1, n), 0);
+
+    unsigned threads[] = { 1, 2, 4, 8 };
+    for(size_t t = 0; t < 4; ++t) {
+        t0 = Clock::now();
+        {
+            AVLTree<int, int> tree;
+            tree.build_parallel(items.begin(), items.end(), threads[t]);
+            sink = tree.begin() != tree.end();
+        }
+        t1 = Clock::now();
+        report("build", "avl_pointer", n, "build_parallel_t" + to_string(threads[t]), nsPerOp(t0, t1, n), 0);
+    }
+}
+
+/**
+* A full pass that sums every value: iterating, against parallel_reduce
+* (unordered and ordered) and parallel_for_each on 1 to 8 threads.
+*/
+static void benchParallelPass(size_t n)
+{
+    vector<int> keys = randomKeys(n, 17);
+    AVLTree<int, int> tree;
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(make_pair(keys[i], keys[i] & 0xff));
+    }
+    typedef pair<const int, int> Item;
+    auto value = [](const Item& item) { return static_cast<long long>(item.second); };
+    auto plus = [](long long a, long long b) { return a + b; };
+
+    Clock::time_point t0 = Clock::now();
+    long long total = 0;
+    for(AVLTree<int, int>::iterator it = tree.begin(); it != tree.end(); ++it) {
+        total += it->second;
+    }
+    Clock::time_point t1 = Clock::now();
+    report("parallel", "avl_pointer", n, "iterate_sum", nsPerOp(t0, t1, n), 0);
+    sink = static_cast<size_t>(total);
+
+    unsigned threads[] = { 1, 2, 4, 8 };
+    for(size_t t = 0; t < 4; ++t) {
+        string suffix = "_t" + to_string(threads[t]);
+        t0 = Clock::now();
+        total = tree.parallel_reduce(0LL, value, plus, threads[t]);
+        t1 = Clock::now();
+        report("parallel", "avl_pointer", n, "reduce" + suffix, nsPerOp(t0, t1, n), 0);
+        sink = static_cast<size_t>(total);
+
+        t0 = Clock::now();
+        total = tree.parallel_reduce_ordered(0LL, value, plus, threads[t]);
+        t1 = Clock::now();
+        report("parallel", "avl_pointer", n, "reduce_ordered" + suffix, nsPerOp(t0, t1, n), 0);
+        sink = static_cast<size_t>(total);
+
+        atomic<long long> shared(0);
+        t0 = Clock::now();
+        tree.parallel_for_each([&shared](Item& item) {
+            shared.fetch_add(item.second & 1, memory_order_relaxed);
+        }, threads[t]);
+        t1 = Clock::now();
+        report("parallel", "avl_pointer", n, "for_each" + suffix, nsPerOp(t0, t1, n), 0);
+        sink = static_cast<size_t>(shared.load());
+    }
+}
+
+/**
+* Health-check polling: size(), height() and isBalanced() against the
+* full O(n) verifyBalance() walk, for an AVLTree and a plain BST with
+* its default SubtreeShape nodes. Also what SubtreeShape costs on insert,
+* against a BST with bare nodes.
+*/
+static void benchShape(size_t n)
+{
+    vector<int> keys = randomKeys(n, 19);
+    AVLTree<int, int> avl;
+    UnshapedBinarySearchTree<int, int> plain;
+    BinarySearchTree<int, int> shaped;
+    for(size_t i = 0; i < n; ++i) {
+        avl.insert(make_pair(keys[i], keys[i]));
+    }
+    Clock::time_point t0 = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        plain.insert(make_pair(keys[i], keys[i]));
+    }
+    Clock::time_point t1 = Clock::now();
+    report("shape", "bst_unshaped", n, "insert", nsPerOp(t0, t1, n), 0);
+    t0 = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        shaped.insert(make_pair(keys[i], keys[i]));
+    }
+    t1 = Clock::now();
+    report("shape", "bst_shaped", n, "insert", nsPerOp(t0, t1, n), 0);
+
+    const size_t polls = 1000;
+    size_t total = 0;
+    t0 = Clock::now();
+    for(size_t i = 0; i < polls; ++i) {
+        total += avl.size() + static_cast<size_t>(avl.height()) + avl.isBalanced();
+    }
+    t1 = Clock::now();
+    report("shape", "avl_pointer", n, "poll", nsPerOp(t0, t1, polls), 0);
+    t0 = Clock::now();
+    for(size_t i = 0; i < polls; ++i) {
+        total += shaped.size() + static_cast<size_t>(shaped.height()) + shaped.isBalanced();
+    }
+    t1 = Clock::now();
+    report("shape", "bst_shaped", n, "poll", nsPerOp(t0, t1, polls), 0);
+
+    const size_t walks = 5;
+    t0 = Clock::now();
+    for(size_t i = 0; i < walks; ++i) {
+        total += avl.verifyBalance();
+    }
+    t1 = Clock::now();
+    report("shape", "avl_pointer", n, "verify_balance", nsPerOp(t0, t1, walks), 0);
+    t0 = Clock::now();
+    for(size_t i = 0; i < walks; ++i) {
+        total += plain.isBalanced();
+    }
+    t1 = Clock::now();
+    report("shape", "bst_unshaped", n, "is_balanced", nsPerOp(t0, t1, walks), 0);
+    sink = total;
+}
+
+/**
+* Key sequences for the compare suite. Stored keys are even, so key + 1
+* always misses. inserts is the insertion order and probes the order of
+* lookups and removals: for "random", "sorted" and "reverse" every key is
+* inserted once in that order and looked up in random order; "zipf"
+* inserts in random order but draws lookups with Zipf(0.99) skew (as in
+* YCSB), hot keys scattered over the key range. Removals then hit each
+* key once, hottest first.
+*/
+struct Workload
+{
+    string name;
+    vector<int> inserts;
+    vector<int> probes;
+    vector<int> removes;
+};
+
+static vector<int> zipfRanks(size_t count, size_t universe, double skew, unsigned seed)
+{
+    vector<double> cdf(universe);
+    double total = 0;
+    for(size_t i = 0; i < universe; ++i) {
+        total += 1.0 / pow(static_cast<double>(i + 1), skew);
+        cdf[i] = total;
+    }
+    mt19937 rng(seed);
+    uniform_real_distribution<double> uniform(0, total);
+    vector<int> ranks(count);
+    for(size_t i = 0; i < count; ++i) {
+        ranks[i] = static_cast<int>(lower_bound(cdf.begin(), cdf.end(), uniform(rng)) - cdf.begin());
+    }
+    return ranks;
+}
+
+static Workload makeWorkload(const string& name, size_t n)
+{
+    Workload w;
+    w.name = name;
+    vector<int> shuffled = randomKeys(n, 21);
+    vector<int> lookups = randomKeys(n, 22);
+    w.inserts.resize(n);
+    w.probes.resize(n);
+    for(size_t i = 0; i < n; ++i) {
+        if(name == "sorted") {
+            w.inserts[i] = static_cast<int>(2 * i);
+        }
+        else if(name == "reverse") {
+            w.inserts[i] = static_cast<int>(2 * (n - 1 - i));
+        }
+        else {
+            w.inserts[i] = 2 * shuffled[i];
+        }
+        w.probes[i] = 2 * lookups[i];
+    }
+    w.removes = w.probes;
+    if(name == "zipf") {
+        // Rank r is the key at shuffled[r], so hot keys are spread out.
+        vector<int> ranks = zipfRanks(n, n, 0.99, 23);
+        vector<bool> removed(n, false);
+        w.removes.clear();
+        for(size_t i = 0; i < n; ++i) {
+            w.probes[i] = 2 * shuffled[ranks[i]];
+        }
+        sort(ranks.begin(), ranks.end());
+        for(size_t i = 0; i < n; ++i) {
+            if(!removed[ranks[i]]) {
+                removed[ranks[i]] = true;
+                w.removes.push_back(2 * shuffled[ranks[i]]);
+            }
+        }
+        for(size_t r = 0; r < n; ++r) {
+            if(!removed[r]) {
+                w.removes.push_back(2 * shuffled[r]);
+            }
+        }
+    }
+    return w;
+}
+
+// Keys of the compare suite, as ints or as zero-padded strings (which
+// sort like the numbers).
+template <typename K>
+struct KeyMaker;
+
+template <>
+struct KeyMaker<int>
+{
+    static const char* name() { return "int"; }
+    static int make(int key) { return key; }
+};
+
+template <>
+struct KeyMaker<string>
+{
+    static const char* name() { return "string"; }
+    static string make(int key)
+    {
+        char buffer[16];
+        snprintf(buffer, sizeof(buffer), "k%011d", key);
+        return buffer;
+    }
+};
+
+template <typename K>
+static vector<K> makeKeys(const vector<int>& ids, int offset)
+{
+    vector<K> keys(ids.size());
+    for(size_t i = 0; i < ids.size(); ++i) {
+        keys[i] = KeyMaker<K>::make(ids[i] + offset);
+    }
+    return keys;
+}
+
+template <typename Tree, typename K>
+void removeKey(Tree& tree, const K& key)
+{
+    tree.remove(key);
+}
+
+template <typename K, typename V, typename C, typename A>
+void removeKey(map<K, V, C, A>& tree, const K& key)
+{
+    tree.erase(key);
+}
+
+/**
+* insert / find_hit / find_miss / iterate / remove / clear for one
+* container on one workload. Each phase's keys are made just before it
+* and dropped after, so string runs only hold one key vector at a time.
+*/
+template <typename Tree, typename K>
+void runCompare(const string& container, const Workload& w)
+{
+    size_t n = w.inserts.size();
+    string name = container + "_" + KeyMaker<K>::name() + "_" + w.name;
+    size_t before = liveBytes;
+    Tree tree;
+
+    vector<K> keys = makeKeys<K>(w.inserts, 0);
+    Clock::time_point t0 = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(make_pair(keys[i], static_cast<int>(i)));
+    }
+    Clock::time_point t1 = Clock::now();
+    double bytes = static_cast<double>(liveBytes - before) / n;
+    report("compare", name, n, "insert", nsPerOp(t0, t1, n), bytes);
+
+    keys = makeKeys<K>(w.probes, 0);
+    size_t found = 0;
+    t0 = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        found += tree.find(keys[i]) != tree.end();
+    }
+    t1 = Clock::now();
+    report("compare", name, n, "find_hit", nsPerOp(t0, t1, n), bytes);
+
+    keys = makeKeys<K>(w.probes, 1);
+    t0 = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        found += tree.find(keys[i]) != tree.end();
+    }
+    t1 = Clock::now();
+    report("compare", name, n, "find_miss", nsPerOp(t0, t1, n), bytes);
+    sink = found;
+
+    size_t sum = 0;
+    t0 = Clock::now();
+    for(typename Tree::iterator it = tree.begin(); it != tree.end(); ++it) {
+        sum += it->second;
+    }
+    t1 = Clock::now();
+    report("compare", name, n, "iterate", nsPerOp(t0, t1, n), bytes);
+    sink = sum;
+
+    keys = makeKeys<K>(w.removes, 0);
+    t0 = Clock::now();
+    for(size_t i = 0; i < keys.size(); ++i) {
+        removeKey(tree, keys[i]);
+    }
+    t1 = Clock::now();
+    report("compare", name, n, "remove", nsPerOp(t0, t1, keys.size()), bytes);
+
+    keys = makeKeys<K>(w.inserts, 0);
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(make_pair(keys[i], static_cast<int>(i)));
+    }
+    vector<K>().swap(keys);
+    t0 = Clock::now();
+    tree.clear();
+    t1 = Clock::now();
+    report("compare", name, n, "clear", nsPerOp(t0, t1, n), bytes);
+}
+
+// Past this size a sorted or reversed plain BST (a linked list) is only
+// a quadratic wait, so it is left out.
+static const size_t kDegenerateLimit = 20000;
+
+template <typename K>
+void runCompareKeys(const Workload& w)
+{
+    typedef CountingAllocator<pair<const K, int> > Counting;
+    bool degenerate = w.name == "sorted" || w.name == "reverse";
+    if(!degenerate || w.inserts.size() <= kDegenerateLimit) {
+        runCompare<BinarySearchTree<K, int, Counting>, K>("bst_pointer", w);
+    }
+    runCompare<AVLTree<K, int, Counting>, K>("avl_pointer", w);
+    runCompare<map<K, int, less<K>, Counting>, K>("std_map", w);
+}
+
+/**
+* The baseline matrix: BinarySearchTree, AVLTree and std::map, int and
+* string keys, over every workload above. Container names read
+* <container>_<key type>_<workload>.
+*/
+static void benchCompare(size_t n)
+{
+    const char* workloads[] = { "random", "sorted", "reverse", "zipf" };
+    for(size_t i = 0; i < 4; ++i) {
+        Workload w = makeWorkload(workloads[i], n);
+        runCompareKeys<int>(w);
+        runCompareKeys<string>(w);
+    }
+}
+
+// Checks that failed in the stress suite; main exits non-zero if any did.
+static atomic<size_t> stressFailures(0);
+
+static void stressCheck(bool ok, const string& what)
+{
+    if(!ok && stressFailures++ < 10) {
+        cerr << "stress: " << what << endl;
+    }
+}
+
+/**
+* std::less that, on stress reader threads, yields now and then in the
+* middle of a descent or scan, so that writes land while a reader is
+* part-way down the tree even when the threads share one core.
+*/
+struct YieldingLess
+{
+    static thread_local unsigned readerCompares;   // 0 on other threads
+
+    bool operator()(int a, int b) const
+    {
+        if(readerCompares != 0 && ++readerCompares % 8 == 0) {
+            this_thread::yield();
+        }
+        return a < b;
+    }
+};
+thread_local unsigned YieldingLess::readerCompares = 0;
+
+/**
+* One writer applies random inserts, overwrites and removes to a
+* ConcurrentAVLTree and to a std::map while `readers` threads check it:
+* the keys divisible by 4 are never removed, so every find of one must
+* hit (with its value or its negation, the writer's overwrite), and every
+* window scanned through a reader must be strictly increasing and hold
+* each of them exactly once. The tree must match the map at the end.
+*/
+static void runConcurrentStress(size_t n, unsigned readers)
+{
+    ConcurrentAVLTree<int, int, YieldingLess> tree;
+    map<int, int> model;
+    for(size_t i = 0; i < n; i += 4) {
+        int key = static_cast<int>(i);
+        tree.insert(make_pair(key, key));
+        model[key] = key;
+    }
+    const size_t ops = 400000;
+    const int window = 64;
+    atomic<bool> done(false);
+    vector<thread> threads;
+    for(unsigned r = 0; r < readers; ++r) {
+        threads.push_back(thread([&, r] {
+            mt19937 rng(100 + r);
+            YieldingLess::readerCompares = 1;
+            size_t round = 0;
+            while(!done.load(memory_order_relaxed)) {
+                int key = static_cast<int>(rng() % n) & ~3;
+                int value = 0;
+                bool found = tree.find(key, value);
+                stressCheck(found && (value == key || value == -key),
+                            "find missed stable key " + to_string(key));
+                if(++round % 16 != 0) {
+                    continue;
+                }
+                int lo = static_cast<int>(rng() % n);
+                int hi = min(lo + window, static_cast<int>(n));
+                int stable = 0, expected = (hi + 3) / 4 - (lo + 3) / 4;
+                bool ordered = true;
+                ConcurrentAVLTree<int, int, YieldingLess>::reader view(tree);
+                ConcurrentAVLTree<int, int, YieldingLess>::iterator it = view.lower_bound(lo);
+                for(int last = lo - 1; it != view.end() && it->first < hi; ++it) {
+                    ordered = ordered && it->first > last;
+                    last = it->first;
+                    stable += it->first % 4 == 0;
+                }
+                stressCheck(ordered && stable == expected,
+                            "scan of [" + to_string(lo) + ", " + to_string(hi) + ") saw "
+                            + to_string(stable) + " of " + to_string(expected) + " stable keys");
+            }
+        }));
+    }
+
+    mt19937 rng(7);
+    Clock::time_point t0 = Clock::now();
+    for(size_t i = 0; i < ops; ++i) {
+        int key = static_cast<int>(rng() % n);
+        if(key % 4 == 0) {
+            int value = rng() % 2 ? key : -key;
+            tree.insert(make_pair(key, value));
+            model[key] = value;
+        }
+        else if(rng() % 2) {
+            tree.insert(make_pair(key, static_cast<int>(i)));
+            model[key] = static_cast<int>(i);
+        }
+        else {
+            tree.remove(key);
+            model.erase(key);
+        }
+    }
+    Clock::time_point t1 = Clock::now();
+    done = true;
+    for(size_t r = 0; r < threads.size(); ++r) {
+        threads[r].join();
+    }
+
+    bool same = tree.size() == model.size() && tree.isBalanced();
+    {
+        ConcurrentAVLTree<int, int, YieldingLess>::reader view(tree);
+        map<int, int>::const_iterator expect = model.begin();
+        for(ConcurrentAVLTree<int, int, YieldingLess>::iterator it = view.begin(); same && it != view.end(); ++it, ++expect) {
+            same = expect != model.end() && it->first == expect->first && it->second == expect->second;
+        }
+    }
+    stressCheck(same, "concurrent tree differs from std::map after " + to_string(ops) + " writes");
+    report("stress", "avl_epoch_r" + to_string(readers), n, "write", nsPerOp(t0, t1, ops), 0);
+}
+
+template <typename Tree>
+static bool sameItems(const Tree& tree, const map<int, int>& model)
+{
+    if(tree.size() != model.size() || !tree.isBalanced()) {
+        return false;
+    }
+    map<int, int>::const_iterator expect = model.begin();
+    for(typename Tree::iterator it = tree.begin(); it != tree.end(); ++it, ++expect) {
+        if(expect == model.end() || it->first != expect->first || it->second != expect->second) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+* Random inserts, operator[] writes and removes on a PersistentAVLTree
+* mirrored in a std::map. Every so often a snapshot is taken with a copy
+* of the map: some are kept and rechecked at the end, others are handed
+* to a thread that scans and drops them while the writer goes on, so
+* path copying and cross-thread reference release are both exercised.
+*/
+static void runPersistentStress(size_t n)
+{
+    PersistentAVLTree<int, int> tree;
+    map<int, int> model;
+    vector<pair<PersistentAVLTree<int, int>, map<int, int> > > kept;
+    vector<thread> scanners;
+    const size_t ops = 2 * min<size_t>(n, 200000);
+    const size_t every = max<size_t>(ops / 16, 1);
+    mt19937 rng(9);
+    Clock::time_point t0 = Clock::now();
+    for(size_t i = 0; i < ops; ++i) {
+        int key = static_cast<int>(rng() % n);
+        switch(rng() % 3) {
+            case 0: tree.insert(make_pair(key, static_cast<int>(i))); model[key] = static_cast<int>(i); break;
+            case 1: tree[key] = -static_cast<int>(i); model[key] = -static_cast<int>(i); break;
+            default: tree.remove(key); model.erase(key); break;
+        }
+        if(i % every != every - 1) {
+            continue;
+        }
+        if((i / every) % 2 == 0) {
+            kept.push_back(make_pair(tree.snapshot(), model));
+        }
+        else {
+            PersistentAVLTree<int, int> snapshot = tree.snapshot();
+            scanners.push_back(thread([snapshot, model]() mutable {
+                stressCheck(sameItems(snapshot, model), "snapshot differs from its std::map on a scanner thread");
+                snapshot.clear();
+            }));
+        }
+    }
+    Clock::time_point t1 = Clock::now();
+    for(size_t t = 0; t < scanners.size(); ++t) {
+        scanners[t].join();
+    }
+    for(size_t k = 0; k < kept.size(); ++k) {
+        stressCheck(sameItems(kept[k].first, kept[k].second), "kept snapshot " + to_string(k) + " changed");
+    }
+    kept.clear();
+    stressCheck(sameItems(tree, model), "persistent tree differs from std::map after " + to_string(ops) + " writes");
+    report("stress", "persistent", n, "write", nsPerOp(t0, t1, ops), 0);
+}
+
+/**
+* Checking stress runs for the thread-facing trees; failures go to
+* stderr and make bench exit with status 1 (make stress).
+*/
+static void benchStress(size_t n)
+{
+    unsigned readerCounts[] = { 1, 2, 4, 8 };
+    for(size_t i = 0; i < sizeof(readerCounts) / sizeof(readerCounts[0]); ++i) {
+        runConcurrentStress(n, readerCounts[i]);
+    }
+    runPersistentStress(n);
+}
+
+struct Suite
+{
+    const char* name;
+    void (*run)(size_t n);
+};
+
+static const Suite suites[] = {
+    { "layout", benchNodeLayout },
+    { "copy", benchCopyClear },
+    { "load", benchSortedLoad },
+    { "batch", benchBatchInsert },
+    { "setops", benchSetAlgebra },
+    { "split", benchSplitConcat },
+    { "order", benchOrderStatistics },
+    { "aggregate", benchRangeAggregate },
+    { "scan", benchRangeScan },
+    { "hinted", benchHintedInsert },
+    { "string_keys", benchStringKeys },
+    { "frozen", benchFrozen },
+    { "integral", benchIntegralKeys },
+    { "bplustree", benchBPlusTree },
+    { "concurrent", benchConcurrent },
+    { "sharded", benchSharded },
+    { "persistent", benchPersistent },
+    { "build", benchParallelBuild },
+    { "parallel", benchParallelPass },
+    { "shape", benchShape },
+    { "compare", benchCompare },
+    { "stress", benchStress },
+};
+
+int main(int argc, char* argv[])
+{
+    vector<size_t> sizes;
+    vector<string> selected;
+    for(int i = 1; i < argc; ++i) {
+        if(isdigit(static_cast<unsigned char>(argv[i][0]))) {
+            sizes.push_back(strtoul(argv[i], NULL, 10));
+        }
+        else {
+            selected.push_back(argv[i]);
+        }
+    }
+    if(sizes.empty()) {
+        sizes.push_back(100000);
+        sizes.push_back(1000000);
+    }
+
+    cout << "suite,container,n,operation,ns_per_op,bytes_per_item" << endl;
+    for(size_t i = 0; i < sizes.size(); ++i) {
+        for(size_t s = 0; s < sizeof(suites) / sizeof(suites[0]); ++s) {
+            if(selected.empty() ||
+               find(selected.begin(), selected.end(), suites[s].name) != selected.end()) {
+                suites[s].run(sizes[i]);
+            }
+        }
+    }
+    return stressFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,1037 @@
+#ifndef BPLUSTREE_H
+#define BPLUSTREE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+#include <tuple>
+#include <iterator>
+#include <stdexcept>
+#include <functional>
+#include <type_traits>
+#include <vector>
+
+/**
+* A B+ tree with the same insert / remove / find / operator[] / iterator
+* surface as BinarySearchTree, for data sets much larger than the cache.
+*
+* Every node is about NodeBytes bytes (a few cache lines): an inner node
+* holds up to kInner routing keys and kInner + 1 children, a leaf up to
+* kLeaf items. All items live in the leaves, which are chained in key
+* order, so iterating costs O(1) per step without climbing; a lookup
+* touches one node per level and the tree is only log_{kInner}(n) deep.
+* Inserting at the far right end leaves the full leaf as it is instead of
+* halving it, so sorted input fills leaves completely. Nodes other than
+* the root and that last leaf stay at least half full.
+*
+* Unlike BinarySearchTree, items are stored in leaf slots and move when
+* a leaf shifts, splits, borrows or merges. So every insert, remove,
+* non-const operator[], bulk_load or clear invalidates ALL iterators,
+* pointers and references into the tree, even those to other keys.
+* Lookups and iteration invalidate nothing.
+*/
+template <typename Key, typename Value,
+          typename Compare = std::less<Key>,
+          std::size_t NodeBytes = 256>
+class BPlusTree
+{
+public:
+    typedef std::pair<const Key, Value> value_type;
+
+    BPlusTree();
+    explicit BPlusTree(const Compare& comp);
+    BPlusTree(const BPlusTree& other);
+    BPlusTree(BPlusTree&& other) noexcept;
+    BPlusTree& operator=(const BPlusTree& other);
+    BPlusTree& operator=(BPlusTree&& other) noexcept;
+    ~BPlusTree();
+
+    void insert(const value_type& keyValuePair);
+    void insert(value_type&& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    bool isBalanced() const;
+    bool empty() const;
+    std::size_t size() const;
+    std::size_t memoryUsage() const;
+    template<typename ForwardIt>
+    void bulk_load(ForwardIt first, ForwardIt last, bool checkSorted = true);
+
+private:
+    struct Leaf;
+
+public:
+    /**
+    * Iterates in key order along the leaf chain; holds a leaf and a slot.
+    */
+    class iterator
+    {
+    public:
+        iterator();
+
+        value_type& operator*() const;
+        value_type* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+
+    protected:
+        friend class BPlusTree<Key, Value, Compare, NodeBytes>;
+        iterator(Leaf* leaf, unsigned slot);
+        Leaf* leaf_;
+        unsigned slot_;
+    };
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    iterator upper_bound(const Key& key) const;
+    Value& operator[](const Key& key);
+    Value const & operator[](const Key& key) const;
+
+private:
+    struct Node
+    {
+        explicit Node(bool isLeaf) : count(0), leaf(isLeaf) { }
+        unsigned count;   // items in a leaf, keys in an inner node
+        bool leaf;
+    };
+
+    struct Inner;
+
+public:
+    // Capacities derived from NodeBytes; at least 4 so splits and merges
+    // always have room.
+    static const std::size_t kInnerRaw = (NodeBytes - sizeof(Node)) / (sizeof(Key) + sizeof(void*));
+    static const std::size_t kInner = kInnerRaw < 4 ? 4 : kInnerRaw;
+    static const std::size_t kLeafRaw = (NodeBytes - sizeof(Node) - 2 * sizeof(void*)) / sizeof(value_type);
+    static const std::size_t kLeaf = kLeafRaw < 4 ? 4 : kLeafRaw;
+
+private:
+    static const unsigned kInnerMin = kInner / 2;
+    static const unsigned kLeafMin = kLeaf / 2;
+
+    struct Inner : Node
+    {
+        Inner() : Node(false) { }
+        Key keys[kInner];
+        Node* children[kInner + 1];
+    };
+
+    struct Leaf : Node
+    {
+        Leaf() : Node(true), prev(nullptr), next(nullptr) { }
+        value_type* item(unsigned i) { return reinterpret_cast<value_type*>(&slots[i]); }
+        const Key& key(unsigned i) { return item(i)->first; }
+        template<typename... Args>
+        void insertAt(unsigned pos, Args&&... args);
+        void eraseAt(unsigned pos);
+        void moveTail(unsigned from, Leaf* to, unsigned at);
+
+        Leaf* prev;
+        Leaf* next;
+        typename std::aligned_storage<sizeof(value_type), alignof(value_type)>::type slots[kLeaf];
+    };
+
+    template<typename... Args>
+    std::pair<value_type*, bool> tryEmplace(const Key& key, Args&&... args);
+    template<typename... Args>
+    std::pair<value_type*, bool> insertRec(Node* node, const Key& key, Node*& splitRight, Key& splitKey,
+                                           Args&&... args);
+    bool removeRec(Node* node, const Key& key);
+    void fixChild(Inner* parent, unsigned i);
+    void mergeChildren(Inner* parent, unsigned i);
+    void eraseFromInner(Inner* inner, unsigned keyIndex);
+    unsigned childIndex(const Inner* inner, const Key& key) const;
+    unsigned leafLowerBound(Leaf* leaf, const Key& key) const;
+    Leaf* findLeaf(const Key& key) const;
+    bool underflows(const Node* node) const;
+    int checkNode(const Node* node, const Key* lo, const Key* hi) const;
+
+    Leaf* createLeaf();
+    Inner* createInner();
+    void destroyNode(Node* node);
+    void destroySubtree(Node* node);
+
+    Node* root_;
+    std::size_t size_;
+    std::size_t leaves_;
+    std::size_t inners_;
+    Compare comp_;
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the BPlusTree::Leaf class.
+  -------------------------------------------------
+*/
+
+/**
+* Constructs an item at pos from args, shifting the items after it right.
+* The item is built first so a throwing constructor changes nothing.
+*/
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+template<typename... Args>
+void BPlusTree<Key, Value, Compare, NodeBytes>::Leaf::insertAt(unsigned pos, Args&&... args)
+{
+    value_type made(std::forward<Args>(args)...);
+    for(unsigned i = this->count; i > pos; --i) {
+        new (&slots[i]) value_type(std::move(*item(i - 1)));
+        item(i - 1)->~value_type();
+    }
+    new (&slots[pos]) value_type(std::move(made));
+    ++this->count;
+}
+
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+void BPlusTree<Key, Value, Compare, NodeBytes>::Leaf::eraseAt(unsigned pos)
+{
+    item(pos)->~value_type();
+    for(unsigned i = pos + 1; i < this->count; ++i) {
+        new (&slots[i - 1]) value_type(std::move(*item(i)));
+        item(i)->~value_type();
+    }
+    --this->count;
+}
+
+/**
+* Moves items [from, count) into to, starting at slot at (which must be
+* to's end), and drops them from this leaf.
+*/
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+void BPlusTree<Key, Value, Compare, NodeBytes>::Leaf::moveTail(unsigned from, Leaf* to, unsigned at)
+{
+    for(unsigned i = from; i < this->count; ++i, ++at) {
+        new (&to->slots[at]) value_type(std::move(*item(i)));
+        item(i)->~value_type();
+    }
+    to->count = at;
+    this->count = from;
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the BPlusTree::Leaf class.
+  -----------------------------------------------
+*/
+
+/*
+  -----------------------------------------------------
+  Begin implementations for the BPlusTree::iterator class.
+  -----------------------------------------------------
+*/
+
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+BPlusTree<Key, Value, Compare, NodeBytes>::iterator::iterator() :
+    leaf_(nullptr), slot_(0)
+{
+
+}
+
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+BPlusTree<Key, Value, Compare, NodeBytes>::iterator::iterator(Leaf* leaf, unsigned slot) :
+    leaf_(leaf), slot_(slot)
+{
+    // A position one past a leaf's last item is the next leaf's first.
+    if(leaf_ != nullptr && slot_ == leaf_->count) {
+        leaf_ = leaf_->next;
+        slot_ = 0;
+    }
+}
+
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+typename BPlusTree<Key, Value, Compare, NodeBytes>::value_type&
+BPlusTree<Key, Value, Compare, NodeBytes>::iterator::operator*() const
+{
+    return *leaf_->item(slot_);
+}
+
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+typename BPlusTree<Key, Value, Compare, NodeBytes>::value_type*
+BPlusTree<Key, Value, Compare, NodeBytes>::iterator::operator->() const
+{
+    return leaf_->item(slot_);
+}
+
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+bool BPlusTree<Key, Value, Compare, NodeBytes>::iterator::operator==(const iterator& rhs) const
+{
+    return leaf_ == rhs.leaf_ && slot_ == rhs.slot_;
+}
+
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+bool BPlusTree<Key, Value, Compare, NodeBytes>::iterator::operator!=(const iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+typename BPlusTree<Key, Value, Compare, NodeBytes>::iterator&
+BPlusTree<Key, Value, Compare, NodeBytes>::iterator::operator++()
+{
+    if(++slot_ == leaf_->count) {
+        leaf_ = leaf_->next;
+        slot_ = 0;
+    }
+    return *this;
+}
+
+/*
+  ---------------------------------------------------
+  End implementations for the BPlusTree::iterator class.
+  ---------------------------------------------------
+*/
+
+/*
+  ---------------------------------------------
+  Begin implementations for the BPlusTree class.
+  ---------------------------------------------
+*/
+
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+BPlusTree<Key, Value, Compare, NodeBytes>::BPlusTree() :
+    root_(nullptr), size_(0), leaves_(0), inners_(0), comp_()
+{
+
+}
+
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+BPlusTree<Key, Value, Compare, NodeBytes>::BPlusTree(const Compare& comp) :
+    root_(nullptr), size_(0), leaves_(0), inners_(0), comp_(comp)
+{
+
+}
+
+/**
+* Copies by bulk loading other's items, so the copy is packed. O(n).
+*/
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+BPlusTree<Key, Value, Compare, NodeBytes>::BPlusTree(const BPlusTree& other) :
+    root_(nullptr), size_(0), leaves_(0), inners_(0), comp_(other.comp_)
+{
+    bulk_load(other.begin(), other.end(), false);
+}
+
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+BPlusTree<Key, Value, Compare, NodeBytes>::BPlusTree(BPlusTree&& other) noexcept :
+    root_(other.root_), size_(other.size_), leaves_(other.leaves_), inners_(other.inners_),
+    comp_(other.comp_)
+{
+    other.root_ = nullptr;
+    other.size_ = other.leaves_ = other.inners_ = 0;
+}
+
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+BPlusTree<Key, Value, Compare, NodeBytes>&
+BPlusTree<Key, Value, Compare, NodeBytes>::operator=(const BPlusTree& other)
+{
+    if(this != &other) {
+        BPlusTree copy(other);
+        *this = std::move(copy);
+    }
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+BPlusTree<Key, Value, Compare, NodeBytes>&
+BPlusTree<Key, Value, Compare, NodeBytes>::operator=(BPlusTree&& other) noexcept
+{
+    if(this != &other) {
+        clear();
+        root_ = other.root_;
+        size_ = other.size_;
+        leaves_ = other.leaves_;
+        inners_ = other.inners_;
+        comp_ = other.comp_;
+        other.root_ = nullptr;
+        other.size_ = other.leaves_ = other.inners_ = 0;
+    }
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+BPlusTree<Key, Value, Compare, NodeBytes>::~BPlusTree()
+{
+    clear();
+}
+
+/**
+* Inserts the item, overwriting the value if the key is already present.
+*/
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+void BPlusTree<Key, Value, Compare, NodeBytes>::insert(const value_type& keyValuePair)
+{
+    std::pair<value_type*, bool> result = tryEmplace(keyValuePair.first, keyValuePair.second);
+    if(!result.second) {
+        result.first->second = keyValuePair.second;
+    }
+}
+
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+void BPlusTree<Key, Value, Compare, NodeBytes>::insert(value_type&& keyValuePair)
+{
+    std::pair<value_type*, bool> result = tryEmplace(keyValuePair.first, std::move(keyValuePair.second));
+    if(!result.second) {
+        result.first->second = std::move(keyValuePair.second);
+    }
+}
+
+/**
+* Removes key if present. A node left less than half full borrows from a
+* sibling or merges with one; a root left with a single child is dropped.
+*/
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+void BPlusTree<Key, Value, Compare, NodeBytes>::remove(const Key& key)
+{
+    if(root_ == nullptr || !removeRec(root_, key)) {
+        return;
+    }
+    --size_;
+    if(root_->count == 0) {
+        Node* old = root_;
+        root_ = old->leaf ? nullptr : static_cast<Inner*>(old)->children[0];
+        destroyNode(old);
+    }
+}
+
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+void BPlusTree<Key, Value, Compare, NodeBytes>::clear()
+{
+    destroySubtree(root_);
+    root_ = nullptr;
+    size_ = 0;
+}
+
+/**
+* Checks the structure: keys ordered within and across nodes, every leaf
+* at the same depth, no node over capacity and the leaf chain in order.
+*/
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+bool BPlusTree<Key, Value, Compare, NodeBytes>::isBalanced() const
+{
+    if(root_ == nullptr) {
+        return size_ == 0;
+    }
+    if(checkNode(root_, nullptr, nullptr) < 0) {
+        return false;
+    }
+    std::size_t seen = 0;
+    Leaf* prev = nullptr;
+    for(Leaf* leaf = begin().leaf_; leaf != nullptr; prev = leaf, leaf = leaf->next) {
+        if(leaf->prev != prev || leaf->count == 0) {
+            return false;
+        }
+        if(prev != nullptr && !comp_(prev->key(prev->count - 1), leaf->key(0))) {
+            return false;
+        }
+        seen += leaf->count;
+    }
+    return seen == size_;
+}
+
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+bool BPlusTree<Key, Value, Compare, NodeBytes>::empty() const
+{
+    return size_ == 0;
+}
+
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+std::size_t BPlusTree<Key, Value, Compare, NodeBytes>::size() const
+{
+    return size_;
+}
+
+/**
+* Bytes held by the nodes (not counting memory owned by the items).
+*/
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+std::size_t BPlusTree<Key, Value, Compare, NodeBytes>::memoryUsage() const
+{
+    return leaves_ * sizeof(Leaf) + inners_ * sizeof(Inner);
+}
+
+/**
+* Replaces the contents with [first, last), which must be in strictly
+* increasing key order (checked unless checkSorted is false;
+* std::invalid_argument otherwise). Builds packed leaves and then each
+* inner level bottom-up in O(n); nodes of a level share out the entries
+* evenly so that each is at least half full.
+*/
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+template<typename ForwardIt>
+void BPlusTree<Key, Value, Compare, NodeBytes>::bulk_load(ForwardIt first, ForwardIt last, bool checkSorted)
+{
+    std::size_t n = 0;
+    for(ForwardIt it = first; it != last; ++it) {
+        ++n;
+    }
+    if(checkSorted && n > 1) {
+        ForwardIt prev = first;
+        ForwardIt it = first;
+        for(++it; it != last; ++prev, ++it) {
+            if(!comp_(prev->first, it->first)) {
+                throw std::invalid_argument("bulk_load: keys are not strictly increasing");
+            }
+        }
+    }
+    clear();
+    if(n == 0) {
+        return;
+    }
+
+    // Level 0: the leaves, with the smallest key under each node.
+    std::vector<Node*> level;
+    std::vector<const Key*> lowest;
+    std::size_t nodes = (n + kLeaf - 1) / kLeaf;
+    Leaf* prev = nullptr;
+    ForwardIt it = first;
+    for(std::size_t i = 0; i < nodes; ++i) {
+        Leaf* leaf = createLeaf();
+        std::size_t take = n / nodes + (i < n % nodes ? 1 : 0);
+        for(std::size_t j = 0; j < take; ++j, ++it) {
+            new (&leaf->slots[j]) value_type(*it);
+            leaf->count = static_cast<unsigned>(j + 1);
+        }
+        leaf->prev = prev;
+        if(prev != nullptr) {
+            prev->next = leaf;
+        }
+        prev = leaf;
+        level.push_back(leaf);
+        lowest.push_back(&leaf->key(0));
+    }
+    size_ = n;
+
+    // Inner levels until a single root remains.
+    while(level.size() > 1) {
+        std::size_t count = level.size();
+        nodes = (count + kInner) / (kInner + 1);
+        std::vector<Node*> upper;
+        std::vector<const Key*> upperLowest;
+        std::size_t next = 0;
+        for(std::size_t i = 0; i < nodes; ++i) {
+            Inner* inner = createInner();
+            std::size_t take = count / nodes + (i < count % nodes ? 1 : 0);
+            upperLowest.push_back(lowest[next]);
+            for(std::size_t j = 0; j < take; ++j, ++next) {
+                inner->children[j] = level[next];
+                if(j > 0) {
+                    inner->keys[j - 1] = *lowest[next];
+                }
+            }
+            inner->count = static_cast<unsigned>(take - 1);
+            upper.push_back(inner);
+        }
+        level.swap(upper);
+        lowest.swap(upperLowest);
+    }
+    root_ = level[0];
+}
+
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+typename BPlusTree<Key, Value, Compare, NodeBytes>::iterator
+BPlusTree<Key, Value, Compare, NodeBytes>::begin() const
+{
+    Node* node = root_;
+    if(node == nullptr) {
+        return end();
+    }
+    while(!node->leaf) {
+        node = static_cast<Inner*>(node)->children[0];
+    }
+    return iterator(static_cast<Leaf*>(node), 0);
+}
+
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+typename BPlusTree<Key, Value, Compare, NodeBytes>::iterator
+BPlusTree<Key, Value, Compare, NodeBytes>::end() const
+{
+    return iterator(nullptr, 0);
+}
+
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+typename BPlusTree<Key, Value, Compare, NodeBytes>::iterator
+BPlusTree<Key, Value, Compare, NodeBytes>::find(const Key& key) const
+{
+    Leaf* leaf = findLeaf(key);
+    if(leaf == nullptr) {
+        return end();
+    }
+    unsigned pos = leafLowerBound(leaf, key);
+    if(pos == leaf->count || comp_(key, leaf->key(pos))) {
+        return end();
+    }
+    return iterator(leaf, pos);
+}
+
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+typename BPlusTree<Key, Value, Compare, NodeBytes>::iterator
+BPlusTree<Key, Value, Compare, NodeBytes>::lower_bound(const Key& key) const
+{
+    Leaf* leaf = findLeaf(key);
+    if(leaf == nullptr) {
+        return end();
+    }
+    return iterator(leaf, leafLowerBound(leaf, key));
+}
+
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+typename BPlusTree<Key, Value, Compare, NodeBytes>::iterator
+BPlusTree<Key, Value, Compare, NodeBytes>::upper_bound(const Key& key) const
+{
+    iterator it = lower_bound(key);
+    if(it != end() && !comp_(key, it->first)) {
+        ++it;
+    }
+    return it;
+}
+
+/**
+ * Returns the value associated with the key, inserting a
+ * default-constructed value first if the key is not in the map.
+ */
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+Value& BPlusTree<Key, Value, Compare, NodeBytes>::operator[](const Key& key)
+{
+    return tryEmplace(key).first->second;
+}
+
+/**
+ * @precondition The key exists in the map
+ * Returns the value associated with the key
+ */
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+Value const & BPlusTree<Key, Value, Compare, NodeBytes>::operator[](const Key& key) const
+{
+    iterator it = find(key);
+    if(it == end()) throw std::out_of_range("Invalid key");
+    return it->second;
+}
+
+/**
+* Inserts (key, Value(args...)) unless key is present. Returns the item
+* and whether it was inserted. A split at the root grows a new root.
+*/
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+template<typename... Args>
+std::pair<typename BPlusTree<Key, Value, Compare, NodeBytes>::value_type*, bool>
+BPlusTree<Key, Value, Compare, NodeBytes>::tryEmplace(const Key& key, Args&&... args)
+{
+    if(root_ == nullptr) {
+        root_ = createLeaf();
+    }
+    Node* splitRight = nullptr;
+    Key splitKey;
+    std::pair<value_type*, bool> result = insertRec(root_, key, splitRight, splitKey,
+                                                    std::forward<Args>(args)...);
+    if(splitRight != nullptr) {
+        Inner* root = createInner();
+        root->keys[0] = std::move(splitKey);
+        root->children[0] = root_;
+        root->children[1] = splitRight;
+        root->count = 1;
+        root_ = root;
+    }
+    if(result.second) {
+        ++size_;
+    }
+    return result;
+}
+
+/**
+* Inserts below node. If node had to split, splitRight is set to the new
+* right sibling and splitKey to the smallest key under it.
+*/
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+template<typename... Args>
+std::pair<typename BPlusTree<Key, Value, Compare, NodeBytes>::value_type*, bool>
+BPlusTree<Key, Value, Compare, NodeBytes>::insertRec(Node* node, const Key& key, Node*& splitRight,
+                                                     Key& splitKey, Args&&... args)
+{
+    if(node->leaf) {
+        Leaf* leaf = static_cast<Leaf*>(node);
+        unsigned pos = leafLowerBound(leaf, key);
+        if(pos < leaf->count && !comp_(key, leaf->key(pos))) {
+            return std::make_pair(leaf->item(pos), false);
+        }
+        if(leaf->count < kLeaf) {
+            leaf->insertAt(pos, std::piecewise_construct, std::forward_as_tuple(key),
+                           std::forward_as_tuple(std::forward<Args>(args)...));
+            return std::make_pair(leaf->item(pos), true);
+        }
+        // Split. Appending past the last leaf starts a fresh one instead.
+        Leaf* right = createLeaf();
+        unsigned mid = (pos == leaf->count && leaf->next == nullptr) ? leaf->count
+                                                                      : (leaf->count + 1) / 2;
+        leaf->moveTail(mid, right, 0);
+        right->next = leaf->next;
+        right->prev = leaf;
+        if(leaf->next != nullptr) {
+            leaf->next->prev = right;
+        }
+        leaf->next = right;
+        Leaf* target = pos < mid ? leaf : right;
+        unsigned at = pos < mid ? pos : pos - mid;
+        target->insertAt(at, std::piecewise_construct, std::forward_as_tuple(key),
+                         std::forward_as_tuple(std::forward<Args>(args)...));
+        splitRight = right;
+        splitKey = right->key(0);
+        return std::make_pair(target->item(at), true);
+    }
+
+    Inner* inner = static_cast<Inner*>(node);
+    unsigned i = childIndex(inner, key);
+    Node* childRight = nullptr;
+    Key childKey;
+    std::pair<value_type*, bool> result = insertRec(inner->children[i], key, childRight, childKey,
+                                                    std::forward<Args>(args)...);
+    if(childRight == nullptr) {
+        return result;
+    }
+    if(inner->count < kInner) {
+        for(unsigned j = inner->count; j > i; --j) {
+            inner->keys[j] = std::move(inner->keys[j - 1]);
+            inner->children[j + 1] = inner->children[j];
+        }
+        inner->keys[i] = std::move(childKey);
+        inner->children[i + 1] = childRight;
+        ++inner->count;
+        return result;
+    }
+    // Split a full inner node around its middle key, which moves up.
+    Key keys[kInner + 1];
+    Node* children[kInner + 2];
+    for(unsigned j = 0, from = 0; j <= kInner; ++j) {
+        keys[j] = (j == i) ? std::move(childKey) : std::move(inner->keys[from++]);
+    }
+    for(unsigned j = 0, from = 0; j <= kInner + 1; ++j) {
+        children[j] = (j == i + 1) ? childRight : inner->children[from++];
+    }
+    const unsigned mid = (kInner + 1) / 2;
+    Inner* right = createInner();
+    for(unsigned j = 0; j < mid; ++j) {
+        inner->keys[j] = std::move(keys[j]);
+        inner->children[j] = children[j];
+    }
+    inner->children[mid] = children[mid];
+    inner->count = mid;
+    for(unsigned j = mid + 1; j <= kInner; ++j) {
+        right->keys[j - mid - 1] = std::move(keys[j]);
+        right->children[j - mid - 1] = children[j];
+    }
+    right->children[kInner - mid] = children[kInner + 1];
+    right->count = kInner - mid;
+    splitRight = right;
+    splitKey = std::move(keys[mid]);
+    return result;
+}
+
+/**
+* Removes key from below node; returns false if it is not there. Leaves
+* any underflow of node itself to the caller.
+*/
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+bool BPlusTree<Key, Value, Compare, NodeBytes>::removeRec(Node* node, const Key& key)
+{
+    if(node->leaf) {
+        Leaf* leaf = static_cast<Leaf*>(node);
+        unsigned pos = leafLowerBound(leaf, key);
+        if(pos == leaf->count || comp_(key, leaf->key(pos))) {
+            return false;
+        }
+        leaf->eraseAt(pos);
+        return true;
+    }
+    Inner* inner = static_cast<Inner*>(node);
+    unsigned i = childIndex(inner, key);
+    if(!removeRec(inner->children[i], key)) {
+        return false;
+    }
+    if(underflows(inner->children[i])) {
+        fixChild(inner, i);
+    }
+    return true;
+}
+
+/**
+* Refills child i of parent: borrow one entry from a sibling that can
+* spare it, otherwise merge with a sibling.
+*/
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+void BPlusTree<Key, Value, Compare, NodeBytes>::fixChild(Inner* parent, unsigned i)
+{
+    Node* child = parent->children[i];
+    Node* left = i > 0 ? parent->children[i - 1] : nullptr;
+    Node* right = i < parent->count ? parent->children[i + 1] : nullptr;
+    unsigned minCount = child->leaf ? kLeafMin : kInnerMin;
+
+    if(left != nullptr && left->count > minCount) {
+        if(child->leaf) {
+            Leaf* from = static_cast<Leaf*>(left);
+            Leaf* to = static_cast<Leaf*>(child);
+            to->insertAt(0, std::move(*from->item(from->count - 1)));
+            from->eraseAt(from->count - 1);
+            parent->keys[i - 1] = to->key(0);
+        }
+        else {
+            Inner* from = static_cast<Inner*>(left);
+            Inner* to = static_cast<Inner*>(child);
+            for(unsigned j = to->count; j > 0; --j) {
+                to->keys[j] = std::move(to->keys[j - 1]);
+            }
+            for(unsigned j = to->count + 1; j > 0; --j) {
+                to->children[j] = to->children[j - 1];
+            }
+            to->keys[0] = std::move(parent->keys[i - 1]);
+            to->children[0] = from->children[from->count];
+            parent->keys[i - 1] = std::move(from->keys[from->count - 1]);
+            --from->count;
+            ++to->count;
+        }
+    }
+    else if(right != nullptr && right->count > minCount) {
+        if(child->leaf) {
+            Leaf* from = static_cast<Leaf*>(right);
+            Leaf* to = static_cast<Leaf*>(child);
+            to->insertAt(to->count, std::move(*from->item(0)));
+            from->eraseAt(0);
+            parent->keys[i] = from->key(0);
+        }
+        else {
+            Inner* from = static_cast<Inner*>(right);
+            Inner* to = static_cast<Inner*>(child);
+            to->keys[to->count] = std::move(parent->keys[i]);
+            to->children[to->count + 1] = from->children[0];
+            ++to->count;
+            parent->keys[i] = std::move(from->keys[0]);
+            for(unsigned j = 1; j < from->count; ++j) {
+                from->keys[j - 1] = std::move(from->keys[j]);
+            }
+            for(unsigned j = 1; j <= from->count; ++j) {
+                from->children[j - 1] = from->children[j];
+            }
+            --from->count;
+        }
+    }
+    else if(left != nullptr) {
+        mergeChildren(parent, i - 1);
+    }
+    else {
+        mergeChildren(parent, i);
+    }
+}
+
+/**
+* Merges child i + 1 of parent into child i and drops the key between them.
+*/
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+void BPlusTree<Key, Value, Compare, NodeBytes>::mergeChildren(Inner* parent, unsigned i)
+{
+    Node* into = parent->children[i];
+    Node* from = parent->children[i + 1];
+    if(into->leaf) {
+        Leaf* left = static_cast<Leaf*>(into);
+        Leaf* right = static_cast<Leaf*>(from);
+        right->moveTail(0, left, left->count);
+        left->next = right->next;
+        if(right->next != nullptr) {
+            right->next->prev = left;
+        }
+    }
+    else {
+        Inner* left = static_cast<Inner*>(into);
+        Inner* right = static_cast<Inner*>(from);
+        left->keys[left->count] = std::move(parent->keys[i]);
+        for(unsigned j = 0; j < right->count; ++j) {
+            left->keys[left->count + 1 + j] = std::move(right->keys[j]);
+        }
+        for(unsigned j = 0; j <= right->count; ++j) {
+            left->children[left->count + 1 + j] = right->children[j];
+        }
+        left->count += right->count + 1;
+        right->count = 0;
+    }
+    destroyNode(from);
+    eraseFromInner(parent, i);
+}
+
+/**
+* Drops key keyIndex and the child to its right from inner.
+*/
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+void BPlusTree<Key, Value, Compare, NodeBytes>::eraseFromInner(Inner* inner, unsigned keyIndex)
+{
+    for(unsigned j = keyIndex + 1; j < inner->count; ++j) {
+        inner->keys[j - 1] = std::move(inner->keys[j]);
+        inner->children[j] = inner->children[j + 1];
+    }
+    --inner->count;
+}
+
+/**
+* The child of inner whose range holds key: the number of routing keys
+* not greater than key.
+*/
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+unsigned BPlusTree<Key, Value, Compare, NodeBytes>::childIndex(const Inner* inner, const Key& key) const
+{
+    unsigned lo = 0;
+    unsigned hi = inner->count;
+    while(lo < hi) {
+        unsigned mid = (lo + hi) / 2;
+        if(comp_(key, inner->keys[mid])) {
+            hi = mid;
+        }
+        else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+/**
+* Slot of the first item of leaf whose key is not less than key.
+*/
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+unsigned BPlusTree<Key, Value, Compare, NodeBytes>::leafLowerBound(Leaf* leaf, const Key& key) const
+{
+    unsigned lo = 0;
+    unsigned hi = leaf->count;
+    while(lo < hi) {
+        unsigned mid = (lo + hi) / 2;
+        if(comp_(leaf->key(mid), key)) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+typename BPlusTree<Key, Value, Compare, NodeBytes>::Leaf*
+BPlusTree<Key, Value, Compare, NodeBytes>::findLeaf(const Key& key) const
+{
+    Node* node = root_;
+    if(node == nullptr) {
+        return nullptr;
+    }
+    while(!node->leaf) {
+        const Inner* inner = static_cast<const Inner*>(node);
+        node = inner->children[childIndex(inner, key)];
+    }
+    return static_cast<Leaf*>(node);
+}
+
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+bool BPlusTree<Key, Value, Compare, NodeBytes>::underflows(const Node* node) const
+{
+    return node->count < (node->leaf ? kLeafMin : kInnerMin);
+}
+
+/**
+* Returns the height of the subtree at node if its keys lie in [lo, hi)
+* (either bound may be absent) and it is well formed, else -1.
+*/
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+int BPlusTree<Key, Value, Compare, NodeBytes>::checkNode(const Node* node, const Key* lo, const Key* hi) const
+{
+    if(node->leaf) {
+        Leaf* leaf = const_cast<Leaf*>(static_cast<const Leaf*>(node));
+        if(leaf->count > kLeaf) {
+            return -1;
+        }
+        for(unsigned j = 0; j < leaf->count; ++j) {
+            const Key& key = leaf->key(j);
+            if((lo != nullptr && comp_(key, *lo)) || (hi != nullptr && !comp_(key, *hi)) ||
+               (j > 0 && !comp_(leaf->key(j - 1), key))) {
+                return -1;
+            }
+        }
+        return 1;
+    }
+    const Inner* inner = static_cast<const Inner*>(node);
+    if(inner->count > kInner || (node != root_ && inner->count < kInnerMin) || inner->count == 0) {
+        return -1;
+    }
+    int height = -1;
+    for(unsigned j = 0; j <= inner->count; ++j) {
+        const Key* childLo = j > 0 ? &inner->keys[j - 1] : lo;
+        const Key* childHi = j < inner->count ? &inner->keys[j] : hi;
+        if(childLo != nullptr && childHi != nullptr && !comp_(*childLo, *childHi)) {
+            return -1;
+        }
+        int h = checkNode(inner->children[j], childLo, childHi);
+        if(h < 0 || (height >= 0 && h != height)) {
+            return -1;
+        }
+        height = h;
+    }
+    return height + 1;
+}
+
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+typename BPlusTree<Key, Value, Compare, NodeBytes>::Leaf*
+BPlusTree<Key, Value, Compare, NodeBytes>::createLeaf()
+{
+    Leaf* leaf = new Leaf();
+    ++leaves_;
+    return leaf;
+}
+
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+typename BPlusTree<Key, Value, Compare, NodeBytes>::Inner*
+BPlusTree<Key, Value, Compare, NodeBytes>::createInner()
+{
+    Inner* inner = new Inner();
+    ++inners_;
+    return inner;
+}
+
+/**
+* Frees one node, destroying a leaf's items; children are not touched.
+*/
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+void BPlusTree<Key, Value, Compare, NodeBytes>::destroyNode(Node* node)
+{
+    if(node->leaf) {
+        Leaf* leaf = static_cast<Leaf*>(node);
+        for(unsigned j = 0; j < leaf->count; ++j) {
+            leaf->item(j)->~value_type();
+        }
+        delete leaf;
+        --leaves_;
+    }
+    else {
+        delete static_cast<Inner*>(node);
+        --inners_;
+    }
+}
+
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+void BPlusTree<Key, Value, Compare, NodeBytes>::destroySubtree(Node* node)
+{
+    if(node == nullptr) {
+        return;
+    }
+    if(!node->leaf) {
+        Inner* inner = static_cast<Inner*>(node);
+        for(unsigned j = 0; j <= inner->count; ++j) {
+            destroySubtree(inner->children[j]);
+        }
+    }
+    destroyNode(node);
+}
+
+/*
+  -------------------------------------------
+  End implementations for the BPlusTree class.
+  -------------------------------------------
+*/
+
+#endif
@@ -1,10 +1,44 @@
 #include <iostream>
+#include <functional>
 #include <map>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
 #include "bst.h"
 #include "avlbst.h"
+#include "indexed_bst.h"
+#include "simd_index.h"
+#include "bplustree.h"
+#include "concurrent_avl.h"
+#include "sharded_map.h"
+#include "persistent_avl.h"
 
 using namespace std;
 
+/**
+* Stops a reader thread the first time it compares against gate, until
+* the writer releases it; the writer's own comparisons never wait.
+*/
+struct GatedLess
+{
+    static thread_local bool reader;
+    static std::atomic<int> gate;
+    static std::atomic<bool> paused;
+    static std::atomic<bool> released;
+
+    bool operator()(int a, int b) const
+    {
+        if(reader && (a == gate || b == gate) && !paused.exchange(true)) {
+            while(!released) std::this_thread::yield();
+        }
+        return a < b;
+    }
+};
+thread_local bool GatedLess::reader = false;
+std::atomic<int> GatedLess::gate(-1);
+std::atomic<bool> GatedLess::paused(false);
+std::atomic<bool> GatedLess::released(false);
 
 int main(int argc, char *argv[])
 {
@@ -44,5 +78,328 @@ int main(int argc, char *argv[])
     cout << "Erasing b" << endl;
     at.remove('b');
 
+    // Pooled allocator tests
+    PooledAVLTree<int,int> pt;
+    for(int i = 0; i < 8; ++i) {
+        pt.insert(std::make_pair(i, i * i));
+    }
+    pt.remove(3);
+    cout << "\nPooled AVLTree contents:" << endl;
+    for(PooledAVLTree<int,int>::iterator it = pt.begin(); it != pt.end(); ++it) {
+        cout << it->first << " " << it->second << endl;
+    }
+
+    // Copy / move tests
+    PooledAVLTree<int,int> copied(pt);
+    copied.remove(7);
+    PooledAVLTree<int,int> moved(std::move(pt));
+    pt.clear();
+    cout << "\nCopy has " << (copied.find(7) == copied.end() ? "no 7" : "7")
+         << ", moved-to tree has " << (moved.find(7) != moved.end() ? "7" : "no 7")
+         << ", moved-from tree is " << (pt.empty() ? "empty" : "not empty") << endl;
+
+    // Bulk load test
+    vector<pair<int,int> > sorted;
+    for(int i = 1; i <= 15; ++i) {
+        sorted.push_back(std::make_pair(i, -i));
+    }
+    AVLTree<int,int> bulk;
+    bulk.bulk_load(sorted.begin(), sorted.end());
+    bulk.insert(std::make_pair(16, -16));
+    cout << "\nBulk-loaded AVLTree (balanced: " << bulk.verifyBalance() << "):" << endl;
+    bulk.print();
+
+    // Batch insert test
+    vector<pair<int,int> > updates;
+    updates.push_back(std::make_pair(20, 20));
+    updates.push_back(std::make_pair(0, 0));
+    updates.push_back(std::make_pair(8, 64));
+    updates.push_back(std::make_pair(20, -20));
+    bulk.insert_batch(updates.begin(), updates.end());
+    cout << "\nAfter insert_batch (balanced: " << bulk.verifyBalance() << "):";
+    for(AVLTree<int,int>::iterator it = bulk.begin(); it != bulk.end(); ++it) {
+        cout << " " << it->first << "=" << it->second;
+    }
+    cout << endl;
+
+    // Set algebra tests
+    AVLTree<int,int> evens, threes;
+    for(int i = 0; i <= 12; ++i) {
+        if(i % 2 == 0) evens.insert(std::make_pair(i, 1));
+        if(i % 3 == 0) threes.insert(std::make_pair(i, 10));
+    }
+    AVLTree<int,int> both(evens), either(evens), onlyEvens(evens);
+    both.intersect_with(threes);
+    either.union_with(threes, [](const int&, int& mine, int& theirs) { return mine + theirs; });
+    onlyEvens.difference(threes);
+    cout << "\nintersect:";
+    for(AVLTree<int,int>::iterator it = both.begin(); it != both.end(); ++it) cout << " " << it->first << "=" << it->second;
+    cout << "\nunion:";
+    for(AVLTree<int,int>::iterator it = either.begin(); it != either.end(); ++it) cout << " " << it->first << "=" << it->second;
+    cout << "\ndifference:";
+    for(AVLTree<int,int>::iterator it = onlyEvens.begin(); it != onlyEvens.end(); ++it) cout << " " << it->first;
+    cout << endl;
+
+    // Split / concat tests
+    AVLTree<int,int> upper = either.split(6);
+    cout << "split at 6:";
+    for(AVLTree<int,int>::iterator it = either.begin(); it != either.end(); ++it) cout << " " << it->first;
+    cout << " |";
+    for(AVLTree<int,int>::iterator it = upper.begin(); it != upper.end(); ++it) cout << " " << it->first;
+    cout << " (sizes " << either.size() << " | " << upper.size() << ")";
+    either.concat(upper);
+    cout << "\nconcat back (balanced: " << either.verifyBalance() << "):";
+    for(AVLTree<int,int>::iterator it = either.begin(); it != either.end(); ++it) cout << " " << it->first;
+    cout << endl;
+
+    // Order statistic tests
+    RankedAVLTree<int,int> ranked;
+    for(int i = 0; i < 100; ++i) {
+        ranked.insert(std::make_pair(i * 10, i));
+    }
+    ranked.remove(500);
+    cout << "\nrank(505) = " << ranked.rank(505)
+         << ", select(90) = " << ranked.select(90)->first
+         << ", count_range(100, 200) = " << ranked.count_range(100, 200) << endl;
+
+    // Range aggregate tests
+    AggregateAVLTree<int,int,SumMonoid<int> > sums;
+    AggregateAVLTree<int,int,MaxMonoid<int> > maxes;
+    for(int i = 1; i <= 10; ++i) {
+        sums.insert(std::make_pair(i, i));
+        maxes.insert(std::make_pair(i, (i * 7) % 11));
+    }
+    sums.insert_or_assign(5, 50);
+    cout << "sum over [3, 7) = " << sums.aggregate(3, 7)
+         << ", max over [1, 6) = " << maxes.aggregate(1, 6) << endl;
+
+    // Bound and scan tests
+    cout << "lower_bound(55) = " << ranked.lower_bound(55)->first
+         << ", upper_bound(60) = " << ranked.upper_bound(60)->first
+         << ", equal_range(500) is " << (ranked.equal_range(500).first == ranked.equal_range(500).second ? "empty" : "not empty")
+         << endl;
+    RankedAVLTree<int,int>::scan_cursor cursor = ranked.scan(475, 545);
+    pair<int,int> page[3];
+    cout << "scan [475, 545):";
+    for(size_t got = cursor.next(page, 3); got > 0; got = cursor.next(page, 3)) {
+        cout << " [";
+        for(size_t i = 0; i < got; ++i) cout << (i ? " " : "") << page[i].first;
+        cout << "]";
+    }
+    cout << endl;
+
+    // Hinted insert tests
+    AVLTree<int,int> hinted;
+    AVLTree<int,int>::iterator last = hinted.end();
+    for(int i = 0; i < 10; ++i) {
+        last = hinted.insert(last, std::make_pair(i % 2 ? 10 - i : i, i));
+    }
+    hinted.insert(hinted.end(), std::make_pair(4, -4));
+    cout << "hinted (balanced: " << hinted.verifyBalance() << "):";
+    for(AVLTree<int,int>::iterator it = hinted.begin(); it != hinted.end(); ++it) cout << " " << it->first << "=" << it->second;
+    cout << endl;
+
+    // Comparator tests
+    AVLTree<int,int,std::allocator<pair<const int,int> >,AVLNode<int,int>,std::greater<int> > descending;
+    for(int i = 0; i < 5; ++i) descending.insert(std::make_pair(i, i));
+    cout << "descending:";
+    for(AVLTree<int,int,std::allocator<pair<const int,int> >,AVLNode<int,int>,std::greater<int> >::iterator it = descending.begin();
+        it != descending.end(); ++it) cout << " " << it->first;
+    OrderedAVLTree<string,int,ThreeWayCompare> names;
+    names.insert(std::make_pair(string("bob"), 2));
+    names.insert(std::make_pair(string("alice"), 1));
+    cout << ", find(\"bob\") by const char* = " << names.find("bob")->second << endl;
+
+    // Frozen snapshot tests
+    FrozenSearchTree<int,int> frozen = ranked.freeze();
+    cout << "frozen: size " << frozen.size() << ", find(490) = " << frozen.find(490)->second
+         << ", lower_bound(495) = " << frozen.lower_bound(495)->first << ", first three:";
+    FrozenSearchTree<int,int>::iterator fit = frozen.begin();
+    for(int i = 0; i < 3; ++i, ++fit) cout << " " << fit->first;
+    cout << endl;
+
+    // SIMD index tests
+    SimdSearchIndex<int,int> simd(ranked);
+    cout << "simd index: size " << simd.size() << ", find(730) = " << simd.find(730)->second
+         << ", lower_bound(501) = " << simd.lower_bound(501)->first
+         << ", find(500) is " << (simd.find(500) == simd.end() ? "end" : "not end") << endl;
+    bool descendingRejected = false;
+    try {
+        SimdSearchIndex<int,int> backwards(descending);
+    }
+    catch(const std::invalid_argument&) {
+        descendingRejected = true;
+    }
+    cout << "simd index from a descending tree rejected: " << descendingRejected << endl;
+
+    // B+ tree tests
+    BPlusTree<int,int> bplus;
+    for(int i = 0; i < 1000; ++i) bplus.insert(std::make_pair((i * 7) % 1000, i));
+    for(int i = 0; i < 1000; i += 2) bplus.remove(i);
+    bplus[1] = -1;
+    cout << "b+ tree: size " << bplus.size() << " (balanced: " << bplus.isBalanced()
+         << "), find(999) = " << bplus.find(999)->second << ", first three:";
+    BPlusTree<int,int>::iterator bit = bplus.begin();
+    for(int i = 0; i < 3; ++i, ++bit) cout << " " << bit->first << "=" << bit->second;
+    cout << endl;
+
+    // Concurrent AVL tests
+    ConcurrentAVLTree<int,int> shared;
+    for(int i = 0; i < 100; ++i) shared.insert(std::make_pair(i, i));
+    std::thread updater([&shared] {
+        for(int i = 0; i < 100; i += 2) shared.remove(i);
+        shared.insert(std::make_pair(1, -1));
+    });
+    int seen = 0;
+    {
+        ConcurrentAVLTree<int,int>::reader view(shared);
+        for(ConcurrentAVLTree<int,int>::iterator it = view.begin(); it != view.end(); ++it) seen += (it->first % 2 == 1);
+    }
+    updater.join();
+    int one = 0;
+    shared.find(1, one);
+    cout << "concurrent avl: odd keys seen " << seen << ", size " << shared.size()
+         << " (balanced: " << shared.isBalanced() << "), find(1) = " << one << endl;
+
+    // Concurrent two-child removal tests: a reader stopped at 7 goes on
+    // into the old right subtree after 7 is removed and must still reach 8.
+    int successorFound = -1, successorWalked = 0;
+    for(int round = 0; round < 2; ++round) {
+        ConcurrentAVLTree<int,int,GatedLess> gated;
+        for(int i = 0; i < 15; ++i) gated.insert(std::make_pair(i, i));
+        GatedLess::gate = 7;
+        GatedLess::paused = false;
+        GatedLess::released = false;
+        std::thread slowReader([&gated, &successorFound, &successorWalked, round] {
+            GatedLess::reader = true;
+            if(round == 0) {
+                gated.find(8, successorFound);
+            }
+            else {
+                ConcurrentAVLTree<int,int,GatedLess>::reader view(gated);
+                for(ConcurrentAVLTree<int,int,GatedLess>::iterator it = view.begin(); it != view.end(); ++it) {
+                    successorWalked += (it->first == 8);
+                }
+            }
+        });
+        while(!GatedLess::paused) std::this_thread::yield();
+        gated.remove(7);
+        GatedLess::released = true;
+        slowReader.join();
+    }
+    cout << "concurrent avl removal: find(8) = " << successorFound << ", 8 walked " << successorWalked << " time(s)" << endl;
+
+    // Sharded map tests
+    std::vector<int> cuts;
+    cuts.push_back(10);
+    cuts.push_back(20);
+    ShardedAVLMap<int,int> sharded(cuts);
+    for(int i = 0; i < 30; ++i) sharded.insert(std::make_pair(i, i * i));
+    for(int i = 0; i < 200; ++i) sharded.contains(i % 10);
+    bool shifted = sharded.rebalance();
+    cout << "sharded map: size " << sharded.size() << ", rebalanced " << shifted
+         << ", first boundary " << sharded.boundaries()[0] << ", scan [8, 12):";
+    sharded.scan(8, 12, [](const pair<const int,int>& item) { cout << " " << item.first << "=" << item.second; });
+    cout << endl;
+
+    // Persistent AVL tests
+    PersistentAVLTree<int,int> versioned;
+    for(int i = 0; i < 10; ++i) versioned.insert(std::make_pair(i, i));
+    PersistentAVLTree<int,int> before = versioned.snapshot();
+    versioned.remove(3);
+    versioned[4] = 40;
+    cout << "persistent avl: size " << versioned.size() << " (balanced: " << versioned.isBalanced()
+         << "), snapshot size " << before.size() << ", snapshot[4] = " << before[4]
+         << ", snapshot has 3: " << (before.find(3) != before.end()) << ", live[4] = " << versioned.find(4)->second << endl;
+
+    // Parallel build tests
+    std::vector<std::pair<int,int> > unsorted;
+    for(int i = 0; i < 5000; ++i) unsorted.push_back(std::make_pair((i * 7919) % 1000, i));
+    AVLTree<int,int> built;
+    built.insert(std::make_pair(-1, -1));
+    built.build_parallel(unsorted.begin(), unsorted.end(), 4);
+    int builtCount = 0;
+    for(AVLTree<int,int>::iterator it = built.begin(); it != built.end(); ++it) ++builtCount;
+    cout << "build_parallel: size " << builtCount << " (balanced: " << built.verifyBalance()
+         << "), has -1: " << (built.find(-1) != built.end()) << ", [0] = " << built[0] << endl;
+
+    // Parallel pass tests
+    long long valueSum = built.parallel_reduce(0LL,
+        [](const pair<const int,int>& item) { return static_cast<long long>(item.second); },
+        [](long long a, long long b) { return a + b; }, 4);
+    std::string keyList = built.parallel_reduce_ordered(std::string(),
+        [](const pair<const int,int>& item) { return item.first < 5 ? std::to_string(item.first) : std::string(); },
+        [](std::string a, const std::string& b) { return a + b; }, 4);
+    built.parallel_for_each([](pair<const int,int>& item) { item.second = -item.second; }, 4);
+    cout << "parallel passes: value sum " << valueSum << ", first keys \"" << keyList
+         << "\", [0] after for_each = " << built[0] << endl;
+
+    // Shape statistics tests
+    UnshapedBinarySearchTree<int,int> chain;
+    BinarySearchTree<int,int> shaped;
+    for(int i = 0; i < 100000; ++i) chain.insert(std::make_pair(i, i));
+    int shapedKeys[] = { 3, 1, 5, 0, 2, 4, 6 };
+    for(int i = 0; i < 7; ++i) shaped.insert(std::make_pair(shapedKeys[i], i));
+    bool shapedBefore = shaped.isBalanced();
+    shaped.insert(std::make_pair(10, 10));
+    shaped.insert(std::make_pair(11, 11));
+    cout << "shape: chain size " << chain.size() << ", height " << chain.height() << ", balanced " << chain.isBalanced()
+         << "; shaped size " << shaped.size() << ", height " << shaped.height() << ", balanced " << shapedBefore
+         << " then " << shaped.isBalanced() << "; built size " << built.size() << ", height " << built.height() << endl;
+
+    // Throwing resolve tests
+    AVLTree<int,int> merged, incoming;
+    for(int i = 0; i < 40000; ++i) {
+        merged.insert(std::make_pair(2 * i, 1));
+        incoming.insert(std::make_pair(3 * i, 2));
+    }
+    bool rethrown = false;
+    try {
+        merged.union_with(std::move(incoming), [](const int& key, int& mine, int& theirs) {
+            if(key % 7 == 0) throw std::runtime_error("resolve failed");
+            return mine + theirs;
+        }, 4);
+    }
+    catch(const std::runtime_error&) {
+        rethrown = true;
+    }
+    cout << "throwing resolve: rethrown " << rethrown << ", size " << merged.size()
+         << " (balanced: " << merged.verifyBalance() << "), 42=" << merged.find(42)->second
+         << ", 48=" << merged.find(48)->second << endl;
+
+    // Locked pool tests: the halves of a split share one pool, so with
+    // a locked pool they can be filled from two threads at once.
+    PooledAVLTree<int,int> lower((PoolAllocator<pair<const int,int> >(256, true)));
+    for(int i = 0; i < 2000; ++i) lower.insert(std::make_pair(i, i));
+    PooledAVLTree<int,int> higher = lower.split(1000);
+    std::thread filler([&higher] { for(int i = 2000; i < 4000; ++i) higher.insert(std::make_pair(i, i)); });
+    for(int i = -2000; i < 0; ++i) lower.insert(std::make_pair(i, i));
+    filler.join();
+    cout << "locked pool: sizes " << lower.size() << " | " << higher.size() << " (balanced: "
+         << (lower.verifyBalance() && higher.verifyBalance()) << ")" << endl;
+
+    // emplace / try_emplace / insert_or_assign / operator[] tests
+    AVLTree<string,string> st;
+    st.try_emplace("x", 3, 'x');
+    st.emplace(string("y"), string("why"));
+    cout << "\ntry_emplace on existing key inserted: " << st.try_emplace("x", "no").second << endl;
+    cout << "insert_or_assign on existing key inserted: " << st.insert_or_assign("y", "yes").second << endl;
+    st["z"] += "zed";
+    for(AVLTree<string,string>::iterator it = st.begin(); it != st.end(); ++it) {
+        cout << it->first << " " << it->second << endl;
+    }
+
+    // Index-linked storage tests
+    IndexedAVLTree<int,int> it32;
+    for(int i = 0; i < 8; ++i) {
+        it32.insert(std::make_pair(i, i * i));
+    }
+    it32.remove(3);
+    it32.remove(0);
+    cout << "\nIndexed AVLTree contents (balanced: " << it32.isBalanced() << "):" << endl;
+    for(IndexedAVLTree<int,int>::iterator it = it32.begin(); it != it32.end(); ++it) {
+        cout << it->first << " " << it->second << endl;
+    }
+
     return 0;
 }
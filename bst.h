@@ -4,23 +4,272 @@
 #include <iostream>
 #include <exception>
 #include <cstdlib>
+#include <cstdint>
 #include <utility>
 #include <algorithm>   // for std::max
 #include <cmath>       // for std::abs
+#include <memory>
+#include <atomic>
+#include <tuple>
+#include <type_traits>
+#include <stdexcept>
+#include <iterator>
+#include <limits>
+#include <vector>
+#include <functional>
+#include "node_pool.h"
+#include "tree_walk.h"
+#include "frozen_bst.h"
 
 /**
- * A templated class for a Node in a search tree.
- * The getters for parent/left/right are virtual so
- * that they can be overridden for future kinds of
- * search trees, such as Red Black trees, Splay trees,
- * and AVL trees.
+ * Tag selecting the Node constructors that build the item in place
+ * from arbitrary std::pair constructor arguments.
  */
-template <typename Key, typename Value>
-class Node
+struct InPlaceItem { };
+
+/**
+ * Augmentation policies for the node types. A node derives from its
+ * policy, which holds any per-subtree summary and recomputes it from the
+ * node's children in pull(self). The trees call pull bottom-up wherever
+ * a subtree changes; with the default NoAugment that compiles away.
+ */
+struct NoAugment
+{
+    static const bool augmented = false;
+
+    template<typename N>
+    void pull(const N*) { }
+};
+
+/**
+ * Tracks the number of nodes in each subtree, for rank/select queries.
+ */
+struct SubtreeSize
+{
+    static const bool augmented = true;
+
+    SubtreeSize() : size_(1) { }
+
+    std::size_t subtreeSize() const { return size_; }
+
+    template<typename N>
+    void pull(const N* self)
+    {
+        size_ = 1 + (self->getLeft() ? self->getLeft()->subtreeSize() : 0)
+                  + (self->getRight() ? self->getRight()->subtreeSize() : 0);
+    }
+
+protected:
+    std::size_t size_;
+};
+
+/**
+ * Tracks the height of each subtree and how many of its nodes are out of
+ * AVL balance (subtree heights more than one apart), so that height()
+ * and isBalanced() of a plain BinarySearchTree are O(1). This is the
+ * default augmentation of BinarySearchTree's nodes.
+ */
+struct SubtreeShape
+{
+    static const bool augmented = true;
+
+    SubtreeShape() : height_(1), unbalanced_(0) { }
+
+    int shapeHeight() const { return static_cast<int>(height_); }
+    std::size_t unbalancedNodes() const { return unbalanced_; }
+
+    template<typename N>
+    void pull(const N* self)
+    {
+        std::uint32_t leftHeight = 0, rightHeight = 0;
+        unbalanced_ = 0;
+        if(self->getLeft() != nullptr) {
+            leftHeight = self->getLeft()->height_;
+            unbalanced_ += self->getLeft()->unbalanced_;
+        }
+        if(self->getRight() != nullptr) {
+            rightHeight = self->getRight()->height_;
+            unbalanced_ += self->getRight()->unbalanced_;
+        }
+        height_ = 1 + std::max(leftHeight, rightHeight);
+        if(leftHeight > rightHeight + 1 || rightHeight > leftHeight + 1) {
+            ++unbalanced_;
+        }
+    }
+
+protected:
+    std::uint32_t height_;
+    std::uint32_t unbalanced_;
+};
+
+/**
+ * Caches, per subtree, the combination of its values in key order under
+ * a monoid, for aggregate(lo, hi) queries. Monoid supplies
+ *   typedef ... result_type;               (constructible from Value)
+ *   static result_type identity();
+ *   static result_type combine(const result_type&, const result_type&);
+ * where combine is associative. Values must only be changed through the
+ * tree (insert, insert_or_assign, ...): writes through an iterator or a
+ * reference from operator[] bypass the cache.
+ */
+template <typename Monoid>
+struct SubtreeAggregate
+{
+    static const bool augmented = true;
+    typedef typename Monoid::result_type aggregate_type;
+    typedef Monoid monoid_type;
+
+    SubtreeAggregate() : aggregate_(Monoid::identity()) { }
+
+    const aggregate_type& subtreeAggregate() const { return aggregate_; }
+
+    template<typename N>
+    void pull(const N* self)
+    {
+        aggregate_type own(self->getValue());
+        if(self->getLeft() != nullptr) {
+            own = Monoid::combine(self->getLeft()->subtreeAggregate(), own);
+        }
+        if(self->getRight() != nullptr) {
+            own = Monoid::combine(own, self->getRight()->subtreeAggregate());
+        }
+        aggregate_ = own;
+    }
+
+protected:
+    aggregate_type aggregate_;
+};
+
+/**
+ * Ready-made monoids for SubtreeAggregate.
+ */
+template <typename T>
+struct SumMonoid
+{
+    typedef T result_type;
+    static T identity() { return T(); }
+    static T combine(const T& a, const T& b) { return a + b; }
+};
+
+template <typename T>
+struct MinMonoid
+{
+    typedef T result_type;
+    static T identity() { return std::numeric_limits<T>::max(); }
+    static T combine(const T& a, const T& b) { return b < a ? b : a; }
+};
+
+template <typename T>
+struct MaxMonoid
+{
+    typedef T result_type;
+    static T identity() { return std::numeric_limits<T>::lowest(); }
+    static T combine(const T& a, const T& b) { return a < b ? b : a; }
+};
+
+/**
+ * Key ordering. The trees take a strict-weak-ordering Compare like
+ * std::map. A comparator that also has compare(a, b), returning a
+ * negative, zero or positive int, is used three-way on the search paths,
+ * so each level costs one key comparison instead of up to two. One that
+ * defines is_transparent additionally enables lookups by any type it can
+ * compare against Key, without building a Key.
+ */
+template <typename Compare, typename A, typename B>
+struct HasThreeWayCompare
+{
+private:
+    template <typename C>
+    static auto test(int) -> decltype(std::declval<const C&>().compare(std::declval<const A&>(),
+                                                                       std::declval<const B&>()),
+                                      std::true_type());
+    template <typename C>
+    static std::false_type test(...);
+public:
+    static const bool value = decltype(test<Compare>(0))::value;
+};
+
+template <typename Compare, typename A, typename B>
+int compareKeys(const Compare& comp, const A& a, const B& b, std::true_type)
+{
+    return comp.compare(a, b);
+}
+
+template <typename Compare, typename A, typename B>
+int compareKeys(const Compare& comp, const A& a, const B& b, std::false_type)
+{
+    return comp(a, b) ? -1 : (comp(b, a) ? 1 : 0);
+}
+
+template <typename Compare, typename A, typename B>
+int compareKeys(const Compare& comp, const A& a, const B& b)
+{
+    return compareKeys(comp, a, b,
+                       std::integral_constant<bool, HasThreeWayCompare<Compare, A, B>::value>());
+}
+
+/**
+ * A transparent three-way comparator built on the keys themselves: it
+ * calls a.compare(b) (or b.compare(a)) when the key type has one, as
+ * std::string and std::string_view do, and falls back to operator<.
+ */
+struct ThreeWayCompare
+{
+    typedef void is_transparent;
+
+    template <typename A, typename B>
+    bool operator()(const A& a, const B& b) const { return a < b; }
+
+    template <typename A, typename B>
+    int compare(const A& a, const B& b) const
+    {
+        return byMember(a, b, 0);
+    }
+
+private:
+    template <typename A, typename B>
+    static auto byMember(const A& a, const B& b, int) -> decltype(int(a.compare(b)))
+    {
+        return a.compare(b);
+    }
+    template <typename A, typename B>
+    static int byMember(const A& a, const B& b, long)
+    {
+        return byReverse(a, b, 0);
+    }
+    template <typename A, typename B>
+    static auto byReverse(const A& a, const B& b, int) -> decltype(int(b.compare(a)))
+    {
+        int r = b.compare(a);
+        return (r < 0) - (r > 0);
+    }
+    template <typename A, typename B>
+    static int byReverse(const A& a, const B& b, long)
+    {
+        return (b < a) - (a < b);
+    }
+};
+
+/**
+ * The common part of every search tree node: the item plus the
+ * parent/left/right links. Derived is the concrete node type
+ * (CRTP), so the links are typed as Derived* and the getters
+ * need no virtual dispatch or casts. Kinds of nodes such as
+ * AVLNode derive from BasicNode<Key, Value, AVLNode<Key, Value> >
+ * and add their own data.
+ *
+ * The parent link is stored as an integer whose low bits, selected by
+ * Derived::kParentTagMask, are free for the node type's own use (the
+ * node must be aligned so those bits are always zero in a real
+ * address). getParent/setParent ignore and preserve them.
+ */
+template <typename Key, typename Value, typename Derived>
+class BasicNode
 {
 public:
-    Node(const Key& key, const Value& value, Node<Key, Value>* parent);
-    virtual ~Node();
+    BasicNode(const Key& key, const Value& value, Derived* parent);
+    template<typename... Args>
+    explicit BasicNode(InPlaceItem, Args&&... args);
 
     const std::pair<const Key, Value>& getItem() const;
     std::pair<const Key, Value>& getItem();
@@ -28,35 +277,80 @@ public:
     const Value& getValue() const;
     Value& getValue();
 
-    virtual Node<Key, Value>* getParent() const;
-    virtual Node<Key, Value>* getLeft() const;
-    virtual Node<Key, Value>* getRight() const;
+    Derived* getParent() const;
+    Derived* getLeft() const;
+    Derived* getRight() const;
 
-    void setParent(Node<Key, Value>* parent);
-    void setLeft(Node<Key, Value>* left);
-    void setRight(Node<Key, Value>* right);
+    void setParent(Derived* parent);
+    void setLeft(Derived* left);
+    void setRight(Derived* right);
     void setValue(const Value &value);
 
+    // Copies or swaps the per-node bookkeeping (the parent tag bits)
+    // with other. Node types with extra data hide these with their own
+    // versions.
+    void copyNodeData(const Derived& other);
+    void swapNodeData(Derived& other);
+    // Told the heights of both subtrees when a tree is built bottom-up.
+    // A no-op here; node types that track balance hide it.
+    void setSubtreeHeights(int leftHeight, int rightHeight);
+
 protected:
+    // Nodes are destroyed through their concrete type only.
+    ~BasicNode();
+
     std::pair<const Key, Value> item_;
-    Node<Key, Value>* parent_;
-    Node<Key, Value>* left_;
-    Node<Key, Value>* right_;
+    std::uintptr_t parent_;   // Derived* plus tag bits
+    Derived* left_;
+    Derived* right_;
+};
+
+/**
+ * The node type used by BinarySearchTree, optionally augmented.
+ */
+template <typename Key, typename Value, typename Augment = NoAugment>
+class Node : public BasicNode<Key, Value, Node<Key, Value, Augment> >, public Augment
+{
+public:
+    static const std::uintptr_t kParentTagMask = 0;
+
+    Node(const Key& key, const Value& value, Node<Key, Value, Augment>* parent);
+    template<typename... Args>
+    explicit Node(InPlaceItem tag, Args&&... args);
+
+    void copyNodeData(const Node<Key, Value, Augment>& other);
+    void swapNodeData(Node<Key, Value, Augment>& other);
+    void pull();
 };
 
 /*
-  -----------------------------------------
-  Begin implementations for the Node class.
-  -----------------------------------------
+  -------------------------------------------
+  Begin implementations for the Node classes.
+  -------------------------------------------
 */
 
 /**
 * Explicit constructor for a node.
 */
-template<typename Key, typename Value>
-Node<Key, Value>::Node(const Key& key, const Value& value, Node<Key, Value>* parent) :
+template<typename Key, typename Value, typename Derived>
+BasicNode<Key, Value, Derived>::BasicNode(const Key& key, const Value& value, Derived* parent) :
     item_(key, value),
-    parent_(parent),
+    parent_(reinterpret_cast<std::uintptr_t>(parent)),
+    left_(NULL),
+    right_(NULL)
+{
+
+}
+
+/**
+* In-place constructor: forwards args to the item's std::pair constructor.
+* The node starts unlinked.
+*/
+template<typename Key, typename Value, typename Derived>
+template<typename... Args>
+BasicNode<Key, Value, Derived>::BasicNode(InPlaceItem, Args&&... args) :
+    item_(std::forward<Args>(args)...),
+    parent_(0),
     left_(NULL),
     right_(NULL)
 {
@@ -68,8 +362,8 @@ Node<Key, Value>::Node(const Key& key, const Value& value, Node<Key, Value>* par
 * are only used as references to existing nodes. The nodes pointed to by parent/left/right
 * are freed by the BinarySearchTree.
 */
-template<typename Key, typename Value>
-Node<Key, Value>::~Node()
+template<typename Key, typename Value, typename Derived>
+BasicNode<Key, Value, Derived>::~BasicNode()
 {
 
 }
@@ -77,8 +371,8 @@ Node<Key, Value>::~Node()
 /**
 * A const getter for the item.
 */
-template<typename Key, typename Value>
-const std::pair<const Key, Value>& Node<Key, Value>::getItem() const
+template<typename Key, typename Value, typename Derived>
+const std::pair<const Key, Value>& BasicNode<Key, Value, Derived>::getItem() const
 {
     return item_;
 }
@@ -86,8 +380,8 @@ const std::pair<const Key, Value>& Node<Key, Value>::getItem() const
 /**
 * A non-const getter for the item.
 */
-template<typename Key, typename Value>
-std::pair<const Key, Value>& Node<Key, Value>::getItem()
+template<typename Key, typename Value, typename Derived>
+std::pair<const Key, Value>& BasicNode<Key, Value, Derived>::getItem()
 {
     return item_;
 }
@@ -95,8 +389,8 @@ std::pair<const Key, Value>& Node<Key, Value>::getItem()
 /**
 * A const getter for the key.
 */
-template<typename Key, typename Value>
-const Key& Node<Key, Value>::getKey() const
+template<typename Key, typename Value, typename Derived>
+const Key& BasicNode<Key, Value, Derived>::getKey() const
 {
     return item_.first;
 }
@@ -104,8 +398,8 @@ const Key& Node<Key, Value>::getKey() const
 /**
 * A const getter for the value.
 */
-template<typename Key, typename Value>
-const Value& Node<Key, Value>::getValue() const
+template<typename Key, typename Value, typename Derived>
+const Value& BasicNode<Key, Value, Derived>::getValue() const
 {
     return item_.second;
 }
@@ -113,35 +407,35 @@ const Value& Node<Key, Value>::getValue() const
 /**
 * A non-const getter for the value.
 */
-template<typename Key, typename Value>
-Value& Node<Key, Value>::getValue()
+template<typename Key, typename Value, typename Derived>
+Value& BasicNode<Key, Value, Derived>::getValue()
 {
     return item_.second;
 }
 
 /**
-* An implementation of the virtual function for retreiving the parent.
+* A getter for the parent.
 */
-template<typename Key, typename Value>
-Node<Key, Value>* Node<Key, Value>::getParent() const
+template<typename Key, typename Value, typename Derived>
+Derived* BasicNode<Key, Value, Derived>::getParent() const
 {
-    return parent_;
+    return reinterpret_cast<Derived*>(parent_ & ~Derived::kParentTagMask);
 }
 
 /**
-* An implementation of the virtual function for retreiving the left child.
+* A getter for the left child.
 */
-template<typename Key, typename Value>
-Node<Key, Value>* Node<Key, Value>::getLeft() const
+template<typename Key, typename Value, typename Derived>
+Derived* BasicNode<Key, Value, Derived>::getLeft() const
 {
     return left_;
 }
 
 /**
-* An implementation of the virtual function for retreiving the right child.
+* A getter for the right child.
 */
-template<typename Key, typename Value>
-Node<Key, Value>* Node<Key, Value>::getRight() const
+template<typename Key, typename Value, typename Derived>
+Derived* BasicNode<Key, Value, Derived>::getRight() const
 {
     return right_;
 }
@@ -149,17 +443,17 @@ Node<Key, Value>* Node<Key, Value>::getRight() const
 /**
 * A setter for setting the parent of a node.
 */
-template<typename Key, typename Value>
-void Node<Key, Value>::setParent(Node<Key, Value>* parent)
+template<typename Key, typename Value, typename Derived>
+void BasicNode<Key, Value, Derived>::setParent(Derived* parent)
 {
-    parent_ = parent;
+    parent_ = reinterpret_cast<std::uintptr_t>(parent) | (parent_ & Derived::kParentTagMask);
 }
 
 /**
 * A setter for setting the left child of a node.
 */
-template<typename Key, typename Value>
-void Node<Key, Value>::setLeft(Node<Key, Value>* left)
+template<typename Key, typename Value, typename Derived>
+void BasicNode<Key, Value, Derived>::setLeft(Derived* left)
 {
     left_ = left;
 }
@@ -167,8 +461,8 @@ void Node<Key, Value>::setLeft(Node<Key, Value>* left)
 /**
 * A setter for setting the right child of a node.
 */
-template<typename Key, typename Value>
-void Node<Key, Value>::setRight(Node<Key, Value>* right)
+template<typename Key, typename Value, typename Derived>
+void BasicNode<Key, Value, Derived>::setRight(Derived* right)
 {
     right_ = right;
 }
@@ -176,36 +470,153 @@ void Node<Key, Value>::setRight(Node<Key, Value>* right)
 /**
 * A setter for the value of a node.
 */
-template<typename Key, typename Value>
-void Node<Key, Value>::setValue(const Value& value)
+template<typename Key, typename Value, typename Derived>
+void BasicNode<Key, Value, Derived>::setValue(const Value& value)
 {
     item_.second = value;
 }
 
+/**
+* Copies other's tag bits, leaving this node's links alone.
+*/
+template<typename Key, typename Value, typename Derived>
+void BasicNode<Key, Value, Derived>::copyNodeData(const Derived& other)
+{
+    parent_ = (parent_ & ~Derived::kParentTagMask) | (other.parent_ & Derived::kParentTagMask);
+}
+
+template<typename Key, typename Value, typename Derived>
+void BasicNode<Key, Value, Derived>::setSubtreeHeights(int leftHeight, int rightHeight)
+{
+
+}
+
+/**
+* Exchanges tag bits with other, leaving the links alone.
+*/
+template<typename Key, typename Value, typename Derived>
+void BasicNode<Key, Value, Derived>::swapNodeData(Derived& other)
+{
+    std::uintptr_t mine = parent_ & Derived::kParentTagMask;
+    parent_ = (parent_ & ~Derived::kParentTagMask) | (other.parent_ & Derived::kParentTagMask);
+    other.parent_ = (other.parent_ & ~Derived::kParentTagMask) | mine;
+}
+
+/**
+* Explicit constructor for a BST node.
+*/
+template<typename Key, typename Value, typename Augment>
+Node<Key, Value, Augment>::Node(const Key& key, const Value& value, Node<Key, Value, Augment>* parent) :
+    BasicNode<Key, Value, Node<Key, Value, Augment> >(key, value, parent)
+{
+
+}
+
+/**
+* In-place constructor for a BST node.
+*/
+template<typename Key, typename Value, typename Augment>
+template<typename... Args>
+Node<Key, Value, Augment>::Node(InPlaceItem tag, Args&&... args) :
+    BasicNode<Key, Value, Node<Key, Value, Augment> >(tag, std::forward<Args>(args)...)
+{
+
+}
+
+/**
+* Copies (or swaps) the augmentation along with the tag bits.
+*/
+template<typename Key, typename Value, typename Augment>
+void Node<Key, Value, Augment>::copyNodeData(const Node<Key, Value, Augment>& other)
+{
+    BasicNode<Key, Value, Node<Key, Value, Augment> >::copyNodeData(other);
+    static_cast<Augment&>(*this) = static_cast<const Augment&>(other);
+}
+
+template<typename Key, typename Value, typename Augment>
+void Node<Key, Value, Augment>::swapNodeData(Node<Key, Value, Augment>& other)
+{
+    BasicNode<Key, Value, Node<Key, Value, Augment> >::swapNodeData(other);
+    std::swap(static_cast<Augment&>(*this), static_cast<Augment&>(other));
+}
+
+/**
+* Recomputes the augmentation from the children.
+*/
+template<typename Key, typename Value, typename Augment>
+void Node<Key, Value, Augment>::pull()
+{
+    Augment::pull(this);
+}
+
 /*
-  ---------------------------------------
-  End implementations for the Node class.
-  ---------------------------------------
+  -----------------------------------------
+  End implementations for the Node classes.
+  -----------------------------------------
 */
 
 /**
 * A templated unbalanced binary search tree.
+* Nodes are obtained from Alloc (rebound to NodeT), so a PoolAllocator can
+* be plugged in to keep them packed in contiguous slabs. NodeT is the
+* concrete BasicNode type, fixed at compile time, which lets derived trees
+* (e.g. AVLTree) store their own node type without virtual node accessors.
+* By default the nodes carry SubtreeShape, which keeps height() and
+* isBalanced() O(1); UnshapedBinarySearchTree drops it.
 */
-template <typename Key, typename Value>
+template <typename Key, typename Value,
+          typename Alloc = std::allocator<std::pair<const Key, Value> >,
+          typename NodeT = Node<Key, Value, SubtreeShape>,
+          typename Compare = std::less<Key> >
 class BinarySearchTree
 {
 public:
-    BinarySearchTree(); //TODO
+    typedef typename std::allocator_traits<Alloc>::template rebind_alloc<NodeT> NodeAllocator;
+
+    explicit BinarySearchTree(const Alloc& alloc = Alloc()); //TODO
+    explicit BinarySearchTree(const Compare& comp, const Alloc& alloc = Alloc());
+    BinarySearchTree(const BinarySearchTree& other);
+    BinarySearchTree(BinarySearchTree&& other) noexcept;
+    BinarySearchTree& operator=(const BinarySearchTree& other);
+    BinarySearchTree& operator=(BinarySearchTree&& other);
     virtual ~BinarySearchTree(); //TODO
-    virtual void insert(const std::pair<const Key, Value>& keyValuePair); //TODO
-    virtual void remove(const Key& key); //TODO
+    void insert(const std::pair<const Key, Value>& keyValuePair); //TODO
+    void insert(std::pair<const Key, Value>&& keyValuePair);
+    void remove(const Key& key); //TODO
     void clear(); //TODO
-    bool isBalanced() const; //TODO
+    // Whether every node's two subtree heights are at most one apart.
+    // O(1) for an AVLTree and with SubtreeShape nodes (the default);
+    // O(n) with other nodes, e.g. in a RankedBinarySearchTree or an
+    // UnshapedBinarySearchTree.
+    virtual bool isBalanced() const; //TODO
+    // Always the full O(n) check, whatever the node type.
+    bool verifyBalance() const;
     void print() const;
     bool empty() const;
-
-    template<typename PPKey, typename PPValue>
-    friend void prettyPrintBST(BinarySearchTree<PPKey, PPValue> & tree);
+    std::size_t size() const;
+    // Levels in the tree, 0 when empty. O(1) with SubtreeShape nodes
+    // (the default), O(log n) for an AVLTree, else O(n).
+    virtual int height() const;
+    Compare key_comp() const;
+    FrozenSearchTree<Key, Value, Compare> freeze() const;
+    template<typename ForwardIt>
+    void bulk_load(ForwardIt first, ForwardIt last, bool checkSorted = true);
+
+    // Whole-tree passes shared by up to threads threads (see TreeWalk).
+    // fn(item) is called once per item, in no particular order. The
+    // reductions fold transform(item) of every item into init with
+    // combine, which must be associative; parallel_reduce also takes it
+    // to be commutative, while parallel_reduce_ordered combines the
+    // partial results left to right in key order.
+    template<typename Fn>
+    void parallel_for_each(Fn fn, unsigned threads = 1) const;
+    template<typename T, typename Transform, typename Combine>
+    T parallel_reduce(T init, Transform transform, Combine combine, unsigned threads = 1) const;
+    template<typename T, typename Transform, typename Combine>
+    T parallel_reduce_ordered(T init, Transform transform, Combine combine, unsigned threads = 1) const;
+
+    template<typename PPKey, typename PPValue, typename PPAlloc, typename PPNode, typename PPCompare>
+    friend void prettyPrintBST(BinarySearchTree<PPKey, PPValue, PPAlloc, PPNode, PPCompare> & tree);
 public:
     /**
     * An internal iterator class for traversing the contents of the BST.
@@ -224,37 +635,175 @@ public:
         iterator& operator++();
 
     protected:
-        friend class BinarySearchTree<Key, Value>;
-        iterator(Node<Key,Value>* ptr);
-        Node<Key, Value> *current_;
+        friend class BinarySearchTree<Key, Value, Alloc, NodeT, Compare>;
+        iterator(NodeT* ptr);
+        NodeT* current_;
+    };
+
+    /**
+    * A resumable forward scan that copies items out in batches. It keeps
+    * the pending ancestors on a stack of its own, so each item costs O(1)
+    * amortized with no parent-pointer climbing. Any change to the tree
+    * invalidates it; to resume later, start a new scan after the last
+    * key returned.
+    */
+    class scan_cursor
+    {
+    public:
+        scan_cursor();
+
+        std::size_t next(std::pair<Key, Value>* out, std::size_t max);
+        bool done() const;
+
+    protected:
+        friend class BinarySearchTree<Key, Value, Alloc, NodeT, Compare>;
+        void descendLeft(NodeT* node);
+
+        std::vector<NodeT*> pending_;   // next node on top
+        bool bounded_;
+        Key hi_;
+        Compare comp_;
     };
 
 public:
     iterator begin() const;
     iterator end() const;
     iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    iterator upper_bound(const Key& key) const;
+    std::pair<iterator, iterator> equal_range(const Key& key) const;
+    // Heterogeneous lookups, for a transparent Compare only.
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator find(const K& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator lower_bound(const K& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator upper_bound(const K& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    std::pair<iterator, iterator> equal_range(const K& key) const;
+    scan_cursor scan(const Key& lo) const;
+    scan_cursor scan(const Key& lo, const Key& hi) const;
     Value& operator[](const Key& key);
+    Value& operator[](Key&& key);
     Value const & operator[](const Key& key) const;
 
+    // Order statistics; need a node type augmented with SubtreeSize.
+    std::size_t rank(const Key& key) const;
+    iterator select(std::size_t index) const;
+    std::size_t count_range(const Key& lo, const Key& hi) const;
+    // Range aggregate; needs nodes augmented with SubtreeAggregate.
+    template<typename N = NodeT>
+    typename N::aggregate_type aggregate(const Key& lo, const Key& hi) const;
+
+    // std::map-style insertion. Each call walks the tree once and only
+    // allocates when a new node is actually linked in.
+    template<typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args);
+    template<typename K, typename M>
+    typename std::enable_if<std::is_same<typename std::decay<K>::type, Key>::value,
+                            std::pair<iterator, bool> >::type
+    emplace(K&& key, M&& obj);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(Key&& key, Args&&... args);
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(const Key& key, M&& obj);
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(Key&& key, M&& obj);
+
+    // Hinted insertion (overwrites like insert). When the key belongs right
+    // next to hint (end() meaning after the largest key), the node is linked
+    // there without a descent from the root.
+    iterator insert(iterator hint, const std::pair<const Key, Value>& keyValuePair);
+    iterator insert(iterator hint, std::pair<const Key, Value>&& keyValuePair);
+
 protected:
     // Mandatory helper functions
-    Node<Key, Value>* internalFind(const Key& k) const; // TODO
-    Node<Key, Value> *getSmallestNode() const;  // TODO
-    static Node<Key, Value>* predecessor(Node<Key, Value>* current); // TODO
+    template<typename K>
+    NodeT* internalFind(const K& k) const; // TODO
+    template<typename K>
+    NodeT* lowerBoundNode(const K& key) const;
+    template<typename K>
+    NodeT* upperBoundNode(const K& key) const;
+    template<typename A, typename B>
+    int compareKeys(const A& a, const B& b) const;
+    NodeT* getSmallestNode() const;  // TODO
+    static NodeT* predecessor(NodeT* current); // TODO
+    static NodeT* successor(NodeT* current);
     // Note:  static means these functions don't have a "this" pointer
     //        and instead just use the input argument.
 
     // Provided helper functions
-    virtual void printRoot (Node<Key, Value> *r) const;
-    virtual void nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2) ;
+    void printRoot (NodeT* r) const;
+    virtual void nodeSwap( NodeT* n1, NodeT* n2) ;
 
     // Add helper functions here
-    int checkBalance(Node<Key, Value>* node) const;// Returns the height of the subtree if balanced,or -1 if the subtree is unbalanced.
+    // Height of the subtree at node by an O(n) walk without recursion;
+    // balanced is cleared if any node in it is out of balance.
+    static int measureSubtree(NodeT* node, bool& balanced);
+    bool isBalanced(std::true_type) const;
+    bool isBalanced(std::false_type) const;
+    int height(std::true_type) const;
+    int height(std::false_type) const;
+    template<typename... Args>
+    NodeT* createNode(Args&&... args);
+    void destroyNode(NodeT* node);
+    void destroySubtree(NodeT* root);
+    template<bool MoveItems>
+    NodeT* cloneSubtree(typename std::conditional<MoveItems, NodeT, const NodeT>::type* root);
+    template<typename ForwardIt>
+    NodeT* buildSubtree(ForwardIt& it, std::size_t n, int& height);
+    template<bool Ordered, typename T, typename Transform, typename Combine>
+    T parallelReduce(T init, Transform& transform, Combine& combine, unsigned threads) const;
+    void moveAssign(BinarySearchTree& other, std::true_type);
+    void moveAssign(BinarySearchTree& other, std::false_type);
+    // Where a new key would be linked, plus its in-order neighbours
+    // (nullptr past either end), which become the finger once it is.
+    struct Slot
+    {
+        NodeT* parent;
+        bool asLeft;
+        NodeT* prev;
+        NodeT* next;
+    };
+    NodeT* findSlot(const Key& key, Slot& slot) const;
+    NodeT* findSlotNear(NodeT* hint, const Key& key, Slot& slot) const;
+    bool slotBeside(NodeT* at, NodeT* prev, NodeT* next, const Key& key,
+                    Slot& slot, NodeT*& existing) const;
+    void linkNode(NodeT* node, const Slot& slot);
+    void resetFinger();
+    static void pullPath(NodeT* node);
+    template<typename K, typename... Args>
+    std::pair<iterator, bool> tryEmplace(K&& key, Args&&... args);
+    template<typename K, typename M>
+    std::pair<iterator, bool> insertOrAssign(K&& key, M&& obj);
+    template<typename K, typename M>
+    std::pair<iterator, bool> assignOrLink(NodeT* existing, const Slot& slot, K&& key, M&& obj);
+
+    // Hooks for derived trees to restore their invariants after a node
+    // has been linked in, or unlinked from below parent.
+    virtual void insertFixup(NodeT* node);
+    virtual void removeFixup(NodeT* parent, bool fromLeft);
 
 
 protected:
-    Node<Key, Value>* root_;
-    // You should not need other data members
+    NodeT* root_;
+    // Nodes allocated and not yet destroyed, which outside of an update
+    // are the nodes in the tree. Trees that hand nodes to one another
+    // move the count along with them. kSizeUnknown after a split that
+    // could not tell the sizes of the parts; size() counts it then.
+    // Atomic only so that const size() calls may fill it in concurrently.
+    mutable std::atomic<std::size_t> size_;
+    static const std::size_t kSizeUnknown = static_cast<std::size_t>(-1);
+    NodeAllocator alloc_;
+    Compare comp_;
+    // Finger: the last node linked in and its in-order neighbours at that
+    // time. Rotations keep in-order neighbours, so it stays valid until
+    // one of the three is removed or the tree is rebuilt wholesale.
+    NodeT* finger_;
+    NodeT* fingerPrev_;
+    NodeT* fingerNext_;
 };
 
 /*
@@ -266,8 +815,8 @@ Begin implementations for the BinarySearchTree::iterator class.
 /**
 * Explicit constructor that initializes an iterator with a given node pointer.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator(Node<Key,Value> *ptr)
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::iterator::iterator(NodeT* ptr)
 {
     // TODO
     current_ = ptr;
@@ -276,8 +825,8 @@ BinarySearchTree<Key, Value>::iterator::iterator(Node<Key,Value> *ptr)
 /**
 * A default constructor that initializes the iterator to NULL.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator() 
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::iterator::iterator() 
 {
     current_ = nullptr;
     // TODO
@@ -287,9 +836,9 @@ BinarySearchTree<Key, Value>::iterator::iterator()
 /**
 * Provides access to the item.
 */
-template<class Key, class Value>
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
 std::pair<const Key,Value> &
-BinarySearchTree<Key, Value>::iterator::operator*() const
+BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::iterator::operator*() const
 {
     return current_->getItem();
 }
@@ -297,9 +846,9 @@ BinarySearchTree<Key, Value>::iterator::operator*() const
 /**
 * Provides access to the address of the item.
 */
-template<class Key, class Value>
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
 std::pair<const Key,Value> *
-BinarySearchTree<Key, Value>::iterator::operator->() const
+BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::iterator::operator->() const
 {
     return &(current_->getItem());
 }
@@ -308,10 +857,10 @@ BinarySearchTree<Key, Value>::iterator::operator->() const
 * Checks if 'this' iterator's internals have the same value
 * as 'rhs'
 */
-template<class Key, class Value>
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
 bool
-BinarySearchTree<Key, Value>::iterator::operator==(
-    const BinarySearchTree<Key, Value>::iterator& rhs) const
+BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::iterator::operator==(
+    const BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::iterator& rhs) const
 {
     // TODO
     return current_ == rhs.current_;
@@ -322,10 +871,10 @@ BinarySearchTree<Key, Value>::iterator::operator==(
 * Checks if 'this' iterator's internals have a different value
 * as 'rhs'
 */
-template<class Key, class Value>
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
 bool
-BinarySearchTree<Key, Value>::iterator::operator!=(
-    const BinarySearchTree<Key, Value>::iterator& rhs) const
+BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::iterator::operator!=(
+    const BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::iterator& rhs) const
 {
     // TODO
 
@@ -337,9 +886,9 @@ BinarySearchTree<Key, Value>::iterator::operator!=(
 /**
 * Advances the iterator's location using an in-order sequencing
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator&
-BinarySearchTree<Key, Value>::iterator::operator++()
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::iterator&
+BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::iterator::operator++()
 {
     // TODO
     if (current_ == nullptr) {
@@ -352,7 +901,7 @@ BinarySearchTree<Key, Value>::iterator::operator++()
             current_ = current_->getLeft();
         }
     } else {
-        Node<Key, Value>* parent = current_->getParent();
+        NodeT* parent = current_->getParent();
         while (parent != nullptr && current_ == parent->getRight()) {
             current_ = parent;
             parent = parent->getParent();
@@ -371,6 +920,69 @@ End implementations for the BinarySearchTree::iterator class.
 -------------------------------------------------------------
 */
 
+/*
+-----------------------------------------------------------------
+Begin implementations for the BinarySearchTree::scan_cursor class.
+-----------------------------------------------------------------
+*/
+
+/**
+* An exhausted cursor.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::scan_cursor::scan_cursor() :
+    bounded_(false), hi_(), comp_()
+{
+
+}
+
+/**
+* Copies up to max of the next items into out and returns how many were
+* copied; fewer than max means the scan is over.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+std::size_t BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::scan_cursor::next(std::pair<Key, Value>* out, std::size_t max)
+{
+    std::size_t count = 0;
+    while(count < max && !pending_.empty()) {
+        NodeT* node = pending_.back();
+        if(bounded_ && !comp_(node->getKey(), hi_)) {
+            pending_.clear();
+            break;
+        }
+        pending_.pop_back();
+        out[count++] = node->getItem();
+        descendLeft(node->getRight());
+    }
+    return count;
+}
+
+/**
+* True once every item in range has been handed out.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+bool BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::scan_cursor::done() const
+{
+    return pending_.empty() || (bounded_ && !comp_(pending_.back()->getKey(), hi_));
+}
+
+/**
+* Pushes node and its chain of left children.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+void BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::scan_cursor::descendLeft(NodeT* node)
+{
+    for(; node != nullptr; node = node->getLeft()) {
+        pending_.push_back(node);
+    }
+}
+
+/*
+---------------------------------------------------------------
+End implementations for the BinarySearchTree::scan_cursor class.
+---------------------------------------------------------------
+*/
+
 /*
 -----------------------------------------------------
 Begin implementations for the BinarySearchTree class.
@@ -380,184 +992,723 @@ Begin implementations for the BinarySearchTree class.
 /**
 * Default constructor for a BinarySearchTree, which sets the root to NULL.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::BinarySearchTree() : root_(nullptr)
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::BinarySearchTree(const Alloc& alloc) :
+    root_(nullptr), size_(0), alloc_(alloc), comp_(),
+    finger_(nullptr), fingerPrev_(nullptr), fingerNext_(nullptr)
 {
     // TODO
 }
 
-template<typename Key, typename Value>
-BinarySearchTree<Key, Value>::~BinarySearchTree()
+/**
+* Constructs an empty tree ordered by comp.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::BinarySearchTree(const Compare& comp, const Alloc& alloc) :
+    root_(nullptr), size_(0), alloc_(alloc), comp_(comp),
+    finger_(nullptr), fingerPrev_(nullptr), fingerNext_(nullptr)
 {
-    // TODO
-    clear();
+}
 
+/**
+* Copy constructor: an O(n) structural clone of other. Every node is
+* copied into the same position, together with its node data (e.g. the
+* AVL balance), so no key is compared and nothing is rebalanced.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::BinarySearchTree(const BinarySearchTree& other) :
+    root_(nullptr), size_(0),
+    alloc_(std::allocator_traits<NodeAllocator>::select_on_container_copy_construction(other.alloc_)),
+    comp_(other.comp_),
+    finger_(nullptr), fingerPrev_(nullptr), fingerNext_(nullptr)
+{
+    root_ = cloneSubtree<false>(other.root_);
 }
 
 /**
- * Returns true if tree is empty
+* Move constructor: takes over other's nodes in O(1) and leaves it empty.
+* The allocator is copied rather than moved so that other, which keeps
+* using it, still has a working one.
 */
-template<class Key, class Value>
-bool BinarySearchTree<Key, Value>::empty() const
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::BinarySearchTree(BinarySearchTree&& other) noexcept :
+    root_(other.root_), size_(other.size_.load(std::memory_order_relaxed)),
+    alloc_(other.alloc_), comp_(other.comp_),
+    finger_(other.finger_), fingerPrev_(other.fingerPrev_), fingerNext_(other.fingerNext_)
 {
-    return root_ == NULL;
+    other.root_ = nullptr;
+    other.size_.store(0, std::memory_order_relaxed);
+    other.resetFinger();
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::print() const
+/**
+* Copy assignment. The clone is built before the old contents are
+* released, so a throwing copy leaves this tree unchanged.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+BinarySearchTree<Key, Value, Alloc, NodeT, Compare>&
+BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::operator=(const BinarySearchTree& other)
 {
-    printRoot(root_);
+    if(this != &other) {
+        NodeT* copy = cloneSubtree<false>(other.root_);
+        clear();
+        root_ = copy;
+        comp_ = other.comp_;
+    }
+    return *this;
 }
 
 /**
-* Returns an iterator to the "smallest" item in the tree
+* Move assignment: O(1) when the allocator propagates or both trees share
+* one; otherwise the items have to be moved into nodes from this tree's
+* allocator, which is O(n).
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::begin() const
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+BinarySearchTree<Key, Value, Alloc, NodeT, Compare>&
+BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::operator=(BinarySearchTree&& other)
 {
-    BinarySearchTree<Key, Value>::iterator begin(getSmallestNode());
-    return begin;
+    if(this != &other) {
+        comp_ = other.comp_;
+        moveAssign(other, typename std::allocator_traits<NodeAllocator>::propagate_on_container_move_assignment());
+    }
+    return *this;
+}
+
+template<typename Key, typename Value, typename Alloc, typename NodeT, typename Compare>
+BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::~BinarySearchTree()
+{
+    // TODO
+    clear();
+
 }
 
 /**
-* Returns an iterator whose value means INVALID
+ * Returns true if tree is empty
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::end() const
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+bool BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::empty() const
 {
-    BinarySearchTree<Key, Value>::iterator end(NULL);
-    return end;
+    return root_ == NULL;
 }
 
 /**
-* Returns an iterator to the item with the given key, k
-* or the end iterator if k does not exist in the tree
+* Returns a copy of the comparator that orders the keys.
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::find(const Key & k) const
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+Compare BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::key_comp() const
 {
-    Node<Key, Value> *curr = internalFind(k);
-    BinarySearchTree<Key, Value>::iterator it(curr);
-    return it;
+    return comp_;
 }
 
 /**
- * @precondition The key exists in the map
- * Returns the value associated with the key
- */
-template<class Key, class Value>
-Value& BinarySearchTree<Key, Value>::operator[](const Key& key)
+* Returns an immutable copy of the current contents laid out for fast
+* read-only lookups; see FrozenSearchTree. O(n). Later changes to this
+* tree do not show up in it.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+FrozenSearchTree<Key, Value, Compare> BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::freeze() const
 {
-    Node<Key, Value> *curr = internalFind(key);
-    if(curr == NULL) throw std::out_of_range("Invalid key");
-    return curr->getValue();
+    std::vector<const std::pair<const Key, Value>*> items;
+    for(iterator it = begin(); it != end(); ++it) {
+        items.push_back(&*it);
+    }
+    return FrozenSearchTree<Key, Value, Compare>(items.begin(), items.end(), comp_, false);
 }
-template<class Key, class Value>
-Value const & BinarySearchTree<Key, Value>::operator[](const Key& key) const
+
+template<typename Key, typename Value, typename Alloc, typename NodeT, typename Compare>
+void BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::print() const
 {
-    Node<Key, Value> *curr = internalFind(key);
-    if(curr == NULL) throw std::out_of_range("Invalid key");
-    return curr->getValue();
+    printRoot(root_);
 }
 
 /**
-* An insert method to insert into a Binary Search Tree.
-* The tree will not remain balanced when inserting.
-* Recall: If key is already in the tree, you should 
-* overwrite the current value with the updated value.
+* Replaces the contents with the items of the sorted range [first, last)
+* in O(n). The tree is built directly in perfectly balanced shape (the
+* two subtrees of every node differ in size by at most one), so nothing
+* is searched for or rotated. The keys must be strictly increasing; with
+* checkSorted this is verified up front (n - 1 comparisons) and
+* std::invalid_argument is thrown otherwise. If building fails the tree
+* keeps its old contents.
 */
-template<class Key, class Value>
-void BinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value> &keyValuePair)
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+template<typename ForwardIt>
+void BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::bulk_load(ForwardIt first, ForwardIt last, bool checkSorted)
 {
-    // TODO
-    Node<Key, Value>* newNode = new Node<Key, Value>(keyValuePair.first, keyValuePair.second, nullptr);
-    if (root_ == nullptr) {
-        root_ = newNode;
-    } else {
-        Node<Key, Value>* current = root_;
-        Node<Key, Value>* parent = nullptr;
-        while (current != nullptr) {
-            parent = current;
-            if (keyValuePair.first < current->getKey()) {
-                current = current->getLeft();
-            } else if (keyValuePair.first > current->getKey()) {
-                current = current->getRight();
-            } else {
-                current->setValue(keyValuePair.second); // Overwrite value if key exists
-                delete newNode; // Clean up new node
-                return;
+    if(checkSorted && first != last) {
+        ForwardIt prev = first;
+        for(ForwardIt it = std::next(first); it != last; prev = it, ++it) {
+            if(!comp_(prev->first, it->first)) {
+                throw std::invalid_argument("bulk_load: keys are not strictly increasing");
             }
         }
-        if (keyValuePair.first < parent->getKey()) {
-            parent->setLeft(newNode);
-        } else {
-            parent->setRight(newNode);
-        }
-        newNode->setParent(parent);
     }
+    int height;
+    NodeT* built = buildSubtree(first, static_cast<std::size_t>(std::distance(first, last)), height);
+    clear();
+    root_ = built;
 }
 
+/**
+* Calls fn(item) for every item, on up to threads threads at once; fn
+* must be safe to call concurrently on different items. If a call
+* throws, the pass stops early and the exception is rethrown here.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+template<typename Fn>
+void BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::parallel_for_each(Fn fn, unsigned threads) const
+{
+    struct NoSlot { };
+    auto visit = [&fn](NodeT* node, NoSlot&, NoSlot&) { fn(node->getItem()); };
+    TreeWalk<NodeT, NoSlot> walk(root_, threads);
+    walk.run(visit);
+}
+
+/**
+* Returns init combined with transform(item) for every item, in any
+* order and grouping: combine must be associative and commutative.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+template<typename T, typename Transform, typename Combine>
+T BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::parallel_reduce(T init, Transform transform, Combine combine,
+                                                                       unsigned threads) const
+{
+    return parallelReduce<false>(std::move(init), transform, combine, threads);
+}
+
+/**
+* Like parallel_reduce, but the result is init combined with the
+* transformed items in key order; combine need only be associative.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+template<typename T, typename Transform, typename Combine>
+T BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::parallel_reduce_ordered(T init, Transform transform,
+                                                                               Combine combine,
+                                                                               unsigned threads) const
+{
+    return parallelReduce<true>(std::move(init), transform, combine, threads);
+}
+
+/**
+* Shared by the reductions: each segment of the walk (Ordered) or each
+* worker accumulates its items on its own, starting from its first item
+* rather than from init, and the partial results are folded into init
+* at the end.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+template<bool Ordered, typename T, typename Transform, typename Combine>
+T BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::parallelReduce(T init, Transform& transform,
+                                                                      Combine& combine, unsigned threads) const
+{
+    typedef std::unique_ptr<T> Partial;
+    auto visit = [&transform, &combine](NodeT* node, Partial& segmentSlot, Partial& workerSlot) {
+        Partial& partial = Ordered ? segmentSlot : workerSlot;
+        if(!partial) {
+            partial.reset(new T(transform(node->getItem())));
+        }
+        else {
+            *partial = combine(std::move(*partial), transform(node->getItem()));
+        }
+    };
+    TreeWalk<NodeT, Partial> walk(root_, threads);
+    walk.run(visit);
+
+    T result = std::move(init);
+    if(Ordered) {
+        for(typename TreeWalk<NodeT, Partial>::Segment* s = walk.segments(); s != nullptr; s = s->next) {
+            if(s->slot) {
+                result = combine(std::move(result), std::move(*s->slot));
+            }
+        }
+    }
+    else {
+        for(std::size_t i = 0; i < walk.workerCount(); ++i) {
+            if(walk.workerSlot(i)) {
+                result = combine(std::move(result), std::move(*walk.workerSlot(i)));
+            }
+        }
+    }
+    return result;
+}
+
+/**
+* Returns an iterator to the "smallest" item in the tree
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::begin() const
+{
+    BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::iterator begin(getSmallestNode());
+    return begin;
+}
+
+/**
+* Returns an iterator whose value means INVALID
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::end() const
+{
+    BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::iterator end(NULL);
+    return end;
+}
+
+/**
+* Returns an iterator to the item with the given key, k
+* or the end iterator if k does not exist in the tree
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::find(const Key & k) const
+{
+    NodeT* curr = internalFind(k);
+    BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::iterator it(curr);
+    return it;
+}
+
+/**
+* Returns an iterator to the first item whose key is not less than key,
+* or end() if there is none.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::lower_bound(const Key& key) const
+{
+    return iterator(lowerBoundNode(key));
+}
+
+/**
+* Returns an iterator to the first item whose key is greater than key,
+* or end() if there is none.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::upper_bound(const Key& key) const
+{
+    return iterator(upperBoundNode(key));
+}
+
+/**
+* Returns [lower_bound(key), upper_bound(key)): empty, or just the item
+* with that key.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+std::pair<typename BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::iterator,
+          typename BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::iterator>
+BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::equal_range(const Key& key) const
+{
+    iterator first = lower_bound(key);
+    iterator last = first;
+    if(first != end() && !comp_(key, first->first)) {
+        ++last;
+    }
+    return std::make_pair(first, last);
+}
+
+/**
+* The same lookups by any key type a transparent Compare accepts, e.g. a
+* std::string_view or const char* into a tree keyed by std::string.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::find(const K& key) const
+{
+    return iterator(internalFind(key));
+}
+
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::lower_bound(const K& key) const
+{
+    return iterator(lowerBoundNode(key));
+}
+
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::upper_bound(const K& key) const
+{
+    return iterator(upperBoundNode(key));
+}
+
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+template<typename K, typename C, typename>
+std::pair<typename BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::iterator,
+          typename BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::iterator>
+BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::equal_range(const K& key) const
+{
+    iterator first = iterator(lowerBoundNode(key));
+    iterator last = first;
+    if(first != end() && !comp_(key, first->first)) {
+        ++last;
+    }
+    return std::make_pair(first, last);
+}
+
+/**
+* Starts a scan at the first key not less than lo. Seeking is O(log n);
+* the cursor then returns items in key order.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::scan_cursor
+BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::scan(const Key& lo) const
+{
+    scan_cursor cursor;
+    cursor.comp_ = comp_;
+    NodeT* current = root_;
+    while(current != nullptr) {
+        if(comp_(current->getKey(), lo)) {
+            current = current->getRight();
+        }
+        else {
+            cursor.pending_.push_back(current);
+            current = current->getLeft();
+        }
+    }
+    return cursor;
+}
+
+/**
+* Same as scan(lo), stopping before the first key not less than hi.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::scan_cursor
+BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::scan(const Key& lo, const Key& hi) const
+{
+    scan_cursor cursor = scan(lo);
+    cursor.bounded_ = true;
+    cursor.hi_ = hi;
+    return cursor;
+}
+
+/**
+ * Returns the value associated with the key, inserting a
+ * default-constructed value first if the key is not in the map.
+ */
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+Value& BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::operator[](const Key& key)
+{
+    return tryEmplace(key).first->second;
+}
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+Value& BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::operator[](Key&& key)
+{
+    return tryEmplace(std::move(key)).first->second;
+}
+
+/**
+ * @precondition The key exists in the map
+ * Returns the value associated with the key
+ */
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+Value const & BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::operator[](const Key& key) const
+{
+    NodeT* curr = internalFind(key);
+    if(curr == NULL) throw std::out_of_range("Invalid key");
+    return curr->getValue();
+}
+
+/**
+* Returns the number of keys less than key, in O(log n).
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+std::size_t BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::rank(const Key& key) const
+{
+    static_assert(std::is_base_of<SubtreeSize, NodeT>::value,
+                  "rank() needs nodes augmented with SubtreeSize");
+    std::size_t below = 0;
+    NodeT* current = root_;
+    while(current != nullptr) {
+        if(comp_(current->getKey(), key)) {
+            below += 1 + (current->getLeft() ? current->getLeft()->subtreeSize() : 0);
+            current = current->getRight();
+        }
+        else {
+            current = current->getLeft();
+        }
+    }
+    return below;
+}
+
+/**
+* Returns an iterator to the item with the given zero-based position in
+* key order, or end() if there are not that many items. O(log n).
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::select(std::size_t index) const
+{
+    static_assert(std::is_base_of<SubtreeSize, NodeT>::value,
+                  "select() needs nodes augmented with SubtreeSize");
+    NodeT* current = root_;
+    while(current != nullptr) {
+        std::size_t leftSize = current->getLeft() ? current->getLeft()->subtreeSize() : 0;
+        if(index < leftSize) {
+            current = current->getLeft();
+        }
+        else if(index == leftSize) {
+            break;
+        }
+        else {
+            index -= leftSize + 1;
+            current = current->getRight();
+        }
+    }
+    return iterator(current);
+}
+
+/**
+* Returns the number of keys in [lo, hi), in O(log n).
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+std::size_t BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::count_range(const Key& lo, const Key& hi) const
+{
+    if(!comp_(lo, hi)) {
+        return 0;
+    }
+    return rank(hi) - rank(lo);
+}
+
+/**
+* Combines the values of all keys in [lo, hi), in key order, in O(log n):
+* find the highest node inside the range, then take whole cached subtrees
+* along the two paths from it towards lo and towards hi.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+template<typename N>
+typename N::aggregate_type BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::aggregate(const Key& lo, const Key& hi) const
+{
+    typedef typename N::monoid_type Monoid;
+    typedef typename N::aggregate_type Result;
+
+    NodeT* split = root_;
+    while(split != nullptr && (comp_(split->getKey(), lo) || !comp_(split->getKey(), hi))) {
+        split = comp_(split->getKey(), lo) ? split->getRight() : split->getLeft();
+    }
+    if(split == nullptr) {
+        return Monoid::identity();
+    }
+
+    // Keys >= lo below split's left child, collected right to left.
+    Result low = Monoid::identity();
+    for(NodeT* n = split->getLeft(); n != nullptr; ) {
+        if(comp_(n->getKey(), lo)) {
+            n = n->getRight();
+        }
+        else {
+            Result part(n->getValue());
+            if(n->getRight() != nullptr) {
+                part = Monoid::combine(part, n->getRight()->subtreeAggregate());
+            }
+            low = Monoid::combine(part, low);
+            n = n->getLeft();
+        }
+    }
+    // Keys < hi below split's right child, collected left to right.
+    Result high = Monoid::identity();
+    for(NodeT* n = split->getRight(); n != nullptr; ) {
+        if(comp_(n->getKey(), hi)) {
+            if(n->getLeft() != nullptr) {
+                high = Monoid::combine(high, n->getLeft()->subtreeAggregate());
+            }
+            high = Monoid::combine(high, Result(n->getValue()));
+            n = n->getRight();
+        }
+        else {
+            n = n->getLeft();
+        }
+    }
+    return Monoid::combine(Monoid::combine(low, Result(split->getValue())), high);
+}
+
+/**
+* An insert method to insert into a Binary Search Tree.
+* The tree will not remain balanced when inserting.
+* Recall: If key is already in the tree, you should 
+* overwrite the current value with the updated value.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+void BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::insert(const std::pair<const Key, Value> &keyValuePair)
+{
+    insertOrAssign(keyValuePair.first, keyValuePair.second);
+}
+
+/**
+* Same as above, but moves the value into the tree.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+void BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::insert(std::pair<const Key, Value> &&keyValuePair)
+{
+    insertOrAssign(keyValuePair.first, std::move(keyValuePair.second));
+}
+
+/**
+* Hinted insert. If the key sorts between hint's predecessor and hint, or
+* between hint and its successor, it is linked right there: at most two
+* key comparisons, and the rebalancing starts from the new leaf. Any
+* other hint costs one comparison on top of a normal insert.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::insert(iterator hint, const std::pair<const Key, Value> &keyValuePair)
+{
+    Slot slot;
+    NodeT* existing = findSlotNear(hint.current_, keyValuePair.first, slot);
+    return assignOrLink(existing, slot, keyValuePair.first, keyValuePair.second).first;
+}
+
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::insert(iterator hint, std::pair<const Key, Value> &&keyValuePair)
+{
+    Slot slot;
+    NodeT* existing = findSlotNear(hint.current_, keyValuePair.first, slot);
+    return assignOrLink(existing, slot, keyValuePair.first, std::move(keyValuePair.second)).first;
+}
+
+/**
+* Constructs an item from args and inserts it unless its key is already
+* present. Since the key is only known once the item exists, this general
+* form builds the node up front and discards it on a duplicate; the
+* (key, value) overload below avoids that.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::emplace(Args&&... args)
+{
+    NodeT* newNode = createNode(InPlaceItem(), std::forward<Args>(args)...);
+    Slot slot;
+    NodeT* existing = findSlot(newNode->getKey(), slot);
+    if(existing != nullptr) {
+        destroyNode(newNode);
+        return std::make_pair(iterator(existing), false);
+    }
+    linkNode(newNode, slot);
+    return std::make_pair(iterator(newNode), true);
+}
+
+/**
+* emplace(key, value): searches with the key first, so nothing is
+* allocated when the key already exists.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+template<typename K, typename M>
+typename std::enable_if<std::is_same<typename std::decay<K>::type, Key>::value,
+                        std::pair<typename BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::iterator, bool> >::type
+BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::emplace(K&& key, M&& obj)
+{
+    return tryEmplace(std::forward<K>(key), std::forward<M>(obj));
+}
+
+/**
+* Inserts a value constructed from args if the key is not present;
+* otherwise leaves the tree (and args) untouched.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::try_emplace(const Key& key, Args&&... args)
+{
+    return tryEmplace(key, std::forward<Args>(args)...);
+}
+
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::try_emplace(Key&& key, Args&&... args)
+{
+    return tryEmplace(std::move(key), std::forward<Args>(args)...);
+}
+
+/**
+* Inserts the key with obj as its value, or assigns obj to the existing
+* value. The bool is true if a new node was inserted.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+template<typename M>
+std::pair<typename BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::insert_or_assign(const Key& key, M&& obj)
+{
+    return insertOrAssign(key, std::forward<M>(obj));
+}
+
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+template<typename M>
+std::pair<typename BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::insert_or_assign(Key&& key, M&& obj)
+{
+    return insertOrAssign(std::move(key), std::forward<M>(obj));
+}
 
 /**
 * A remove method to remove a specific key from a Binary Search Tree.
 * Recall: The writeup specifies that if a node has 2 children you
 * should swap with the predecessor and then remove.
 */
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::remove(const Key& key)
+template<typename Key, typename Value, typename Alloc, typename NodeT, typename Compare>
+void BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::remove(const Key& key)
 {
     // TODO
-    Node<Key, Value>* nodeToRemove = internalFind(key);
+    NodeT* nodeToRemove = internalFind(key);
     if (nodeToRemove == nullptr) return; // Key not found
+    if (nodeToRemove == finger_ || nodeToRemove == fingerPrev_ || nodeToRemove == fingerNext_) {
+        resetFinger();
+    }
 
     if (nodeToRemove->getLeft() != nullptr && nodeToRemove->getRight() != nullptr) {
         // Node has two children, swap with predecessor
-        Node<Key, Value>* pred = predecessor(nodeToRemove);
+        NodeT* pred = predecessor(nodeToRemove);
         nodeSwap(nodeToRemove, pred);
         
     }
 
-    Node<Key, Value>* child;
+    NodeT* child;
 
     if (nodeToRemove->getLeft() != nullptr) {
         child = nodeToRemove->getLeft();
     } else {
         child = nodeToRemove->getRight();
-    }    if (child != nullptr) {
-        child->setParent(nodeToRemove->getParent());
+    }
+    NodeT* parent = nodeToRemove->getParent();
+    if (child != nullptr) {
+        child->setParent(parent);
     }
 
-    if (nodeToRemove->getParent() == nullptr) {
+    if (parent == nullptr) {
         root_ = child; // Removing root
-    } else if (nodeToRemove == nodeToRemove->getParent()->getLeft()) {
-        nodeToRemove->getParent()->setLeft(child);
+        destroyNode(nodeToRemove);
+        return;
+    }
+
+    bool fromLeft = (nodeToRemove == parent->getLeft());
+    if (fromLeft) {
+        parent->setLeft(child);
     } else {
-        nodeToRemove->getParent()->setRight(child);
+        parent->setRight(child);
     }
 
-    delete nodeToRemove;
+    destroyNode(nodeToRemove);
+    removeFixup(parent, fromLeft);
+    pullPath(parent);
 }
 
 
-
-template<class Key, class Value>
-Node<Key, Value>*
-BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+NodeT* BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::predecessor(NodeT* current)
 {
     // TODO
     if (current == nullptr) return nullptr;
     if (current->getLeft() != nullptr) {
-        Node<Key, Value>* temp = current->getLeft();
+        NodeT* temp = current->getLeft();
         while (temp->getRight() != nullptr) {
             temp = temp->getRight();
         }
         return temp;
     } else {
-        Node<Key, Value>* temp = current;
-        Node<Key, Value>* parent = current->getParent();
+        NodeT* temp = current;
+        NodeT* parent = current->getParent();
         while (parent != nullptr && temp == parent->getLeft()) {
             temp = parent;
             parent = parent->getParent();
@@ -567,30 +1718,52 @@ BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
     
 }
 
+/**
+* Mirror image of predecessor.
+*/
+template<class Key, class Value, class Alloc, class NodeT, class Compare>
+NodeT* BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::successor(NodeT* current)
+{
+    if (current == nullptr) return nullptr;
+    if (current->getRight() != nullptr) {
+        NodeT* temp = current->getRight();
+        while (temp->getLeft() != nullptr) {
+            temp = temp->getLeft();
+        }
+        return temp;
+    }
+    NodeT* temp = current;
+    NodeT* parent = current->getParent();
+    while (parent != nullptr && temp == parent->getRight()) {
+        temp = parent;
+        parent = parent->getParent();
+    }
+    return parent;
+}
+
 
 /**
 * A method to remove all contents of the tree and
 * reset the values in the tree for use again.
 */
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::clear()
+template<typename Key, typename Value, typename Alloc, typename NodeT, typename Compare>
+void BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::clear()
 {
     // TODO
-    while (root_ != nullptr) {
-        remove(root_->getKey());
-    }
+    destroySubtree(root_);
+    root_ = nullptr;
+    resetFinger();
 }
 
 
 /**
 * A helper function to find the smallest node in the tree.
 */
-template<typename Key, typename Value>
-Node<Key, Value>*
-BinarySearchTree<Key, Value>::getSmallestNode() const
+template<typename Key, typename Value, typename Alloc, typename NodeT, typename Compare>
+NodeT* BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::getSmallestNode() const
 {
     // TODO
-    Node<Key,Value>* current = root_;
+    NodeT* current = root_;
     while(current && current->getLeft() != nullptr){
         current = current->getLeft();
     }
@@ -602,15 +1775,17 @@ BinarySearchTree<Key, Value>::getSmallestNode() const
 * return a pointer to it or NULL if no item with that key
 * exists
 */
-template<typename Key, typename Value>
-Node<Key, Value>* BinarySearchTree<Key, Value>::internalFind(const Key& key) const
+template<typename Key, typename Value, typename Alloc, typename NodeT, typename Compare>
+template<typename K>
+NodeT* BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::internalFind(const K& key) const
 {
     // TODO
-    Node<Key, Value>* current = root_;
+    NodeT* current = root_;
     while (current != nullptr) {
-        if (key == current->getKey())
+        int order = compareKeys(key, current->getKey());
+        if (order == 0)
             return current;
-        else if (key < current->getKey())
+        else if (order < 0)
             current = current->getLeft();
         else
             current = current->getRight();
@@ -618,54 +1793,635 @@ Node<Key, Value>* BinarySearchTree<Key, Value>::internalFind(const Key& key) con
     return nullptr;
 }
 
+/**
+* The first node whose key is not less than key, or nullptr.
+*/
+template<typename Key, typename Value, typename Alloc, typename NodeT, typename Compare>
+template<typename K>
+NodeT* BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::lowerBoundNode(const K& key) const
+{
+    NodeT* bound = nullptr;
+    NodeT* current = root_;
+    while (current != nullptr) {
+        if (comp_(current->getKey(), key)) {
+            current = current->getRight();
+        } else {
+            bound = current;
+            current = current->getLeft();
+        }
+    }
+    return bound;
+}
+
+/**
+* The first node whose key is greater than key, or nullptr.
+*/
+template<typename Key, typename Value, typename Alloc, typename NodeT, typename Compare>
+template<typename K>
+NodeT* BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::upperBoundNode(const K& key) const
+{
+    NodeT* bound = nullptr;
+    NodeT* current = root_;
+    while (current != nullptr) {
+        if (comp_(key, current->getKey())) {
+            bound = current;
+            current = current->getLeft();
+        } else {
+            current = current->getRight();
+        }
+    }
+    return bound;
+}
+
+/**
+* Orders a before, with or after b (negative, zero, positive) with a
+* single call when Compare is three-way, else with up to two.
+*/
+template<typename Key, typename Value, typename Alloc, typename NodeT, typename Compare>
+template<typename A, typename B>
+int BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::compareKeys(const A& a, const B& b) const
+{
+    return ::compareKeys(comp_, a, b);
+}
+
 /**
  * Return true iff the BST is balanced.
  */
-template<typename Key, typename Value>
-bool BinarySearchTree<Key, Value>::isBalanced() const
+template<typename Key, typename Value, typename Alloc, typename NodeT, typename Compare>
+bool BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::isBalanced() const
 {
-    // TODO
-    return checkBalance(root_) != -1;
+    return isBalanced(typename std::is_base_of<SubtreeShape, NodeT>::type());
 }
 
-template<typename Key, typename Value>
-int BinarySearchTree<Key, Value>::checkBalance(Node<Key, Value>* node) const {
-    if (node == nullptr)
+/**
+* With SubtreeShape nodes the root already knows.
+*/
+template<typename Key, typename Value, typename Alloc, typename NodeT, typename Compare>
+bool BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::isBalanced(std::true_type) const
+{
+    return root_ == nullptr || root_->unbalancedNodes() == 0;
+}
+
+template<typename Key, typename Value, typename Alloc, typename NodeT, typename Compare>
+bool BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::isBalanced(std::false_type) const
+{
+    return verifyBalance();
+}
+
+/**
+* Checks every node in O(n), without recursion, so a degenerate tree
+* cannot overflow the stack.
+*/
+template<typename Key, typename Value, typename Alloc, typename NodeT, typename Compare>
+bool BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::verifyBalance() const
+{
+    bool balanced = true;
+    measureSubtree(root_, balanced);
+    return balanced;
+}
+
+/**
+* Returns the number of items in the tree in O(1), except for the first
+* call after a split that left the size unknown, which counts in O(n).
+*/
+template<typename Key, typename Value, typename Alloc, typename NodeT, typename Compare>
+std::size_t BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::size() const
+{
+    std::size_t count = size_.load(std::memory_order_relaxed);
+    if(count == kSizeUnknown) {
+        count = 0;
+        for(NodeT* node = getSmallestNode(); node != nullptr; node = successor(node)) {
+            ++count;
+        }
+        size_.store(count, std::memory_order_relaxed);
+    }
+    return count;
+}
+
+template<typename Key, typename Value, typename Alloc, typename NodeT, typename Compare>
+int BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::height() const
+{
+    return height(typename std::is_base_of<SubtreeShape, NodeT>::type());
+}
+
+template<typename Key, typename Value, typename Alloc, typename NodeT, typename Compare>
+int BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::height(std::true_type) const
+{
+    return root_ == nullptr ? 0 : root_->shapeHeight();
+}
+
+template<typename Key, typename Value, typename Alloc, typename NodeT, typename Compare>
+int BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::height(std::false_type) const
+{
+    bool balanced = true;
+    return measureSubtree(root_, balanced);
+}
+
+/**
+* Post-order walk along the parent links (like destroySubtree, but
+* leaving the tree intact). The heights of finished subtrees wait on a
+* vector until their parent is done, so the only extra memory is
+* O(height) on the heap.
+*/
+template<typename Key, typename Value, typename Alloc, typename NodeT, typename Compare>
+int BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::measureSubtree(NodeT* node, bool& balanced)
+{
+    if(node == nullptr) {
         return 0;
+    }
+    std::vector<int> heights;
+    NodeT* prev = nullptr;
+    NodeT* current = node;
+    while(current != nullptr) {
+        bool fromAbove = (current == node) ? prev == nullptr : prev == current->getParent();
+        if(fromAbove && current->getLeft() != nullptr) {
+            prev = current;
+            current = current->getLeft();
+            continue;
+        }
+        if((fromAbove || prev == current->getLeft()) && current->getRight() != nullptr) {
+            prev = current;
+            current = current->getRight();
+            continue;
+        }
+        int rightHeight = 0, leftHeight = 0;
+        if(current->getRight() != nullptr) {
+            rightHeight = heights.back();
+            heights.pop_back();
+        }
+        if(current->getLeft() != nullptr) {
+            leftHeight = heights.back();
+            heights.pop_back();
+        }
+        if(std::abs(leftHeight - rightHeight) > 1) {
+            balanced = false;
+        }
+        heights.push_back(1 + std::max(leftHeight, rightHeight));
+        prev = current;
+        current = (current == node) ? nullptr : current->getParent();
+    }
+    return heights.back();
+}
+
+/**
+* Allocates a node from the tree's allocator and constructs it in place.
+*/
+template<typename Key, typename Value, typename Alloc, typename NodeT, typename Compare>
+template<typename... Args>
+NodeT* BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::createNode(Args&&... args)
+{
+    typedef std::allocator_traits<NodeAllocator> Traits;
+    NodeT* node = Traits::allocate(alloc_, 1);
+    try {
+        Traits::construct(alloc_, node, std::forward<Args>(args)...);
+    }
+    catch(...) {
+        Traits::deallocate(alloc_, node, 1);
+        throw;
+    }
+    std::size_t count = size_.load(std::memory_order_relaxed);
+    if(count != kSizeUnknown) {
+        size_.store(count + 1, std::memory_order_relaxed);
+    }
+    return node;
+}
 
-    int leftHeight = checkBalance(node->getLeft());
-    if (leftHeight == -1)
-        return -1; // Left subtree is unbalanced
+/**
+* Destroys a node and hands its memory back to the tree's allocator.
+*/
+template<typename Key, typename Value, typename Alloc, typename NodeT, typename Compare>
+void BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::destroyNode(NodeT* node)
+{
+    typedef std::allocator_traits<NodeAllocator> Traits;
+    Traits::destroy(alloc_, node);
+    Traits::deallocate(alloc_, node, 1);
+    std::size_t count = size_.load(std::memory_order_relaxed);
+    if(count != kSizeUnknown) {
+        size_.store(count - 1, std::memory_order_relaxed);
+    }
+}
 
-    int rightHeight = checkBalance(node->getRight());
-    if (rightHeight == -1)
-        return -1; // Right subtree is unbalanced
+/**
+* Frees every node below and including root in O(n), post-order. The walk
+* follows parent links instead of recursing, so even a degenerate
+* (list-shaped) tree is torn down in constant stack space. Nodes above
+* root are left pointing at a freed child; callers unlink root first or
+* discard the whole tree.
+*/
+template<typename Key, typename Value, typename Alloc, typename NodeT, typename Compare>
+void BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::destroySubtree(NodeT* root)
+{
+    NodeT* current = root;
+    while (current != nullptr) {
+        if (current->getLeft() != nullptr) {
+            current = current->getLeft();
+        } else if (current->getRight() != nullptr) {
+            current = current->getRight();
+        } else {
+            // A leaf: detach it from its parent and climb back up.
+            NodeT* parent = (current == root) ? nullptr : current->getParent();
+            if (parent != nullptr) {
+                if (parent->getLeft() == current) {
+                    parent->setLeft(nullptr);
+                } else {
+                    parent->setRight(nullptr);
+                }
+            }
+            destroyNode(current);
+            current = parent;
+        }
+    }
+}
 
-    if (std::abs(leftHeight - rightHeight) > 1)
-        return -1; // Current node is unbalanced
+/**
+* Builds a copy of the subtree at root with the same shape and node data
+* and returns its (parentless) root. Pre-order and iterative, like
+* destroySubtree. With MoveItems the items are moved out of the source
+* nodes instead of copied. If a node cannot be created, the partial copy
+* is freed and the exception propagates.
+*/
+template<typename Key, typename Value, typename Alloc, typename NodeT, typename Compare>
+template<bool MoveItems>
+NodeT* BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::cloneSubtree(
+    typename std::conditional<MoveItems, NodeT, const NodeT>::type* root)
+{
+    typedef typename std::conditional<MoveItems, NodeT, const NodeT>::type SourceNode;
+    typedef typename std::conditional<MoveItems, std::pair<const Key, Value>&&,
+                                      const std::pair<const Key, Value>&>::type ItemRef;
+    if (root == nullptr) {
+        return nullptr;
+    }
+    NodeT* copy = createNode(InPlaceItem(), static_cast<ItemRef>(root->getItem()));
+    copy->copyNodeData(*root);
+    SourceNode* src = root;
+    NodeT* dst = copy;
+    try {
+        while (true) {
+            if (src->getLeft() != nullptr && dst->getLeft() == nullptr) {
+                src = src->getLeft();
+                NodeT* child = createNode(InPlaceItem(), static_cast<ItemRef>(src->getItem()));
+                child->copyNodeData(*src);
+                child->setParent(dst);
+                dst->setLeft(child);
+                dst = child;
+            } else if (src->getRight() != nullptr && dst->getRight() == nullptr) {
+                src = src->getRight();
+                NodeT* child = createNode(InPlaceItem(), static_cast<ItemRef>(src->getItem()));
+                child->copyNodeData(*src);
+                child->setParent(dst);
+                dst->setRight(child);
+                dst = child;
+            } else if (src == root) {
+                break;
+            } else {
+                src = src->getParent();
+                dst = dst->getParent();
+            }
+        }
+    }
+    catch(...) {
+        destroySubtree(copy);
+        throw;
+    }
+    copy->setParent(nullptr);
+    return copy;
+}
 
-    return 1 + std::max(leftHeight, rightHeight);
+/**
+* Builds a perfectly balanced subtree from the next n items at it, in
+* order, advancing it past them, and reports the subtree's height. The
+* recursion is only O(log n) deep. On an exception everything built so
+* far is freed.
+*/
+template<typename Key, typename Value, typename Alloc, typename NodeT, typename Compare>
+template<typename ForwardIt>
+NodeT* BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::buildSubtree(ForwardIt& it, std::size_t n, int& height)
+{
+    if (n == 0) {
+        height = 0;
+        return nullptr;
+    }
+    std::size_t leftSize = (n - 1) / 2;
+    int leftHeight, rightHeight;
+    NodeT* left = buildSubtree(it, leftSize, leftHeight);
+    NodeT* node;
+    try {
+        node = createNode(InPlaceItem(), *it);
+    }
+    catch(...) {
+        destroySubtree(left);
+        throw;
+    }
+    ++it;
+    node->setLeft(left);
+    if (left != nullptr) {
+        left->setParent(node);
+    }
+    NodeT* right;
+    try {
+        right = buildSubtree(it, n - 1 - leftSize, rightHeight);
+    }
+    catch(...) {
+        destroySubtree(node);
+        throw;
+    }
+    node->setRight(right);
+    if (right != nullptr) {
+        right->setParent(node);
+    }
+    node->setSubtreeHeights(leftHeight, rightHeight);
+    node->pull();
+    height = 1 + std::max(leftHeight, rightHeight);
+    return node;
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2)
+/**
+* Move assignment when the allocator travels with the nodes.
+*/
+template<typename Key, typename Value, typename Alloc, typename NodeT, typename Compare>
+void BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::moveAssign(BinarySearchTree& other, std::true_type)
+{
+    clear();
+    alloc_ = other.alloc_;
+    root_ = other.root_;
+    size_.store(other.size_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    finger_ = other.finger_;
+    fingerPrev_ = other.fingerPrev_;
+    fingerNext_ = other.fingerNext_;
+    other.root_ = nullptr;
+    other.size_.store(0, std::memory_order_relaxed);
+    other.resetFinger();
+}
+
+/**
+* Move assignment when the allocator stays put: steal the nodes only if
+* other's allocator can free them, else move the items across.
+*/
+template<typename Key, typename Value, typename Alloc, typename NodeT, typename Compare>
+void BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::moveAssign(BinarySearchTree& other, std::false_type)
+{
+    if (alloc_ == other.alloc_) {
+        moveAssign(other, std::true_type());
+        return;
+    }
+    NodeT* copy = cloneSubtree<true>(other.root_);
+    clear();
+    root_ = copy;
+    other.clear();
+}
+
+/**
+* Looks for key, first beside the finger and then by walking down from
+* the root. Returns the node holding it, or nullptr with slot set to where
+* a new node would be linked (slot.parent is nullptr for an empty tree).
+* The walk notes the last node it turned left and right at, which are the
+* slot's in-order neighbours.
+*/
+template<typename Key, typename Value, typename Alloc, typename NodeT, typename Compare>
+NodeT* BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::findSlot(const Key& key, Slot& slot) const
+{
+    NodeT* existing;
+    if (finger_ != nullptr && slotBeside(finger_, fingerPrev_, fingerNext_, key, slot, existing)) {
+        return existing;
+    }
+    NodeT* current = root_;
+    slot.parent = nullptr;
+    slot.asLeft = false;
+    slot.prev = nullptr;
+    slot.next = nullptr;
+    while (current != nullptr) {
+        int order = compareKeys(key, current->getKey());
+        if (order < 0) {
+            slot.parent = current;
+            slot.asLeft = true;
+            slot.next = current;
+            current = current->getLeft();
+        } else if (order > 0) {
+            slot.parent = current;
+            slot.asLeft = false;
+            slot.prev = current;
+            current = current->getRight();
+        } else {
+            return current;
+        }
+    }
+    return nullptr;
+}
+
+/**
+* findSlot with a caller's guess: hint is the node the key should land
+* next to, or nullptr for "after the largest key". The hint's neighbours
+* are found by pointer chasing only; the finger's are already known.
+*/
+template<typename Key, typename Value, typename Alloc, typename NodeT, typename Compare>
+NodeT* BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::findSlotNear(NodeT* hint, const Key& key, Slot& slot) const
+{
+    NodeT* prev = nullptr;
+    NodeT* next = nullptr;
+    if (hint == nullptr) {
+        hint = root_;
+        if (hint == nullptr) {
+            return findSlot(key, slot);
+        }
+        while (hint->getRight() != nullptr) {
+            hint = hint->getRight();
+        }
+        prev = predecessor(hint);
+    } else if (hint == finger_) {
+        prev = fingerPrev_;
+        next = fingerNext_;
+    } else {
+        prev = predecessor(hint);
+        next = successor(hint);
+    }
+    NodeT* existing;
+    if (slotBeside(hint, prev, next, key, slot, existing)) {
+        return existing;
+    }
+    return findSlot(key, slot);
+}
+
+/**
+* Tries to place key directly beside at, whose in-order neighbours are
+* prev and next. Returns false when key belongs further away. Otherwise
+* existing is the node holding key, or nullptr with slot filled in: the
+* empty child of at on key's side, or else the matching empty child of
+* the neighbour, which is the extreme node of that subtree.
+*/
+template<typename Key, typename Value, typename Alloc, typename NodeT, typename Compare>
+bool BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::slotBeside(NodeT* at, NodeT* prev, NodeT* next, const Key& key,
+                                                                     Slot& slot, NodeT*& existing) const
+{
+    existing = nullptr;
+    int order = compareKeys(key, at->getKey());
+    if (order < 0) {
+        if (prev != nullptr) {
+            int prevOrder = compareKeys(key, prev->getKey());
+            if (prevOrder < 0) {
+                return false;
+            }
+            if (prevOrder == 0) {
+                existing = prev;
+                return true;
+            }
+        }
+        bool free = at->getLeft() == nullptr;
+        slot.parent = free ? at : prev;
+        slot.asLeft = free;
+        slot.prev = prev;
+        slot.next = at;
+    } else if (order > 0) {
+        if (next != nullptr) {
+            int nextOrder = compareKeys(key, next->getKey());
+            if (nextOrder > 0) {
+                return false;
+            }
+            if (nextOrder == 0) {
+                existing = next;
+                return true;
+            }
+        }
+        bool free = at->getRight() == nullptr;
+        slot.parent = free ? at : next;
+        slot.asLeft = !free;
+        slot.prev = at;
+        slot.next = next;
+    } else {
+        existing = at;
+    }
+    return true;
+}
+
+/**
+* Links a detached node at the slot returned by findSlot, makes it the
+* finger and lets the derived tree restore its invariants from there.
+*/
+template<typename Key, typename Value, typename Alloc, typename NodeT, typename Compare>
+void BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::linkNode(NodeT* node, const Slot& slot)
+{
+    node->setParent(slot.parent);
+    if (slot.parent == nullptr) {
+        root_ = node;
+    } else if (slot.asLeft) {
+        slot.parent->setLeft(node);
+    } else {
+        slot.parent->setRight(node);
+    }
+    finger_ = node;
+    fingerPrev_ = slot.prev;
+    fingerNext_ = slot.next;
+    insertFixup(node);
+    pullPath(node);
+}
+
+/**
+* Forgets the finger; needed whenever nodes are relinked other than
+* through linkNode and remove.
+*/
+template<typename Key, typename Value, typename Alloc, typename NodeT, typename Compare>
+void BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::resetFinger()
+{
+    finger_ = nullptr;
+    fingerPrev_ = nullptr;
+    fingerNext_ = nullptr;
+}
+
+/**
+* Recomputes the augmentation of node and all of its ancestors, bottom-up.
+* Only needed for augmented node types; for the others it does nothing.
+*/
+template<typename Key, typename Value, typename Alloc, typename NodeT, typename Compare>
+void BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::pullPath(NodeT* node)
+{
+    if (!NodeT::augmented) {
+        return;
+    }
+    while (node != nullptr) {
+        node->pull();
+        node = node->getParent();
+    }
+}
+
+template<typename Key, typename Value, typename Alloc, typename NodeT, typename Compare>
+template<typename K, typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::tryEmplace(K&& key, Args&&... args)
+{
+    Slot slot;
+    NodeT* existing = findSlot(key, slot);
+    if (existing != nullptr) {
+        return std::make_pair(iterator(existing), false);
+    }
+    NodeT* newNode = createNode(InPlaceItem(), std::piecewise_construct,
+                                std::forward_as_tuple(std::forward<K>(key)),
+                                std::forward_as_tuple(std::forward<Args>(args)...));
+    linkNode(newNode, slot);
+    return std::make_pair(iterator(newNode), true);
+}
+
+template<typename Key, typename Value, typename Alloc, typename NodeT, typename Compare>
+template<typename K, typename M>
+std::pair<typename BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::insertOrAssign(K&& key, M&& obj)
+{
+    Slot slot;
+    NodeT* existing = findSlot(key, slot);
+    return assignOrLink(existing, slot, std::forward<K>(key), std::forward<M>(obj));
+}
+
+/**
+* Overwrites existing's value, or links a new node at slot when there is
+* no existing node.
+*/
+template<typename Key, typename Value, typename Alloc, typename NodeT, typename Compare>
+template<typename K, typename M>
+std::pair<typename BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::assignOrLink(NodeT* existing, const Slot& slot, K&& key, M&& obj)
+{
+    if (existing != nullptr) {
+        existing->getValue() = std::forward<M>(obj);
+        pullPath(existing);
+        return std::make_pair(iterator(existing), false);
+    }
+    NodeT* newNode = createNode(InPlaceItem(), std::forward<K>(key), std::forward<M>(obj));
+    linkNode(newNode, slot);
+    return std::make_pair(iterator(newNode), true);
+}
+
+/**
+* A plain BST has no invariants to restore.
+*/
+template<typename Key, typename Value, typename Alloc, typename NodeT, typename Compare>
+void BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::insertFixup(NodeT* node)
+{
+
+}
+
+template<typename Key, typename Value, typename Alloc, typename NodeT, typename Compare>
+void BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::removeFixup(NodeT* parent, bool fromLeft)
+{
+
+}
+
+template<typename Key, typename Value, typename Alloc, typename NodeT, typename Compare>
+void BinarySearchTree<Key, Value, Alloc, NodeT, Compare>::nodeSwap( NodeT* n1, NodeT* n2)
 {
     if((n1 == n2) || (n1 == NULL) || (n2 == NULL) ) {
         return;
     }
-    Node<Key, Value>* n1p = n1->getParent();
-    Node<Key, Value>* n1r = n1->getRight();
-    Node<Key, Value>* n1lt = n1->getLeft();
+    NodeT* n1p = n1->getParent();
+    NodeT* n1r = n1->getRight();
+    NodeT* n1lt = n1->getLeft();
     bool n1isLeft = false;
     if(n1p != NULL && (n1 == n1p->getLeft())) n1isLeft = true;
-    Node<Key, Value>* n2p = n2->getParent();
-    Node<Key, Value>* n2r = n2->getRight();
-    Node<Key, Value>* n2lt = n2->getLeft();
+    NodeT* n2p = n2->getParent();
+    NodeT* n2r = n2->getRight();
+    NodeT* n2lt = n2->getLeft();
     bool n2isLeft = false;
     if(n2p != NULL && (n2 == n2p->getLeft())) n2isLeft = true;
 
 
-    Node<Key, Value>* temp;
+    NodeT* temp;
     temp = n1->getParent();
     n1->setParent(n2->getParent());
     n2->setParent(temp);
@@ -729,6 +2485,10 @@ void BinarySearchTree<Key, Value>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value
         this->root_ = n1;
     }
 
+    // Balance and augmentation describe a position in the tree, not an
+    // item, so they stay where they were.
+    n1->swapNodeData(*n2);
+
 }
 
 /**
@@ -751,4 +2511,40 @@ End implementations for the BinarySearchTree class.
 ---------------------------------------------------
 */
 
+/**
+* A BinarySearchTree whose nodes come from a private NodePool.
+*/
+template <typename Key, typename Value>
+using PooledBinarySearchTree = BinarySearchTree<Key, Value, PoolAllocator<std::pair<const Key, Value> > >;
+
+/**
+* A BinarySearchTree that supports rank, select and count_range.
+*/
+template <typename Key, typename Value>
+using RankedBinarySearchTree = BinarySearchTree<Key, Value, std::allocator<std::pair<const Key, Value> >,
+                                                Node<Key, Value, SubtreeSize> >;
+
+/**
+* A BinarySearchTree that answers height() and isBalanced() in O(1); the
+* same as the default, spelled out.
+*/
+template <typename Key, typename Value>
+using ShapedBinarySearchTree = BinarySearchTree<Key, Value, std::allocator<std::pair<const Key, Value> >,
+                                                Node<Key, Value, SubtreeShape> >;
+
+/**
+* A BinarySearchTree with bare nodes: smaller and with no upkeep on
+* insert and remove, but height() and isBalanced() walk the whole tree.
+*/
+template <typename Key, typename Value>
+using UnshapedBinarySearchTree = BinarySearchTree<Key, Value, std::allocator<std::pair<const Key, Value> >,
+                                                  Node<Key, Value> >;
+
+/**
+* A BinarySearchTree ordered by Compare instead of operator<.
+*/
+template <typename Key, typename Value, typename Compare>
+using OrderedBinarySearchTree = BinarySearchTree<Key, Value, std::allocator<std::pair<const Key, Value> >,
+                                                 Node<Key, Value, SubtreeShape>, Compare>;
+
 #endif
@@ -0,0 +1,766 @@
+#ifndef CONCURRENT_AVL_H
+#define CONCURRENT_AVL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <functional>
+#include <algorithm>
+
+/**
+* An AVL tree that many threads can read while writers update it. Readers
+* take no lock: they pin an epoch (see reader) and walk the tree through
+* acquire loads. Writers are serialized by a mutex.
+*
+* A published node's key and value never change; only its child links do,
+* and each such change is a single release store. A new leaf is linked in
+* place. A rotation, an overwrite or the removal of a node with two
+* children builds fresh copies of the nodes whose links change and swaps
+* them in with one store, so a reader always sees a well-formed tree with
+* the right key ranges below every node it reaches. Replaced nodes are not
+* deleted straight away but retired, and freed once every reader that
+* could still be looking at them has finished (epoch-based reclamation).
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class ConcurrentAVLTree
+{
+public:
+    typedef std::pair<const Key, Value> value_type;
+
+    ConcurrentAVLTree();
+    explicit ConcurrentAVLTree(const Compare& comp);
+    ConcurrentAVLTree(const ConcurrentAVLTree&) = delete;
+    ConcurrentAVLTree& operator=(const ConcurrentAVLTree&) = delete;
+    ~ConcurrentAVLTree();
+
+    // Writers; may be called from any thread.
+    void insert(const value_type& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+
+    // Lock-free reads; each pins an epoch for its own duration.
+    bool find(const Key& key, Value& value) const;
+    bool contains(const Key& key) const;
+    bool empty() const;
+    std::size_t size() const;
+
+    // Take the writer lock; meant for tests and health checks.
+    bool isBalanced() const;
+    std::size_t retiredCount() const;
+
+private:
+    struct Node
+    {
+        Node(const value_type& item, Node* left, Node* right, int height) :
+            item(item), left(left), right(right), height(height) { }
+        const value_type item;
+        std::atomic<Node*> left;
+        std::atomic<Node*> right;
+        int height;   // only the writer reads or writes this
+    };
+
+public:
+    /**
+    * Iterates in key order over the nodes reachable while the reader that
+    * made it is alive. Writes may land during the walk; keys present for
+    * the whole walk are visited exactly once and the keys seen are always
+    * strictly increasing.
+    */
+    class iterator
+    {
+    public:
+        iterator();
+
+        const value_type& operator*() const;
+        const value_type* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+
+    protected:
+        friend class ConcurrentAVLTree<Key, Value, Compare>;
+        iterator(Node* current, std::vector<Node*>&& pending, const Compare* comp);
+        void step();
+        Node* current_;
+        std::vector<Node*> pending_;   // ancestors whose item is still to come
+        const Compare* comp_;
+    };
+
+    /**
+    * Pins the current epoch for as long as it lives, so nodes reached
+    * through it are not freed. Gives iterator-based access to the tree.
+    * Keep readers short: retired nodes pile up while one is open.
+    */
+    class reader
+    {
+    public:
+        explicit reader(const ConcurrentAVLTree& tree);
+        reader(const reader&) = delete;
+        reader& operator=(const reader&) = delete;
+        ~reader();
+
+        iterator begin() const;
+        iterator end() const;
+        iterator find(const Key& key) const;
+        iterator lower_bound(const Key& key) const;
+
+    private:
+        const ConcurrentAVLTree& tree_;
+        std::atomic<long>* counter_;
+    };
+
+private:
+    // Reader counts are spread over cache-line-sized shards by thread so
+    // that readers entering and leaving do not all hit one line.
+    static const unsigned kReaderShards = 32;
+    struct alignas(64) ReaderShard
+    {
+        std::atomic<long> active[2];   // by epoch parity
+    };
+
+    std::atomic<long>* enterEpoch() const;
+    static void leaveEpoch(std::atomic<long>* counter);
+    static unsigned readerShard();
+
+    Node* lowerBoundNode(const Key& key, std::vector<Node*>* pending) const;
+    void rebalancePath(std::size_t from);
+    Node* rotate(Node* node);
+    Node* copyNode(Node* node, Node* left, Node* right);
+    static int heightOf(Node* node);
+    static void fixHeight(Node* node);
+    int checkBalance(Node* node) const;
+    void retire(Node* node);
+    void tryReclaim();
+    static void deleteSubtree(Node* node);
+
+    std::atomic<Node*> root_;
+    std::atomic<std::size_t> size_;
+    Compare comp_;
+
+    mutable std::mutex writeMutex_;
+    std::vector<std::atomic<Node*>*> path_;   // links walked by the current write
+    std::atomic<std::uint64_t> epoch_;
+    mutable ReaderShard readers_[kReaderShards];
+    // Nodes retired during epoch e wait in retired_[e % 3] until the epoch
+    // reaches e + 2, by which time no reader can still hold them.
+    std::vector<Node*> retired_[3];
+};
+
+/*
+  ----------------------------------------------------------------
+  Begin implementations for the ConcurrentAVLTree::iterator class.
+  ----------------------------------------------------------------
+*/
+
+template<typename Key, typename Value, typename Compare>
+ConcurrentAVLTree<Key, Value, Compare>::iterator::iterator() :
+    current_(nullptr), comp_(nullptr)
+{
+
+}
+
+template<typename Key, typename Value, typename Compare>
+ConcurrentAVLTree<Key, Value, Compare>::iterator::iterator(Node* current, std::vector<Node*>&& pending,
+                                                           const Compare* comp) :
+    current_(current), pending_(std::move(pending)), comp_(comp)
+{
+
+}
+
+template<typename Key, typename Value, typename Compare>
+const typename ConcurrentAVLTree<Key, Value, Compare>::value_type&
+ConcurrentAVLTree<Key, Value, Compare>::iterator::operator*() const
+{
+    return current_->item;
+}
+
+template<typename Key, typename Value, typename Compare>
+const typename ConcurrentAVLTree<Key, Value, Compare>::value_type*
+ConcurrentAVLTree<Key, Value, Compare>::iterator::operator->() const
+{
+    return &current_->item;
+}
+
+template<typename Key, typename Value, typename Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::iterator::operator==(const iterator& rhs) const
+{
+    return current_ == rhs.current_;
+}
+
+template<typename Key, typename Value, typename Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::iterator::operator!=(const iterator& rhs) const
+{
+    return current_ != rhs.current_;
+}
+
+/**
+* Moves to the next node in order, skipping any key not above the current
+* one, so the keys seen stay strictly increasing whatever mix of retired
+* and current nodes the walk passes through.
+*/
+template<typename Key, typename Value, typename Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::iterator&
+ConcurrentAVLTree<Key, Value, Compare>::iterator::operator++()
+{
+    Node* last = current_;
+    do {
+        step();
+    } while(current_ != nullptr && !(*comp_)(last->item.first, current_->item.first));
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::iterator::step()
+{
+    Node* node = current_->right.load(std::memory_order_acquire);
+    while(node != nullptr) {
+        pending_.push_back(node);
+        node = node->left.load(std::memory_order_acquire);
+    }
+    if(pending_.empty()) {
+        current_ = nullptr;
+    }
+    else {
+        current_ = pending_.back();
+        pending_.pop_back();
+    }
+}
+
+/*
+  --------------------------------------------------------------
+  End implementations for the ConcurrentAVLTree::iterator class.
+  --------------------------------------------------------------
+*/
+
+/*
+  --------------------------------------------------------------
+  Begin implementations for the ConcurrentAVLTree::reader class.
+  --------------------------------------------------------------
+*/
+
+template<typename Key, typename Value, typename Compare>
+ConcurrentAVLTree<Key, Value, Compare>::reader::reader(const ConcurrentAVLTree& tree) :
+    tree_(tree), counter_(tree.enterEpoch())
+{
+
+}
+
+template<typename Key, typename Value, typename Compare>
+ConcurrentAVLTree<Key, Value, Compare>::reader::~reader()
+{
+    leaveEpoch(counter_);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::iterator
+ConcurrentAVLTree<Key, Value, Compare>::reader::begin() const
+{
+    std::vector<Node*> pending;
+    Node* node = tree_.root_.load(std::memory_order_acquire);
+    while(node != nullptr) {
+        pending.push_back(node);
+        node = node->left.load(std::memory_order_acquire);
+    }
+    if(pending.empty()) {
+        return end();
+    }
+    Node* first = pending.back();
+    pending.pop_back();
+    return iterator(first, std::move(pending), &tree_.comp_);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::iterator
+ConcurrentAVLTree<Key, Value, Compare>::reader::end() const
+{
+    return iterator(nullptr, std::vector<Node*>(), &tree_.comp_);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::iterator
+ConcurrentAVLTree<Key, Value, Compare>::reader::find(const Key& key) const
+{
+    iterator it = lower_bound(key);
+    if(it != end() && tree_.comp_(key, it->first)) {
+        return end();
+    }
+    return it;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::iterator
+ConcurrentAVLTree<Key, Value, Compare>::reader::lower_bound(const Key& key) const
+{
+    std::vector<Node*> pending;
+    Node* found = tree_.lowerBoundNode(key, &pending);
+    return iterator(found, std::move(pending), &tree_.comp_);
+}
+
+/*
+  ------------------------------------------------------------
+  End implementations for the ConcurrentAVLTree::reader class.
+  ------------------------------------------------------------
+*/
+
+/*
+  -------------------------------------------------------
+  Begin implementations for the ConcurrentAVLTree class.
+  -------------------------------------------------------
+*/
+
+template<typename Key, typename Value, typename Compare>
+ConcurrentAVLTree<Key, Value, Compare>::ConcurrentAVLTree() :
+    root_(nullptr), size_(0), comp_(), epoch_(0)
+{
+    for(unsigned i = 0; i < kReaderShards; ++i) {
+        readers_[i].active[0].store(0);
+        readers_[i].active[1].store(0);
+    }
+}
+
+template<typename Key, typename Value, typename Compare>
+ConcurrentAVLTree<Key, Value, Compare>::ConcurrentAVLTree(const Compare& comp) :
+    root_(nullptr), size_(0), comp_(comp), epoch_(0)
+{
+    for(unsigned i = 0; i < kReaderShards; ++i) {
+        readers_[i].active[0].store(0);
+        readers_[i].active[1].store(0);
+    }
+}
+
+/**
+* @precondition No reader is alive
+*/
+template<typename Key, typename Value, typename Compare>
+ConcurrentAVLTree<Key, Value, Compare>::~ConcurrentAVLTree()
+{
+    deleteSubtree(root_.load());
+    for(int i = 0; i < 3; ++i) {
+        for(std::size_t j = 0; j < retired_[i].size(); ++j) {
+            delete retired_[i][j];
+        }
+    }
+}
+
+/**
+* Inserts the item, replacing the value if the key is already present.
+*/
+template<typename Key, typename Value, typename Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::insert(const value_type& keyValuePair)
+{
+    std::lock_guard<std::mutex> lock(writeMutex_);
+    path_.clear();
+    std::atomic<Node*>* link = &root_;
+    Node* node;
+    while((node = link->load(std::memory_order_relaxed)) != nullptr) {
+        if(comp_(keyValuePair.first, node->item.first)) {
+            path_.push_back(link);
+            link = &node->left;
+        }
+        else if(comp_(node->item.first, keyValuePair.first)) {
+            path_.push_back(link);
+            link = &node->right;
+        }
+        else {
+            Node* replacement = new Node(keyValuePair, node->left.load(std::memory_order_relaxed),
+                                         node->right.load(std::memory_order_relaxed), node->height);
+            link->store(replacement, std::memory_order_release);
+            retire(node);
+            tryReclaim();
+            return;
+        }
+    }
+    link->store(new Node(keyValuePair, nullptr, nullptr, 1), std::memory_order_release);
+    size_.fetch_add(1, std::memory_order_relaxed);
+    rebalancePath(path_.size());
+    tryReclaim();
+}
+
+/**
+* Removes key if present. A node with two children is replaced by a copy
+* of its successor whose right subtree is a copy of the path down to the
+* successor's old place, all published with one store.
+*/
+template<typename Key, typename Value, typename Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::remove(const Key& key)
+{
+    std::lock_guard<std::mutex> lock(writeMutex_);
+    path_.clear();
+    std::atomic<Node*>* link = &root_;
+    Node* node;
+    while((node = link->load(std::memory_order_relaxed)) != nullptr) {
+        if(comp_(key, node->item.first)) {
+            path_.push_back(link);
+            link = &node->left;
+        }
+        else if(comp_(node->item.first, key)) {
+            path_.push_back(link);
+            link = &node->right;
+        }
+        else {
+            break;
+        }
+    }
+    if(node == nullptr) {
+        return;
+    }
+
+    Node* left = node->left.load(std::memory_order_relaxed);
+    Node* right = node->right.load(std::memory_order_relaxed);
+    if(left == nullptr || right == nullptr) {
+        link->store(left != nullptr ? left : right, std::memory_order_release);
+        retire(node);
+    }
+    else {
+        // Copy the left spine from right down to the successor's parent,
+        // leaving the successor out, so nothing a reader may be standing
+        // on changes; the copies keep the old heights for rebalancePath.
+        std::vector<Node*> spine;
+        Node* succ = right;
+        for(Node* next; (next = succ->left.load(std::memory_order_relaxed)) != nullptr; succ = next) {
+            spine.push_back(succ);
+        }
+        Node* below = succ->right.load(std::memory_order_relaxed);
+        std::vector<Node*> copies(spine.size());
+        for(std::size_t i = spine.size(); i-- > 0; ) {
+            copies[i] = new Node(spine[i]->item, below, spine[i]->right.load(std::memory_order_relaxed),
+                                 spine[i]->height);
+            below = copies[i];
+        }
+        Node* replacement = new Node(succ->item, left, below, node->height);
+        link->store(replacement, std::memory_order_release);
+        retire(node);
+        retire(succ);
+        for(std::size_t i = 0; i < spine.size(); ++i) {
+            retire(spine[i]);
+        }
+        // Rebalance from the lowest copy up through the replacement.
+        path_.push_back(link);
+        if(!copies.empty()) {
+            path_.push_back(&replacement->right);
+            for(std::size_t i = 0; i + 1 < copies.size(); ++i) {
+                path_.push_back(&copies[i]->left);
+            }
+        }
+    }
+    size_.fetch_sub(1, std::memory_order_relaxed);
+    rebalancePath(path_.size());
+    tryReclaim();
+}
+
+/**
+* Empties the tree; the old nodes are retired, so open readers can finish.
+*/
+template<typename Key, typename Value, typename Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::clear()
+{
+    std::lock_guard<std::mutex> lock(writeMutex_);
+    Node* old = root_.exchange(nullptr, std::memory_order_acq_rel);
+    size_.store(0, std::memory_order_relaxed);
+    std::vector<Node*> stack;
+    if(old != nullptr) {
+        stack.push_back(old);
+    }
+    while(!stack.empty()) {
+        Node* node = stack.back();
+        stack.pop_back();
+        if(Node* left = node->left.load(std::memory_order_relaxed)) stack.push_back(left);
+        if(Node* right = node->right.load(std::memory_order_relaxed)) stack.push_back(right);
+        retire(node);
+    }
+    tryReclaim();
+}
+
+/**
+* Copies the value for key into value and returns true, or returns false.
+*/
+template<typename Key, typename Value, typename Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::find(const Key& key, Value& value) const
+{
+    std::atomic<long>* counter = enterEpoch();
+    Node* node = lowerBoundNode(key, nullptr);
+    bool found = node != nullptr && !comp_(key, node->item.first);
+    if(found) {
+        value = node->item.second;
+    }
+    leaveEpoch(counter);
+    return found;
+}
+
+template<typename Key, typename Value, typename Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::contains(const Key& key) const
+{
+    std::atomic<long>* counter = enterEpoch();
+    Node* node = lowerBoundNode(key, nullptr);
+    bool found = node != nullptr && !comp_(key, node->item.first);
+    leaveEpoch(counter);
+    return found;
+}
+
+template<typename Key, typename Value, typename Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::empty() const
+{
+    return size() == 0;
+}
+
+template<typename Key, typename Value, typename Compare>
+std::size_t ConcurrentAVLTree<Key, Value, Compare>::size() const
+{
+    return size_.load(std::memory_order_relaxed);
+}
+
+template<typename Key, typename Value, typename Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::isBalanced() const
+{
+    std::lock_guard<std::mutex> lock(writeMutex_);
+    return checkBalance(root_.load(std::memory_order_relaxed)) >= 0;
+}
+
+/**
+* Nodes retired but not yet freed.
+*/
+template<typename Key, typename Value, typename Compare>
+std::size_t ConcurrentAVLTree<Key, Value, Compare>::retiredCount() const
+{
+    std::lock_guard<std::mutex> lock(writeMutex_);
+    return retired_[0].size() + retired_[1].size() + retired_[2].size();
+}
+
+/**
+* Counts the calling thread as a reader of the current epoch. If the
+* epoch moved on meanwhile, it tries again so that the count is never
+* charged to an epoch the writer may already consider drained.
+*/
+template<typename Key, typename Value, typename Compare>
+std::atomic<long>* ConcurrentAVLTree<Key, Value, Compare>::enterEpoch() const
+{
+    ReaderShard& shard = readers_[readerShard()];
+    for(;;) {
+        std::uint64_t epoch = epoch_.load(std::memory_order_seq_cst);
+        std::atomic<long>* counter = &shard.active[epoch & 1];
+        counter->fetch_add(1, std::memory_order_seq_cst);
+        if(epoch_.load(std::memory_order_seq_cst) == epoch) {
+            return counter;
+        }
+        counter->fetch_sub(1, std::memory_order_release);
+    }
+}
+
+template<typename Key, typename Value, typename Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::leaveEpoch(std::atomic<long>* counter)
+{
+    counter->fetch_sub(1, std::memory_order_release);
+}
+
+template<typename Key, typename Value, typename Compare>
+unsigned ConcurrentAVLTree<Key, Value, Compare>::readerShard()
+{
+    static thread_local unsigned shard =
+        static_cast<unsigned>(std::hash<std::thread::id>()(std::this_thread::get_id()) % kReaderShards);
+    return shard;
+}
+
+/**
+* The first node whose key is not less than key, or nullptr. If pending
+* is given, it receives the ancestors an in-order walk from there still
+* has to visit.
+*/
+template<typename Key, typename Value, typename Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Node*
+ConcurrentAVLTree<Key, Value, Compare>::lowerBoundNode(const Key& key, std::vector<Node*>* pending) const
+{
+    Node* node = root_.load(std::memory_order_acquire);
+    Node* best = nullptr;
+    while(node != nullptr) {
+        if(comp_(node->item.first, key)) {
+            node = node->right.load(std::memory_order_acquire);
+        }
+        else {
+            // Every node we go left from is still to come in order.
+            if(best != nullptr && pending != nullptr) {
+                pending->push_back(best);
+            }
+            best = node;
+            if(!comp_(key, node->item.first)) {
+                break;
+            }
+            node = node->left.load(std::memory_order_acquire);
+        }
+    }
+    return best;
+}
+
+/**
+* Walks path_[0, from) bottom-up, refreshing heights and rotating where a
+* node is out of balance. Stops early once a height is unchanged.
+*/
+template<typename Key, typename Value, typename Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::rebalancePath(std::size_t from)
+{
+    for(std::size_t i = from; i-- > 0; ) {
+        std::atomic<Node*>* link = path_[i];
+        Node* node = link->load(std::memory_order_relaxed);
+        int before = node->height;
+        int balance = heightOf(node->right.load(std::memory_order_relaxed))
+                    - heightOf(node->left.load(std::memory_order_relaxed));
+        if(balance < -1 || balance > 1) {
+            Node* top = rotate(node);
+            link->store(top, std::memory_order_release);
+            if(top->height == before) {
+                return;
+            }
+        }
+        else {
+            fixHeight(node);
+            if(node->height == before) {
+                return;
+            }
+        }
+    }
+}
+
+/**
+* Builds the rotated replacement for an unbalanced node out of copies of
+* the two or three nodes whose links change, retires the originals and
+* returns the new subtree root (not yet linked in).
+*/
+template<typename Key, typename Value, typename Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Node*
+ConcurrentAVLTree<Key, Value, Compare>::rotate(Node* node)
+{
+    Node* left = node->left.load(std::memory_order_relaxed);
+    Node* right = node->right.load(std::memory_order_relaxed);
+    Node* top;
+    if(heightOf(left) > heightOf(right)) {
+        Node* ll = left->left.load(std::memory_order_relaxed);
+        Node* lr = left->right.load(std::memory_order_relaxed);
+        if(heightOf(ll) >= heightOf(lr)) {
+            top = copyNode(left, ll, copyNode(node, lr, right));
+        }
+        else {
+            top = copyNode(lr, copyNode(left, ll, lr->left.load(std::memory_order_relaxed)),
+                               copyNode(node, lr->right.load(std::memory_order_relaxed), right));
+            retire(lr);
+        }
+        retire(left);
+    }
+    else {
+        Node* rl = right->left.load(std::memory_order_relaxed);
+        Node* rr = right->right.load(std::memory_order_relaxed);
+        if(heightOf(rr) >= heightOf(rl)) {
+            top = copyNode(right, copyNode(node, left, rl), rr);
+        }
+        else {
+            top = copyNode(rl, copyNode(node, left, rl->left.load(std::memory_order_relaxed)),
+                               copyNode(right, rl->right.load(std::memory_order_relaxed), rr));
+            retire(rl);
+        }
+        retire(right);
+    }
+    retire(node);
+    return top;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Node*
+ConcurrentAVLTree<Key, Value, Compare>::copyNode(Node* node, Node* left, Node* right)
+{
+    Node* copy = new Node(node->item, left, right, 0);
+    fixHeight(copy);
+    return copy;
+}
+
+template<typename Key, typename Value, typename Compare>
+int ConcurrentAVLTree<Key, Value, Compare>::heightOf(Node* node)
+{
+    return node == nullptr ? 0 : node->height;
+}
+
+template<typename Key, typename Value, typename Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::fixHeight(Node* node)
+{
+    node->height = 1 + std::max(heightOf(node->left.load(std::memory_order_relaxed)),
+                                heightOf(node->right.load(std::memory_order_relaxed)));
+}
+
+/**
+* Returns the height of the subtree at node if it is ordered, AVL-balanced
+* and its stored heights are right, else -1.
+*/
+template<typename Key, typename Value, typename Compare>
+int ConcurrentAVLTree<Key, Value, Compare>::checkBalance(Node* node) const
+{
+    if(node == nullptr) {
+        return 0;
+    }
+    Node* left = node->left.load(std::memory_order_relaxed);
+    Node* right = node->right.load(std::memory_order_relaxed);
+    if((left != nullptr && !comp_(left->item.first, node->item.first)) ||
+       (right != nullptr && !comp_(node->item.first, right->item.first))) {
+        return -1;
+    }
+    int lh = checkBalance(left);
+    int rh = checkBalance(right);
+    if(lh < 0 || rh < 0 || lh - rh > 1 || rh - lh > 1 || node->height != 1 + std::max(lh, rh)) {
+        return -1;
+    }
+    return node->height;
+}
+
+template<typename Key, typename Value, typename Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::retire(Node* node)
+{
+    retired_[epoch_.load(std::memory_order_relaxed) % 3].push_back(node);
+}
+
+/**
+* Advances the epoch if no reader is left in the previous one, then frees
+* what was retired two epochs back. Never waits for readers.
+*/
+template<typename Key, typename Value, typename Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::tryReclaim()
+{
+    std::uint64_t epoch = epoch_.load(std::memory_order_relaxed);
+    unsigned previous = static_cast<unsigned>((epoch + 1) & 1);
+    for(unsigned i = 0; i < kReaderShards; ++i) {
+        if(readers_[i].active[previous].load(std::memory_order_seq_cst) != 0) {
+            return;
+        }
+    }
+    epoch_.store(epoch + 1, std::memory_order_seq_cst);
+    std::vector<Node*>& expired = retired_[(epoch + 2) % 3];
+    for(std::size_t i = 0; i < expired.size(); ++i) {
+        delete expired[i];
+    }
+    expired.clear();
+}
+
+template<typename Key, typename Value, typename Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::deleteSubtree(Node* node)
+{
+    std::vector<Node*> stack;
+    if(node != nullptr) {
+        stack.push_back(node);
+    }
+    while(!stack.empty()) {
+        Node* top = stack.back();
+        stack.pop_back();
+        if(Node* left = top->left.load(std::memory_order_relaxed)) stack.push_back(left);
+        if(Node* right = top->right.load(std::memory_order_relaxed)) stack.push_back(right);
+        delete top;
+    }
+}
+
+/*
+  -----------------------------------------------------
+  End implementations for the ConcurrentAVLTree class.
+  -----------------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,365 @@
+#ifndef FROZEN_BST_H
+#define FROZEN_BST_H
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include <stdexcept>
+#include <functional>
+
+/**
+* An immutable, contiguous snapshot of a search tree for read-only phases,
+* made by BinarySearchTree::freeze() or from a sorted random-access range.
+*
+* The keys are laid out in Eytzinger (BFS) order: the children of slot k
+* (1-based) are 2k and 2k + 1. A search is then a fixed number of
+* iterations of k = 2k + (key[k] < key) with no unpredictable branch, and
+* since the four levels below k sit in a few adjacent cache lines they are
+* prefetched while the current level is compared. The items are kept in
+* the same order next to the keys; iteration walks them in key order with
+* index arithmetic. Nothing can be inserted or removed.
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class FrozenSearchTree
+{
+public:
+    FrozenSearchTree();
+    template<typename RandomIt>
+    FrozenSearchTree(RandomIt first, RandomIt last, const Compare& comp = Compare(), bool checkSorted = true);
+
+    bool empty() const;
+    std::size_t size() const;
+    std::size_t memoryUsage() const;
+
+    /**
+    * Iterates in key order; holds the snapshot and a 1-based slot (0 is end).
+    */
+    class iterator
+    {
+    public:
+        iterator();
+
+        const std::pair<const Key,Value>& operator*() const;
+        const std::pair<const Key,Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+
+    protected:
+        friend class FrozenSearchTree<Key, Value, Compare>;
+        iterator(const FrozenSearchTree* tree, std::size_t current);
+        const FrozenSearchTree* tree_;
+        std::size_t current_;
+    };
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    iterator upper_bound(const Key& key) const;
+    Value const & operator[](const Key& key) const;
+
+private:
+    template<typename T>
+    static const T& itemOf(const T& item) { return item; }
+    template<typename T>
+    static const T& itemOf(T* const& item) { return *item; }
+
+    std::size_t lowerBoundSlot(const Key& key) const;
+    std::size_t upperBoundSlot(const Key& key) const;
+    static std::size_t leftmost(std::size_t k, std::size_t n);
+    static std::size_t successor(std::size_t k, std::size_t n);
+    static std::size_t stripRightTurns(std::size_t k);
+    void prefetch(std::size_t k) const;
+
+    // Slots 1..n live at index k - 1 of both vectors.
+    std::vector<Key> keys_;
+    std::vector<std::pair<const Key, Value> > items_;
+    Compare comp_;
+
+    // Descendants this many levels down share a block of 2^kPrefetchLevels
+    // consecutive slots, which is what gets prefetched.
+    static const unsigned kPrefetchLevels = 4;
+};
+
+/*
+  --------------------------------------------------------------
+  Begin implementations for the FrozenSearchTree::iterator class.
+  --------------------------------------------------------------
+*/
+
+template<typename Key, typename Value, typename Compare>
+FrozenSearchTree<Key, Value, Compare>::iterator::iterator() :
+    tree_(nullptr), current_(0)
+{
+
+}
+
+template<typename Key, typename Value, typename Compare>
+FrozenSearchTree<Key, Value, Compare>::iterator::iterator(const FrozenSearchTree* tree, std::size_t current) :
+    tree_(tree), current_(current)
+{
+
+}
+
+template<typename Key, typename Value, typename Compare>
+const std::pair<const Key,Value>& FrozenSearchTree<Key, Value, Compare>::iterator::operator*() const
+{
+    return tree_->items_[current_ - 1];
+}
+
+template<typename Key, typename Value, typename Compare>
+const std::pair<const Key,Value>* FrozenSearchTree<Key, Value, Compare>::iterator::operator->() const
+{
+    return &tree_->items_[current_ - 1];
+}
+
+template<typename Key, typename Value, typename Compare>
+bool FrozenSearchTree<Key, Value, Compare>::iterator::operator==(const iterator& rhs) const
+{
+    return current_ == rhs.current_;
+}
+
+template<typename Key, typename Value, typename Compare>
+bool FrozenSearchTree<Key, Value, Compare>::iterator::operator!=(const iterator& rhs) const
+{
+    return current_ != rhs.current_;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename FrozenSearchTree<Key, Value, Compare>::iterator&
+FrozenSearchTree<Key, Value, Compare>::iterator::operator++()
+{
+    current_ = successor(current_, tree_->keys_.size());
+    return *this;
+}
+
+/*
+  ------------------------------------------------------------
+  End implementations for the FrozenSearchTree::iterator class.
+  ------------------------------------------------------------
+*/
+
+/*
+  -----------------------------------------------------
+  Begin implementations for the FrozenSearchTree class.
+  -----------------------------------------------------
+*/
+
+template<typename Key, typename Value, typename Compare>
+FrozenSearchTree<Key, Value, Compare>::FrozenSearchTree() :
+    comp_()
+{
+
+}
+
+/**
+* Builds a snapshot of [first, last), which must be in strictly increasing
+* key order (checked unless checkSorted is false; std::invalid_argument
+* otherwise). The elements may be items or pointers to items. O(n).
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename RandomIt>
+FrozenSearchTree<Key, Value, Compare>::FrozenSearchTree(RandomIt first, RandomIt last,
+                                                        const Compare& comp, bool checkSorted) :
+    comp_(comp)
+{
+    std::size_t n = static_cast<std::size_t>(last - first);
+    if(checkSorted) {
+        for(std::size_t i = 1; i < n; ++i) {
+            if(!comp_(itemOf(first[i - 1]).first, itemOf(first[i]).first)) {
+                throw std::invalid_argument("FrozenSearchTree: keys are not strictly increasing");
+            }
+        }
+    }
+    if(n == 0) {
+        return;
+    }
+    // An in-order walk of the implicit tree numbers the slots in key order.
+    std::vector<std::size_t> rankOf(n + 1);
+    std::size_t i = 0;
+    for(std::size_t k = leftmost(1, n); k != 0; k = successor(k, n)) {
+        rankOf[k] = i++;
+    }
+    keys_.reserve(n);
+    items_.reserve(n);
+    for(std::size_t k = 1; k <= n; ++k) {
+        const std::pair<const Key, Value>& item = itemOf(first[rankOf[k]]);
+        keys_.push_back(item.first);
+        items_.push_back(item);
+    }
+}
+
+template<typename Key, typename Value, typename Compare>
+bool FrozenSearchTree<Key, Value, Compare>::empty() const
+{
+    return keys_.empty();
+}
+
+template<typename Key, typename Value, typename Compare>
+std::size_t FrozenSearchTree<Key, Value, Compare>::size() const
+{
+    return keys_.size();
+}
+
+/**
+* Bytes held by the two arrays (not counting memory owned by the items).
+*/
+template<typename Key, typename Value, typename Compare>
+std::size_t FrozenSearchTree<Key, Value, Compare>::memoryUsage() const
+{
+    return keys_.capacity() * sizeof(Key) + items_.capacity() * sizeof(std::pair<const Key, Value>);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename FrozenSearchTree<Key, Value, Compare>::iterator
+FrozenSearchTree<Key, Value, Compare>::begin() const
+{
+    return iterator(this, keys_.empty() ? 0 : leftmost(1, keys_.size()));
+}
+
+template<typename Key, typename Value, typename Compare>
+typename FrozenSearchTree<Key, Value, Compare>::iterator
+FrozenSearchTree<Key, Value, Compare>::end() const
+{
+    return iterator(this, 0);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename FrozenSearchTree<Key, Value, Compare>::iterator
+FrozenSearchTree<Key, Value, Compare>::find(const Key& key) const
+{
+    std::size_t k = lowerBoundSlot(key);
+    if(k != 0 && comp_(key, keys_[k - 1])) {
+        k = 0;
+    }
+    return iterator(this, k);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename FrozenSearchTree<Key, Value, Compare>::iterator
+FrozenSearchTree<Key, Value, Compare>::lower_bound(const Key& key) const
+{
+    return iterator(this, lowerBoundSlot(key));
+}
+
+template<typename Key, typename Value, typename Compare>
+typename FrozenSearchTree<Key, Value, Compare>::iterator
+FrozenSearchTree<Key, Value, Compare>::upper_bound(const Key& key) const
+{
+    return iterator(this, upperBoundSlot(key));
+}
+
+/**
+ * @precondition The key exists in the snapshot
+ * Returns the value associated with the key
+ */
+template<typename Key, typename Value, typename Compare>
+Value const & FrozenSearchTree<Key, Value, Compare>::operator[](const Key& key) const
+{
+    iterator it = find(key);
+    if(it == end()) throw std::out_of_range("Invalid key");
+    return it->second;
+}
+
+/**
+* The slot of the first key not less than key, or 0. The descent goes
+* right whenever the slot's key is less, so it always runs to the bottom;
+* the answer is the last slot where it went left, recovered from the bits
+* of the final position.
+*/
+template<typename Key, typename Value, typename Compare>
+std::size_t FrozenSearchTree<Key, Value, Compare>::lowerBoundSlot(const Key& key) const
+{
+    const std::size_t n = keys_.size();
+    std::size_t k = 1;
+    while(k <= n) {
+        prefetch(k);
+        k = 2 * k + static_cast<std::size_t>(comp_(keys_[k - 1], key));
+    }
+    return stripRightTurns(k);
+}
+
+/**
+* The slot of the first key greater than key, or 0.
+*/
+template<typename Key, typename Value, typename Compare>
+std::size_t FrozenSearchTree<Key, Value, Compare>::upperBoundSlot(const Key& key) const
+{
+    const std::size_t n = keys_.size();
+    std::size_t k = 1;
+    while(k <= n) {
+        prefetch(k);
+        k = 2 * k + static_cast<std::size_t>(!comp_(key, keys_[k - 1]));
+    }
+    return stripRightTurns(k);
+}
+
+/**
+* The first slot in key order of the subtree at k, of a tree of n slots.
+*/
+template<typename Key, typename Value, typename Compare>
+std::size_t FrozenSearchTree<Key, Value, Compare>::leftmost(std::size_t k, std::size_t n)
+{
+    while(2 * k <= n) {
+        k *= 2;
+    }
+    return k;
+}
+
+/**
+* The slot after k in key order, or 0 after the last one.
+*/
+template<typename Key, typename Value, typename Compare>
+std::size_t FrozenSearchTree<Key, Value, Compare>::successor(std::size_t k, std::size_t n)
+{
+    if(2 * k + 1 <= n) {
+        return leftmost(2 * k + 1, n);
+    }
+    return stripRightTurns(k);
+}
+
+/**
+* Climbs from k past every step that was a right turn (odd slot) and one
+* more, i.e. to the nearest ancestor whose left subtree holds k.
+*/
+template<typename Key, typename Value, typename Compare>
+std::size_t FrozenSearchTree<Key, Value, Compare>::stripRightTurns(std::size_t k)
+{
+#if defined(__GNUC__)
+    return k >> (__builtin_ctzll(~static_cast<unsigned long long>(k)) + 1);
+#else
+    while(k & 1) {
+        k >>= 1;
+    }
+    return k >> 1;
+#endif
+}
+
+/**
+* Hints the block of slots kPrefetchLevels below k into the cache. Only
+* an address is formed; it is never dereferenced, so running past the end
+* of the array is harmless.
+*/
+template<typename Key, typename Value, typename Compare>
+void FrozenSearchTree<Key, Value, Compare>::prefetch(std::size_t k) const
+{
+#if defined(__GNUC__)
+    std::uintptr_t block = reinterpret_cast<std::uintptr_t>(keys_.data())
+                         + ((k << kPrefetchLevels) - 1) * sizeof(Key);
+    __builtin_prefetch(reinterpret_cast<const void*>(block));
+#else
+    (void)k;
+#endif
+}
+
+/*
+  ---------------------------------------------------
+  End implementations for the FrozenSearchTree class.
+  ---------------------------------------------------
+*/
+
+#endif
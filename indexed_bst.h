@@ -0,0 +1,651 @@
+#ifndef INDEXED_BST_H
+#define INDEXED_BST_H
+
+#include <iostream>
+#include <exception>
+#include <cstdlib>
+#include <cstdint>
+#include <new>
+#include <utility>
+#include <vector>
+#include <stdexcept>
+#include <algorithm>
+#include <type_traits>
+#include <functional>
+
+/**
+* A search tree whose nodes live in one contiguous std::vector and link to
+* each other by 32-bit indices instead of 64-bit pointers. With Balanced
+* set it keeps the AVL invariant (same rotations as AVLTree); otherwise it
+* behaves like the unbalanced BinarySearchTree.
+*
+* Because links are indices, the storage is relocatable: growing the vector
+* or copying the whole tree is a plain element-wise copy, and iterators
+* (tree + index) survive insertions. The vector is kept dense: remove moves
+* the last slot into the freed one, so an iterator to that last slot is
+* invalidated by a remove. At most 2^32 - 1 items fit. Keys are ordered
+* by Compare, as in BinarySearchTree.
+*/
+template <typename Key, typename Value, bool Balanced = false, typename Compare = std::less<Key> >
+class IndexedSearchTree
+{
+public:
+    typedef std::uint32_t Index;
+    static const Index kNull = 0xffffffffu;
+
+    explicit IndexedSearchTree(const Compare& comp = Compare());
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    void reserve(std::size_t n);
+    bool isBalanced() const;
+    bool empty() const;
+    std::size_t size() const;
+    std::size_t memoryUsage() const;
+
+    /**
+    * Iterates in key order; holds the tree and a slot index.
+    */
+    class iterator
+    {
+    public:
+        iterator();
+
+        std::pair<const Key,Value>& operator*() const;
+        std::pair<const Key,Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+
+    protected:
+        friend class IndexedSearchTree<Key, Value, Balanced, Compare>;
+        iterator(const IndexedSearchTree* tree, Index current);
+        IndexedSearchTree* tree_;
+        Index current_;
+    };
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    Value& operator[](const Key& key);
+    Value const & operator[](const Key& key) const;
+
+private:
+    struct Slot
+    {
+        Slot(const std::pair<const Key, Value>& item, Index parent);
+        Slot(Slot&& other)
+            noexcept(std::is_nothrow_move_constructible<std::pair<const Key, Value> >::value);
+        Slot(const Slot& other);
+
+        std::pair<const Key, Value> item;
+        Index parent;
+        Index child[2];   // left, right: indexable so descents need no branch
+        int8_t balance;
+    };
+
+    Index internalFind(const Key& key) const;
+    Index findOrLink(const Key& key, const Value* value);
+    Index successor(Index n) const;
+    Index predecessor(Index n) const;
+    void replaceChild(Index parent, Index oldChild, Index newChild);
+    void relocate(Index from, Index to);
+    void rotateLeft(Index n);
+    void rotateRight(Index n);
+    void rebalance(Index n);
+    void insertFixup(Index n);
+    void removeFixup(Index parent, bool fromLeft);
+    int checkBalance(Index n) const;
+
+    std::vector<Slot> slots_;
+    Index root_;
+    Compare comp_;
+};
+
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+using IndexedBinarySearchTree = IndexedSearchTree<Key, Value, false, Compare>;
+
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+using IndexedAVLTree = IndexedSearchTree<Key, Value, true, Compare>;
+
+/*
+  -----------------------------------------
+  Begin implementations for the Slot class.
+  -----------------------------------------
+*/
+
+template<typename Key, typename Value, bool Balanced, typename Compare>
+IndexedSearchTree<Key, Value, Balanced, Compare>::Slot::Slot(const std::pair<const Key, Value>& item, Index parent) :
+    item(item), parent(parent), balance(0)
+{
+    child[0] = kNull;
+    child[1] = kNull;
+}
+
+template<typename Key, typename Value, bool Balanced, typename Compare>
+IndexedSearchTree<Key, Value, Balanced, Compare>::Slot::Slot(Slot&& other)
+    noexcept(std::is_nothrow_move_constructible<std::pair<const Key, Value> >::value) :
+    item(std::move(other.item)), parent(other.parent), balance(other.balance)
+{
+    child[0] = other.child[0];
+    child[1] = other.child[1];
+}
+
+template<typename Key, typename Value, bool Balanced, typename Compare>
+IndexedSearchTree<Key, Value, Balanced, Compare>::Slot::Slot(const Slot& other) :
+    item(other.item), parent(other.parent), balance(other.balance)
+{
+    child[0] = other.child[0];
+    child[1] = other.child[1];
+}
+
+/*
+  ---------------------------------------
+  End implementations for the Slot class.
+  ---------------------------------------
+*/
+
+/*
+  ---------------------------------------------------------------
+  Begin implementations for the IndexedSearchTree::iterator class.
+  ---------------------------------------------------------------
+*/
+
+template<typename Key, typename Value, bool Balanced, typename Compare>
+IndexedSearchTree<Key, Value, Balanced, Compare>::iterator::iterator() :
+    tree_(nullptr), current_(kNull)
+{
+
+}
+
+template<typename Key, typename Value, bool Balanced, typename Compare>
+IndexedSearchTree<Key, Value, Balanced, Compare>::iterator::iterator(const IndexedSearchTree* tree, Index current) :
+    tree_(const_cast<IndexedSearchTree*>(tree)), current_(current)
+{
+
+}
+
+template<typename Key, typename Value, bool Balanced, typename Compare>
+std::pair<const Key,Value>&
+IndexedSearchTree<Key, Value, Balanced, Compare>::iterator::operator*() const
+{
+    return tree_->slots_[current_].item;
+}
+
+template<typename Key, typename Value, bool Balanced, typename Compare>
+std::pair<const Key,Value>*
+IndexedSearchTree<Key, Value, Balanced, Compare>::iterator::operator->() const
+{
+    return &(tree_->slots_[current_].item);
+}
+
+template<typename Key, typename Value, bool Balanced, typename Compare>
+bool IndexedSearchTree<Key, Value, Balanced, Compare>::iterator::operator==(const iterator& rhs) const
+{
+    return current_ == rhs.current_;
+}
+
+template<typename Key, typename Value, bool Balanced, typename Compare>
+bool IndexedSearchTree<Key, Value, Balanced, Compare>::iterator::operator!=(const iterator& rhs) const
+{
+    return current_ != rhs.current_;
+}
+
+template<typename Key, typename Value, bool Balanced, typename Compare>
+typename IndexedSearchTree<Key, Value, Balanced, Compare>::iterator&
+IndexedSearchTree<Key, Value, Balanced, Compare>::iterator::operator++()
+{
+    if(current_ != kNull) {
+        current_ = tree_->successor(current_);
+    }
+    return *this;
+}
+
+/*
+  -------------------------------------------------------------
+  End implementations for the IndexedSearchTree::iterator class.
+  -------------------------------------------------------------
+*/
+
+/*
+  ------------------------------------------------------
+  Begin implementations for the IndexedSearchTree class.
+  ------------------------------------------------------
+*/
+
+template<typename Key, typename Value, bool Balanced, typename Compare>
+IndexedSearchTree<Key, Value, Balanced, Compare>::IndexedSearchTree(const Compare& comp) :
+    root_(kNull), comp_(comp)
+{
+
+}
+
+template<typename Key, typename Value, bool Balanced, typename Compare>
+bool IndexedSearchTree<Key, Value, Balanced, Compare>::empty() const
+{
+    return root_ == kNull;
+}
+
+template<typename Key, typename Value, bool Balanced, typename Compare>
+std::size_t IndexedSearchTree<Key, Value, Balanced, Compare>::size() const
+{
+    return slots_.size();
+}
+
+/**
+* Bytes reserved for node storage (capacity, not just live slots).
+*/
+template<typename Key, typename Value, bool Balanced, typename Compare>
+std::size_t IndexedSearchTree<Key, Value, Balanced, Compare>::memoryUsage() const
+{
+    return slots_.capacity() * sizeof(Slot);
+}
+
+template<typename Key, typename Value, bool Balanced, typename Compare>
+void IndexedSearchTree<Key, Value, Balanced, Compare>::reserve(std::size_t n)
+{
+    slots_.reserve(n);
+}
+
+/**
+* Drops every slot at once; no per-node work beyond the item destructors.
+*/
+template<typename Key, typename Value, bool Balanced, typename Compare>
+void IndexedSearchTree<Key, Value, Balanced, Compare>::clear()
+{
+    slots_.clear();
+    root_ = kNull;
+}
+
+template<typename Key, typename Value, bool Balanced, typename Compare>
+typename IndexedSearchTree<Key, Value, Balanced, Compare>::iterator
+IndexedSearchTree<Key, Value, Balanced, Compare>::begin() const
+{
+    Index current = root_;
+    while(current != kNull && slots_[current].child[0] != kNull) {
+        current = slots_[current].child[0];
+    }
+    return iterator(this, current);
+}
+
+template<typename Key, typename Value, bool Balanced, typename Compare>
+typename IndexedSearchTree<Key, Value, Balanced, Compare>::iterator
+IndexedSearchTree<Key, Value, Balanced, Compare>::end() const
+{
+    return iterator(this, kNull);
+}
+
+template<typename Key, typename Value, bool Balanced, typename Compare>
+typename IndexedSearchTree<Key, Value, Balanced, Compare>::iterator
+IndexedSearchTree<Key, Value, Balanced, Compare>::find(const Key& key) const
+{
+    return iterator(this, internalFind(key));
+}
+
+/**
+ * Returns the value associated with the key, inserting a
+ * default-constructed value first if the key is not in the map.
+ * One descent either way.
+ */
+template<typename Key, typename Value, bool Balanced, typename Compare>
+Value& IndexedSearchTree<Key, Value, Balanced, Compare>::operator[](const Key& key)
+{
+    return slots_[findOrLink(key, nullptr)].item.second;
+}
+
+/**
+ * @precondition The key exists in the map
+ */
+template<typename Key, typename Value, bool Balanced, typename Compare>
+Value const & IndexedSearchTree<Key, Value, Balanced, Compare>::operator[](const Key& key) const
+{
+    Index n = internalFind(key);
+    if(n == kNull) throw std::out_of_range("Invalid key");
+    return slots_[n].item.second;
+}
+
+/**
+* Inserts the pair, overwriting the value if the key is already present.
+*/
+template<typename Key, typename Value, bool Balanced, typename Compare>
+void IndexedSearchTree<Key, Value, Balanced, Compare>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    findOrLink(keyValuePair.first, &keyValuePair.second);
+}
+
+/**
+* Returns the slot holding key, after assigning *value to it if value is
+* set. A missing key is linked in with *value, or with Value() when value
+* is nullptr. Rotations move links, not slots, so the index stays good.
+*/
+template<typename Key, typename Value, bool Balanced, typename Compare>
+typename IndexedSearchTree<Key, Value, Balanced, Compare>::Index
+IndexedSearchTree<Key, Value, Balanced, Compare>::findOrLink(const Key& key, const Value* value)
+{
+    Index parent = kNull;
+    Index current = root_;
+    bool asLeft = false;
+    while(current != kNull) {
+        parent = current;
+        if(comp_(key, slots_[current].item.first)) {
+            asLeft = true;
+            current = slots_[current].child[0];
+        } else if(comp_(slots_[current].item.first, key)) {
+            asLeft = false;
+            current = slots_[current].child[1];
+        } else {
+            if(value != nullptr) {
+                slots_[current].item.second = *value;
+            }
+            return current;
+        }
+    }
+    if(slots_.size() >= kNull) {
+        throw std::length_error("IndexedSearchTree is full");
+    }
+    Index n = static_cast<Index>(slots_.size());
+    if(value != nullptr) {
+        slots_.push_back(Slot(std::pair<const Key, Value>(key, *value), parent));
+    } else {
+        slots_.push_back(Slot(std::pair<const Key, Value>(key, Value()), parent));
+    }
+    if(parent == kNull) {
+        root_ = n;
+    } else if(asLeft) {
+        slots_[parent].child[0] = n;
+    } else {
+        slots_[parent].child[1] = n;
+    }
+    insertFixup(n);
+    return n;
+}
+
+/**
+* Removes the key if present. A node with two children takes over its
+* predecessor's item and the predecessor's slot is unlinked instead.
+*/
+template<typename Key, typename Value, bool Balanced, typename Compare>
+void IndexedSearchTree<Key, Value, Balanced, Compare>::remove(const Key& key)
+{
+    Index n = internalFind(key);
+    if(n == kNull) return;
+
+    if(slots_[n].child[0] != kNull && slots_[n].child[1] != kNull) {
+        Index pred = predecessor(n);
+        // Rebuild n around the predecessor's item, keeping n's links.
+        Slot moved(std::move(slots_[pred]));
+        moved.parent = slots_[n].parent;
+        moved.child[0] = slots_[n].child[0];
+        moved.child[1] = slots_[n].child[1];
+        moved.balance = slots_[n].balance;
+        slots_[n].~Slot();
+        ::new (static_cast<void*>(&slots_[n])) Slot(std::move(moved));
+        n = pred;
+    }
+
+    Index child = (slots_[n].child[0] != kNull) ? slots_[n].child[0] : slots_[n].child[1];
+    Index parent = slots_[n].parent;
+    bool fromLeft = (parent != kNull && slots_[parent].child[0] == n);
+    if(child != kNull) {
+        slots_[child].parent = parent;
+    }
+    if(parent == kNull) {
+        root_ = child;
+    } else {
+        replaceChild(parent, n, child);
+    }
+
+    // Keep storage dense: move the last slot into the hole.
+    Index last = static_cast<Index>(slots_.size() - 1);
+    if(n != last) {
+        relocate(last, n);
+        if(parent == last) parent = n;
+    }
+    slots_.pop_back();
+
+    if(parent != kNull) {
+        removeFixup(parent, fromLeft);
+    }
+}
+
+/**
+* Moves the slot at 'from' into the (dead) slot at 'to' and repoints
+* every link that referred to 'from'.
+*/
+template<typename Key, typename Value, bool Balanced, typename Compare>
+void IndexedSearchTree<Key, Value, Balanced, Compare>::relocate(Index from, Index to)
+{
+    slots_[to].~Slot();
+    ::new (static_cast<void*>(&slots_[to])) Slot(std::move(slots_[from]));
+    Slot& s = slots_[to];
+    if(s.parent == kNull) {
+        root_ = to;
+    } else {
+        replaceChild(s.parent, from, to);
+    }
+    if(s.child[0] != kNull) slots_[s.child[0]].parent = to;
+    if(s.child[1] != kNull) slots_[s.child[1]].parent = to;
+}
+
+template<typename Key, typename Value, bool Balanced, typename Compare>
+void IndexedSearchTree<Key, Value, Balanced, Compare>::replaceChild(Index parent, Index oldChild, Index newChild)
+{
+    if(slots_[parent].child[0] == oldChild) {
+        slots_[parent].child[0] = newChild;
+    } else {
+        slots_[parent].child[1] = newChild;
+    }
+}
+
+template<typename Key, typename Value, bool Balanced, typename Compare>
+typename IndexedSearchTree<Key, Value, Balanced, Compare>::Index
+IndexedSearchTree<Key, Value, Balanced, Compare>::internalFind(const Key& key) const
+{
+    Index current = root_;
+    while(current != kNull) {
+        const Slot& s = slots_[current];
+        bool goLeft = comp_(key, s.item.first);
+        if(!goLeft && !comp_(s.item.first, key)) {
+            return current;
+        }
+        current = s.child[!goLeft];
+    }
+    return kNull;
+}
+
+template<typename Key, typename Value, bool Balanced, typename Compare>
+typename IndexedSearchTree<Key, Value, Balanced, Compare>::Index
+IndexedSearchTree<Key, Value, Balanced, Compare>::successor(Index n) const
+{
+    if(slots_[n].child[1] != kNull) {
+        n = slots_[n].child[1];
+        while(slots_[n].child[0] != kNull) {
+            n = slots_[n].child[0];
+        }
+        return n;
+    }
+    Index parent = slots_[n].parent;
+    while(parent != kNull && n == slots_[parent].child[1]) {
+        n = parent;
+        parent = slots_[parent].parent;
+    }
+    return parent;
+}
+
+template<typename Key, typename Value, bool Balanced, typename Compare>
+typename IndexedSearchTree<Key, Value, Balanced, Compare>::Index
+IndexedSearchTree<Key, Value, Balanced, Compare>::predecessor(Index n) const
+{
+    if(slots_[n].child[0] != kNull) {
+        n = slots_[n].child[0];
+        while(slots_[n].child[1] != kNull) {
+            n = slots_[n].child[1];
+        }
+        return n;
+    }
+    Index parent = slots_[n].parent;
+    while(parent != kNull && n == slots_[parent].child[0]) {
+        n = parent;
+        parent = slots_[parent].parent;
+    }
+    return parent;
+}
+
+template<typename Key, typename Value, bool Balanced, typename Compare>
+void IndexedSearchTree<Key, Value, Balanced, Compare>::rotateLeft(Index n)
+{
+    Index r = slots_[n].child[1];
+    Index rl = slots_[r].child[0];
+    Index p = slots_[n].parent;
+    slots_[n].child[1] = rl;
+    if(rl != kNull) slots_[rl].parent = n;
+    slots_[r].parent = p;
+    if(p == kNull) root_ = r;
+    else replaceChild(p, n, r);
+    slots_[r].child[0] = n;
+    slots_[n].parent = r;
+
+    int8_t rBalance = slots_[r].balance;
+    slots_[n].balance = slots_[n].balance - 1 - std::max(rBalance, (int8_t)0);
+    slots_[r].balance = slots_[r].balance - 1 + std::min(slots_[n].balance, (int8_t)0);
+}
+
+template<typename Key, typename Value, bool Balanced, typename Compare>
+void IndexedSearchTree<Key, Value, Balanced, Compare>::rotateRight(Index n)
+{
+    Index l = slots_[n].child[0];
+    Index lr = slots_[l].child[1];
+    Index p = slots_[n].parent;
+    slots_[n].child[0] = lr;
+    if(lr != kNull) slots_[lr].parent = n;
+    slots_[l].parent = p;
+    if(p == kNull) root_ = l;
+    else replaceChild(p, n, l);
+    slots_[l].child[1] = n;
+    slots_[n].parent = l;
+
+    int8_t lBalance = slots_[l].balance;
+    slots_[n].balance = slots_[n].balance + 1 - std::min(lBalance, (int8_t)0);
+    slots_[l].balance = slots_[l].balance + 1 + std::max(slots_[n].balance, (int8_t)0);
+}
+
+template<typename Key, typename Value, bool Balanced, typename Compare>
+void IndexedSearchTree<Key, Value, Balanced, Compare>::rebalance(Index n)
+{
+    if(slots_[n].balance == -2) {
+        if(slots_[slots_[n].child[0]].balance <= 0) {
+            rotateRight(n);
+        } else {
+            rotateLeft(slots_[n].child[0]);
+            rotateRight(n);
+        }
+    } else if(slots_[n].balance == 2) {
+        if(slots_[slots_[n].child[1]].balance >= 0) {
+            rotateLeft(n);
+        } else {
+            rotateRight(slots_[n].child[1]);
+            rotateLeft(n);
+        }
+    }
+}
+
+/**
+* Same retrace as AVLTree::insertFixup; a no-op for the unbalanced mode.
+*/
+template<typename Key, typename Value, bool Balanced, typename Compare>
+void IndexedSearchTree<Key, Value, Balanced, Compare>::insertFixup(Index n)
+{
+    if(!Balanced) return;
+    Index child = n;
+    Index current = slots_[n].parent;
+    while(current != kNull) {
+        slots_[current].balance += (child == slots_[current].child[0]) ? -1 : 1;
+        if(slots_[current].balance == 0) break;
+        if(std::abs(slots_[current].balance) == 2) {
+            rebalance(current);
+            break;
+        }
+        child = current;
+        current = slots_[current].parent;
+    }
+}
+
+/**
+* Same retrace as AVLTree::removeFixup; a no-op for the unbalanced mode.
+*/
+template<typename Key, typename Value, bool Balanced, typename Compare>
+void IndexedSearchTree<Key, Value, Balanced, Compare>::removeFixup(Index parent, bool fromLeft)
+{
+    if(!Balanced) return;
+    Index current = parent;
+    while(current != kNull) {
+        slots_[current].balance += fromLeft ? 1 : -1;
+        if(std::abs(slots_[current].balance) == 1) break;
+        if(std::abs(slots_[current].balance) == 2) {
+            rebalance(current);
+            current = slots_[current].parent;
+            if(slots_[current].balance != 0) break;
+        }
+        Index up = slots_[current].parent;
+        if(up != kNull) fromLeft = (slots_[up].child[0] == current);
+        current = up;
+    }
+}
+
+template<typename Key, typename Value, bool Balanced, typename Compare>
+bool IndexedSearchTree<Key, Value, Balanced, Compare>::isBalanced() const
+{
+    return checkBalance(root_) != -1;
+}
+
+/**
+* Height of the subtree at n, or -1 if some node in it is out of balance.
+* A post-order walk along the parent links with the finished subtrees'
+* heights on a vector, so a degenerate tree cannot overflow the stack.
+*/
+template<typename Key, typename Value, bool Balanced, typename Compare>
+int IndexedSearchTree<Key, Value, Balanced, Compare>::checkBalance(Index n) const
+{
+    if(n == kNull) return 0;
+    std::vector<int> heights;
+    Index prev = kNull;
+    Index current = n;
+    while(current != kNull) {
+        const Slot& s = slots_[current];
+        bool fromAbove = (current == n) ? prev == kNull : prev == s.parent;
+        if(fromAbove && s.child[0] != kNull) {
+            prev = current;
+            current = s.child[0];
+            continue;
+        }
+        if((fromAbove || prev == s.child[0]) && s.child[1] != kNull) {
+            prev = current;
+            current = s.child[1];
+            continue;
+        }
+        int rightHeight = 0, leftHeight = 0;
+        if(s.child[1] != kNull) {
+            rightHeight = heights.back();
+            heights.pop_back();
+        }
+        if(s.child[0] != kNull) {
+            leftHeight = heights.back();
+            heights.pop_back();
+        }
+        if(std::abs(leftHeight - rightHeight) > 1) return -1;
+        heights.push_back(1 + std::max(leftHeight, rightHeight));
+        prev = current;
+        current = (current == n) ? kNull : s.parent;
+    }
+    return heights.back();
+}
+
+/*
+  ----------------------------------------------------
+  End implementations for the IndexedSearchTree class.
+  ----------------------------------------------------
+*/
+
+#endif
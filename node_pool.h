@@ -0,0 +1,297 @@
+#ifndef NODE_POOL_H
+#define NODE_POOL_H
+
+#include <cstddef>
+#include <atomic>
+#include <thread>
+#include <new>
+#include <memory>
+#include <vector>
+#include <type_traits>
+
+/**
+* A slab/arena pool for fixed-size tree nodes.
+*
+* Memory is carved out of large contiguous blocks, one bump cursor per size
+* class, so nodes allocated one after another end up next to each other.
+* Freed slots go onto an intrusive free list for their size class and are
+* handed out again before the cursor advances. Blocks are only returned to
+* the system when the pool itself is destroyed.
+*
+* A pool is not thread-safe by default, so one owned by a single tree
+* costs no atomics. A pool can end up shared by trees used from different
+* threads, though: a tree split off another (AVLTree::split) keeps drawing
+* on the pool its nodes came from. Such a pool must be made locked, so
+* that allocate and deallocate take a small spin lock (an uncontended
+* atomic exchange per call). Copies of a tree get a pool of their own
+* (see PoolAllocator).
+*/
+class NodePool
+{
+public:
+    // Slot sizes are rounded up to this granularity (and this alignment).
+    static const std::size_t kGranularity = alignof(std::max_align_t);
+    // Requests larger than this are not pooled.
+    static const std::size_t kMaxSlotSize = 256;
+
+    explicit NodePool(std::size_t slotsPerBlock = 256, bool locked = false);
+    ~NodePool();
+
+    void* allocate(std::size_t bytes);
+    void deallocate(void* p, std::size_t bytes);
+
+    static bool pooled(std::size_t bytes, std::size_t align);
+    std::size_t slotsPerBlock() const;
+    bool locked() const;
+
+private:
+    NodePool(const NodePool&);
+    NodePool& operator=(const NodePool&);
+
+    // Holds the pool's lock for its lifetime, if the pool is locked.
+    class Guard
+    {
+    public:
+        explicit Guard(NodePool& pool) : lock_(pool.locked_ ? &pool.lock_ : nullptr)
+        {
+            while(lock_ != nullptr && lock_->test_and_set(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+        }
+        ~Guard()
+        {
+            if(lock_ != nullptr) {
+                lock_->clear(std::memory_order_release);
+            }
+        }
+    private:
+        std::atomic_flag* lock_;
+    };
+
+    struct FreeSlot
+    {
+        FreeSlot* next;
+    };
+
+    struct SizeClass
+    {
+        FreeSlot* free;
+        char* cursor;
+        char* limit;
+    };
+
+    static std::size_t classIndex(std::size_t bytes);
+
+    SizeClass classes_[kMaxSlotSize / kGranularity];
+    std::vector<void*> blocks_;
+    std::size_t slotsPerBlock_;
+    bool locked_;
+    std::atomic_flag lock_;
+};
+
+/*
+  ---------------------------------------------
+  Begin implementations for the NodePool class.
+  ---------------------------------------------
+*/
+
+/**
+* locked makes allocate and deallocate safe to call from several threads.
+*/
+inline NodePool::NodePool(std::size_t slotsPerBlock, bool locked) :
+    slotsPerBlock_(slotsPerBlock == 0 ? 1 : slotsPerBlock), locked_(locked)
+{
+    lock_.clear();
+    for(std::size_t i = 0; i < kMaxSlotSize / kGranularity; ++i) {
+        classes_[i].free = nullptr;
+        classes_[i].cursor = nullptr;
+        classes_[i].limit = nullptr;
+    }
+}
+
+/**
+* Releases every block at once; any node still living in the pool is gone.
+*/
+inline NodePool::~NodePool()
+{
+    for(std::size_t i = 0; i < blocks_.size(); ++i) {
+        ::operator delete(blocks_[i]);
+    }
+}
+
+/**
+* Returns true if a request of the given size and alignment is served
+* from the pool rather than from the general-purpose heap.
+*/
+inline bool NodePool::pooled(std::size_t bytes, std::size_t align)
+{
+    return bytes != 0 && bytes <= kMaxSlotSize && align <= kGranularity;
+}
+
+inline std::size_t NodePool::slotsPerBlock() const
+{
+    return slotsPerBlock_;
+}
+
+inline bool NodePool::locked() const
+{
+    return locked_;
+}
+
+inline std::size_t NodePool::classIndex(std::size_t bytes)
+{
+    return (bytes + kGranularity - 1) / kGranularity - 1;
+}
+
+/**
+* Hands out one slot able to hold 'bytes' bytes, reusing a freed slot
+* of the same size class when there is one.
+*/
+inline void* NodePool::allocate(std::size_t bytes)
+{
+    Guard guard(*this);
+    SizeClass& sc = classes_[classIndex(bytes)];
+    if(sc.free != nullptr) {
+        FreeSlot* slot = sc.free;
+        sc.free = slot->next;
+        return slot;
+    }
+    std::size_t slotSize = (classIndex(bytes) + 1) * kGranularity;
+    if(sc.cursor == sc.limit) {
+        blocks_.reserve(blocks_.size() + 1);
+        char* block = static_cast<char*>(::operator new(slotSize * slotsPerBlock_));
+        blocks_.push_back(block);
+        sc.cursor = block;
+        sc.limit = block + slotSize * slotsPerBlock_;
+    }
+    void* p = sc.cursor;
+    sc.cursor += slotSize;
+    return p;
+}
+
+/**
+* Puts a slot back on the free list of its size class.
+*/
+inline void NodePool::deallocate(void* p, std::size_t bytes)
+{
+    Guard guard(*this);
+    SizeClass& sc = classes_[classIndex(bytes)];
+    FreeSlot* slot = static_cast<FreeSlot*>(p);
+    slot->next = sc.free;
+    sc.free = slot;
+}
+
+/*
+  -------------------------------------------
+  End implementations for the NodePool class.
+  -------------------------------------------
+*/
+
+/**
+* A standard allocator that draws single-object allocations from a shared
+* NodePool. Copies and rebound copies share the pool, so a tree can rebind
+* its allocator to its node type without losing the pool. A container
+* copy (select_on_container_copy_construction) starts a fresh pool
+* instead, so a copied tree and its original never touch the same free
+* lists. Pass locked = true for a tree whose split-off parts will be used
+* from other threads. Array requests and oversized or over-aligned types
+* fall back to operator new.
+*/
+template <typename T>
+class PoolAllocator
+{
+public:
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+    typedef std::false_type is_always_equal;
+
+    template <typename U>
+    struct rebind
+    {
+        typedef PoolAllocator<U> other;
+    };
+
+    PoolAllocator();
+    explicit PoolAllocator(std::size_t slotsPerBlock, bool locked = false);
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>& other);
+
+    T* allocate(std::size_t n);
+    void deallocate(T* p, std::size_t n);
+    PoolAllocator select_on_container_copy_construction() const;
+
+    const std::shared_ptr<NodePool>& pool() const;
+
+private:
+    std::shared_ptr<NodePool> pool_;
+};
+
+template <typename T>
+PoolAllocator<T>::PoolAllocator() : pool_(std::make_shared<NodePool>())
+{
+
+}
+
+template <typename T>
+PoolAllocator<T>::PoolAllocator(std::size_t slotsPerBlock, bool locked) :
+    pool_(std::make_shared<NodePool>(slotsPerBlock, locked))
+{
+
+}
+
+template <typename T>
+template <typename U>
+PoolAllocator<T>::PoolAllocator(const PoolAllocator<U>& other) : pool_(other.pool())
+{
+
+}
+
+template <typename T>
+T* PoolAllocator<T>::allocate(std::size_t n)
+{
+    if(n == 1 && NodePool::pooled(sizeof(T), alignof(T))) {
+        return static_cast<T*>(pool_->allocate(sizeof(T)));
+    }
+    return static_cast<T*>(::operator new(n * sizeof(T)));
+}
+
+template <typename T>
+void PoolAllocator<T>::deallocate(T* p, std::size_t n)
+{
+    if(n == 1 && NodePool::pooled(sizeof(T), alignof(T))) {
+        pool_->deallocate(p, sizeof(T));
+        return;
+    }
+    ::operator delete(p);
+}
+
+/**
+* The allocator for a copy of a container: same block size and locking,
+* new pool.
+*/
+template <typename T>
+PoolAllocator<T> PoolAllocator<T>::select_on_container_copy_construction() const
+{
+    return PoolAllocator<T>(pool_->slotsPerBlock(), pool_->locked());
+}
+
+template <typename T>
+const std::shared_ptr<NodePool>& PoolAllocator<T>::pool() const
+{
+    return pool_;
+}
+
+template <typename T, typename U>
+bool operator==(const PoolAllocator<T>& a, const PoolAllocator<U>& b)
+{
+    return a.pool() == b.pool();
+}
+
+template <typename T, typename U>
+bool operator!=(const PoolAllocator<T>& a, const PoolAllocator<U>& b)
+{
+    return !(a == b);
+}
+
+#endif
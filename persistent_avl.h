@@ -0,0 +1,642 @@
+#ifndef PERSISTENT_AVL_H
+#define PERSISTENT_AVL_H
+
+#include <cstddef>
+#include <atomic>
+#include <utility>
+#include <vector>
+#include <stdexcept>
+#include <functional>
+#include <algorithm>
+
+/**
+* An AVL tree whose versions share structure, so that snapshot() (and
+* copying) is O(1). Nodes are reference counted. An update copies only
+* the nodes on its root-to-leaf path that some other version also holds
+* (plus the few a rotation touches); a node held by this version alone is
+* changed in place, so with no snapshot around a write costs about what it
+* does in AVLTree. A snapshot never sees later writes to the tree it was
+* taken from, and may be read, or dropped, on another thread while that
+* tree keeps changing (the tree object itself is not thread-safe).
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class PersistentAVLTree
+{
+public:
+    typedef std::pair<const Key, Value> value_type;
+
+    PersistentAVLTree();
+    explicit PersistentAVLTree(const Compare& comp);
+    PersistentAVLTree(const PersistentAVLTree& other);
+    PersistentAVLTree(PersistentAVLTree&& other) noexcept;
+    PersistentAVLTree& operator=(const PersistentAVLTree& other);
+    PersistentAVLTree& operator=(PersistentAVLTree&& other) noexcept;
+    ~PersistentAVLTree();
+
+    PersistentAVLTree snapshot() const;
+    void insert(const value_type& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    bool isBalanced() const;
+    bool empty() const;
+    std::size_t size() const;
+
+private:
+    struct Node
+    {
+        Node(const value_type& item, Node* left, Node* right, int height) :
+            item(item), left(left), right(right), height(height), refs(1) { }
+        value_type item;
+        Node* left;
+        Node* right;
+        int height;
+        std::atomic<std::size_t> refs;
+    };
+
+public:
+    /**
+    * Iterates in key order; keeps the path to the current node, as nodes
+    * have no parent links (one node can sit in several versions). find()
+    * skips recording the path and the first ++ looks it up instead. Valid
+    * until the version it came from changes or goes away.
+    */
+    class iterator
+    {
+    public:
+        iterator();
+
+        const value_type& operator*() const;
+        const value_type* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+
+    protected:
+        friend class PersistentAVLTree<Key, Value, Compare>;
+        iterator(const PersistentAVLTree* tree, const Node* current);
+        iterator(const PersistentAVLTree* tree, const Node* current, std::vector<const Node*>&& pending);
+        const PersistentAVLTree* tree_;
+        const Node* current_;
+        std::vector<const Node*> pending_;   // ancestors whose item is still to come
+        bool pathKnown_;
+    };
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    iterator upper_bound(const Key& key) const;
+    Value& operator[](const Key& key);
+    Value const & operator[](const Key& key) const;
+
+private:
+    // Each of these takes over the caller's reference to node and returns
+    // a reference to the subtree that replaces it.
+    Node* upsert(Node* node, const Key& key, const Value* value, Node*& target);
+    Node* erase(Node* node, const Key& key);
+    static Node* takeMin(Node* node, Node*& min);
+    static Node* unshare(Node* node);
+    static Node* rebalance(Node* node);
+    static Node* rotateLeft(Node* node);
+    static Node* rotateRight(Node* node);
+
+    static Node* retain(Node* node);
+    static void release(Node* node);
+    static int heightOf(const Node* node);
+    static void fixHeight(Node* node);
+    int checkBalance(const Node* node) const;
+    iterator bound(const Key& key, bool strict) const;
+
+    Node* root_;
+    std::size_t size_;
+    Compare comp_;
+};
+
+/*
+  ----------------------------------------------------------------
+  Begin implementations for the PersistentAVLTree::iterator class.
+  ----------------------------------------------------------------
+*/
+
+template<typename Key, typename Value, typename Compare>
+PersistentAVLTree<Key, Value, Compare>::iterator::iterator() :
+    tree_(nullptr), current_(nullptr), pathKnown_(true)
+{
+
+}
+
+template<typename Key, typename Value, typename Compare>
+PersistentAVLTree<Key, Value, Compare>::iterator::iterator(const PersistentAVLTree* tree, const Node* current) :
+    tree_(tree), current_(current), pathKnown_(false)
+{
+
+}
+
+template<typename Key, typename Value, typename Compare>
+PersistentAVLTree<Key, Value, Compare>::iterator::iterator(const PersistentAVLTree* tree, const Node* current,
+                                                           std::vector<const Node*>&& pending) :
+    tree_(tree), current_(current), pending_(std::move(pending)), pathKnown_(true)
+{
+
+}
+
+template<typename Key, typename Value, typename Compare>
+const typename PersistentAVLTree<Key, Value, Compare>::value_type&
+PersistentAVLTree<Key, Value, Compare>::iterator::operator*() const
+{
+    return current_->item;
+}
+
+template<typename Key, typename Value, typename Compare>
+const typename PersistentAVLTree<Key, Value, Compare>::value_type*
+PersistentAVLTree<Key, Value, Compare>::iterator::operator->() const
+{
+    return &current_->item;
+}
+
+template<typename Key, typename Value, typename Compare>
+bool PersistentAVLTree<Key, Value, Compare>::iterator::operator==(const iterator& rhs) const
+{
+    return current_ == rhs.current_;
+}
+
+template<typename Key, typename Value, typename Compare>
+bool PersistentAVLTree<Key, Value, Compare>::iterator::operator!=(const iterator& rhs) const
+{
+    return current_ != rhs.current_;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::iterator&
+PersistentAVLTree<Key, Value, Compare>::iterator::operator++()
+{
+    if(!pathKnown_) {
+        *this = tree_->upper_bound(current_->item.first);
+        return *this;
+    }
+    for(const Node* node = current_->right; node != nullptr; node = node->left) {
+        pending_.push_back(node);
+    }
+    if(pending_.empty()) {
+        current_ = nullptr;
+    }
+    else {
+        current_ = pending_.back();
+        pending_.pop_back();
+    }
+    return *this;
+}
+
+/*
+  --------------------------------------------------------------
+  End implementations for the PersistentAVLTree::iterator class.
+  --------------------------------------------------------------
+*/
+
+/*
+  -------------------------------------------------------
+  Begin implementations for the PersistentAVLTree class.
+  -------------------------------------------------------
+*/
+
+template<typename Key, typename Value, typename Compare>
+PersistentAVLTree<Key, Value, Compare>::PersistentAVLTree() :
+    root_(nullptr), size_(0), comp_()
+{
+
+}
+
+template<typename Key, typename Value, typename Compare>
+PersistentAVLTree<Key, Value, Compare>::PersistentAVLTree(const Compare& comp) :
+    root_(nullptr), size_(0), comp_(comp)
+{
+
+}
+
+/**
+* O(1): the copy shares every node with other.
+*/
+template<typename Key, typename Value, typename Compare>
+PersistentAVLTree<Key, Value, Compare>::PersistentAVLTree(const PersistentAVLTree& other) :
+    root_(retain(other.root_)), size_(other.size_), comp_(other.comp_)
+{
+
+}
+
+template<typename Key, typename Value, typename Compare>
+PersistentAVLTree<Key, Value, Compare>::PersistentAVLTree(PersistentAVLTree&& other) noexcept :
+    root_(other.root_), size_(other.size_), comp_(other.comp_)
+{
+    other.root_ = nullptr;
+    other.size_ = 0;
+}
+
+template<typename Key, typename Value, typename Compare>
+PersistentAVLTree<Key, Value, Compare>&
+PersistentAVLTree<Key, Value, Compare>::operator=(const PersistentAVLTree& other)
+{
+    Node* old = root_;
+    root_ = retain(other.root_);
+    size_ = other.size_;
+    comp_ = other.comp_;
+    release(old);
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare>
+PersistentAVLTree<Key, Value, Compare>&
+PersistentAVLTree<Key, Value, Compare>::operator=(PersistentAVLTree&& other) noexcept
+{
+    if(this != &other) {
+        release(root_);
+        root_ = other.root_;
+        size_ = other.size_;
+        comp_ = other.comp_;
+        other.root_ = nullptr;
+        other.size_ = 0;
+    }
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare>
+PersistentAVLTree<Key, Value, Compare>::~PersistentAVLTree()
+{
+    release(root_);
+}
+
+/**
+* Returns an immutable view of the current contents in O(1). Writes to
+* this tree afterwards copy the nodes they touch instead of changing them.
+*/
+template<typename Key, typename Value, typename Compare>
+PersistentAVLTree<Key, Value, Compare> PersistentAVLTree<Key, Value, Compare>::snapshot() const
+{
+    return PersistentAVLTree(*this);
+}
+
+/**
+* Inserts the item, overwriting the value if the key is already present.
+*/
+template<typename Key, typename Value, typename Compare>
+void PersistentAVLTree<Key, Value, Compare>::insert(const value_type& keyValuePair)
+{
+    Node* target = nullptr;
+    root_ = upsert(root_, keyValuePair.first, &keyValuePair.second, target);
+}
+
+/**
+* Removes key if present; nothing is copied if it is absent.
+*/
+template<typename Key, typename Value, typename Compare>
+void PersistentAVLTree<Key, Value, Compare>::remove(const Key& key)
+{
+    if(find(key) == end()) {
+        return;
+    }
+    root_ = erase(root_, key);
+    --size_;
+}
+
+template<typename Key, typename Value, typename Compare>
+void PersistentAVLTree<Key, Value, Compare>::clear()
+{
+    release(root_);
+    root_ = nullptr;
+    size_ = 0;
+}
+
+template<typename Key, typename Value, typename Compare>
+bool PersistentAVLTree<Key, Value, Compare>::isBalanced() const
+{
+    return checkBalance(root_) >= 0;
+}
+
+template<typename Key, typename Value, typename Compare>
+bool PersistentAVLTree<Key, Value, Compare>::empty() const
+{
+    return size_ == 0;
+}
+
+template<typename Key, typename Value, typename Compare>
+std::size_t PersistentAVLTree<Key, Value, Compare>::size() const
+{
+    return size_;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::iterator
+PersistentAVLTree<Key, Value, Compare>::begin() const
+{
+    std::vector<const Node*> pending;
+    for(const Node* node = root_; node != nullptr; node = node->left) {
+        pending.push_back(node);
+    }
+    if(pending.empty()) {
+        return end();
+    }
+    const Node* first = pending.back();
+    pending.pop_back();
+    return iterator(this, first, std::move(pending));
+}
+
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::iterator
+PersistentAVLTree<Key, Value, Compare>::end() const
+{
+    return iterator();
+}
+
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::iterator
+PersistentAVLTree<Key, Value, Compare>::find(const Key& key) const
+{
+    for(const Node* node = root_; node != nullptr; ) {
+        if(comp_(key, node->item.first)) {
+            node = node->left;
+        }
+        else if(comp_(node->item.first, key)) {
+            node = node->right;
+        }
+        else {
+            return iterator(this, node);
+        }
+    }
+    return end();
+}
+
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::iterator
+PersistentAVLTree<Key, Value, Compare>::lower_bound(const Key& key) const
+{
+    return bound(key, false);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::iterator
+PersistentAVLTree<Key, Value, Compare>::upper_bound(const Key& key) const
+{
+    return bound(key, true);
+}
+
+/**
+ * Returns the value associated with the key, inserting a
+ * default-constructed value first if the key is not in the map. The
+ * path to the key is copied if a snapshot shares it, so writes through
+ * the reference stay out of every snapshot.
+ */
+template<typename Key, typename Value, typename Compare>
+Value& PersistentAVLTree<Key, Value, Compare>::operator[](const Key& key)
+{
+    Node* target = nullptr;
+    root_ = upsert(root_, key, nullptr, target);
+    return target->item.second;
+}
+
+/**
+ * @precondition The key exists in the map
+ * Returns the value associated with the key
+ */
+template<typename Key, typename Value, typename Compare>
+Value const & PersistentAVLTree<Key, Value, Compare>::operator[](const Key& key) const
+{
+    iterator it = find(key);
+    if(it == end()) throw std::out_of_range("Invalid key");
+    return it->second;
+}
+
+/**
+* Finds or adds key below node, making every node on the way private to
+* this version. A found value is overwritten with *value if that is given;
+* an added one is *value or Value(). target is set to the key's node.
+*/
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Node*
+PersistentAVLTree<Key, Value, Compare>::upsert(Node* node, const Key& key, const Value* value, Node*& target)
+{
+    if(node == nullptr) {
+        ++size_;
+        target = new Node(value_type(key, value != nullptr ? *value : Value()), nullptr, nullptr, 1);
+        return target;
+    }
+    node = unshare(node);
+    if(comp_(key, node->item.first)) {
+        node->left = upsert(node->left, key, value, target);
+    }
+    else if(comp_(node->item.first, key)) {
+        node->right = upsert(node->right, key, value, target);
+    }
+    else {
+        if(value != nullptr) {
+            node->item.second = *value;
+        }
+        target = node;
+        return node;
+    }
+    return rebalance(node);
+}
+
+/**
+* Removes key, which must be present, from below node.
+*/
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Node*
+PersistentAVLTree<Key, Value, Compare>::erase(Node* node, const Key& key)
+{
+    node = unshare(node);
+    if(comp_(key, node->item.first)) {
+        node->left = erase(node->left, key);
+    }
+    else if(comp_(node->item.first, key)) {
+        node->right = erase(node->right, key);
+    }
+    else {
+        Node* left = node->left;
+        Node* right = node->right;
+        node->left = node->right = nullptr;
+        release(node);
+        if(left == nullptr || right == nullptr) {
+            return left != nullptr ? left : right;
+        }
+        // The successor takes the removed node's place.
+        Node* min;
+        right = takeMin(right, min);
+        min->left = left;
+        min->right = right;
+        node = min;
+    }
+    return rebalance(node);
+}
+
+/**
+* Detaches the smallest node below node into min (private, no children)
+* and returns what is left of the subtree.
+*/
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Node*
+PersistentAVLTree<Key, Value, Compare>::takeMin(Node* node, Node*& min)
+{
+    node = unshare(node);
+    if(node->left == nullptr) {
+        Node* right = node->right;
+        node->right = nullptr;
+        min = node;
+        return right;
+    }
+    node->left = takeMin(node->left, min);
+    return rebalance(node);
+}
+
+/**
+* Returns node itself if no other version holds it, else a private copy
+* (which holds its own references to the children).
+*/
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Node*
+PersistentAVLTree<Key, Value, Compare>::unshare(Node* node)
+{
+    if(node->refs.load(std::memory_order_acquire) == 1) {
+        return node;
+    }
+    Node* copy = new Node(node->item, retain(node->left), retain(node->right), node->height);
+    release(node);
+    return copy;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Node*
+PersistentAVLTree<Key, Value, Compare>::rebalance(Node* node)
+{
+    int balance = heightOf(node->right) - heightOf(node->left);
+    if(balance > 1) {
+        if(heightOf(node->right->left) > heightOf(node->right->right)) {
+            node->right = rotateRight(unshare(node->right));
+        }
+        return rotateLeft(node);
+    }
+    if(balance < -1) {
+        if(heightOf(node->left->right) > heightOf(node->left->left)) {
+            node->left = rotateLeft(unshare(node->left));
+        }
+        return rotateRight(node);
+    }
+    fixHeight(node);
+    return node;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Node*
+PersistentAVLTree<Key, Value, Compare>::rotateLeft(Node* node)
+{
+    Node* top = unshare(node->right);
+    node->right = top->left;
+    top->left = node;
+    fixHeight(node);
+    fixHeight(top);
+    return top;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Node*
+PersistentAVLTree<Key, Value, Compare>::rotateRight(Node* node)
+{
+    Node* top = unshare(node->left);
+    node->left = top->right;
+    top->right = node;
+    fixHeight(node);
+    fixHeight(top);
+    return top;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Node*
+PersistentAVLTree<Key, Value, Compare>::retain(Node* node)
+{
+    if(node != nullptr) {
+        node->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+    return node;
+}
+
+/**
+* Drops one reference; the last one frees the node and releases its
+* children in turn (recursion depth is bounded by the height).
+*/
+template<typename Key, typename Value, typename Compare>
+void PersistentAVLTree<Key, Value, Compare>::release(Node* node)
+{
+    if(node != nullptr && node->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        release(node->left);
+        release(node->right);
+        delete node;
+    }
+}
+
+template<typename Key, typename Value, typename Compare>
+int PersistentAVLTree<Key, Value, Compare>::heightOf(const Node* node)
+{
+    return node == nullptr ? 0 : node->height;
+}
+
+template<typename Key, typename Value, typename Compare>
+void PersistentAVLTree<Key, Value, Compare>::fixHeight(Node* node)
+{
+    node->height = 1 + std::max(heightOf(node->left), heightOf(node->right));
+}
+
+/**
+* Returns the height of the subtree at node if it is ordered, AVL-balanced
+* and its stored heights are right, else -1.
+*/
+template<typename Key, typename Value, typename Compare>
+int PersistentAVLTree<Key, Value, Compare>::checkBalance(const Node* node) const
+{
+    if(node == nullptr) {
+        return 0;
+    }
+    if((node->left != nullptr && !comp_(node->left->item.first, node->item.first)) ||
+       (node->right != nullptr && !comp_(node->item.first, node->right->item.first))) {
+        return -1;
+    }
+    int lh = checkBalance(node->left);
+    int rh = checkBalance(node->right);
+    if(lh < 0 || rh < 0 || lh - rh > 1 || rh - lh > 1 || node->height != 1 + std::max(lh, rh)) {
+        return -1;
+    }
+    return node->height;
+}
+
+/**
+* The first item with a key not less than key (strict: greater than key),
+* with the ancestors an in-order walk from there still has to visit.
+*/
+template<typename Key, typename Value, typename Compare>
+typename PersistentAVLTree<Key, Value, Compare>::iterator
+PersistentAVLTree<Key, Value, Compare>::bound(const Key& key, bool strict) const
+{
+    std::vector<const Node*> pending;
+    const Node* best = nullptr;
+    for(const Node* node = root_; node != nullptr; ) {
+        bool goRight = strict ? !comp_(key, node->item.first) : comp_(node->item.first, key);
+        if(goRight) {
+            node = node->right;
+        }
+        else {
+            if(best != nullptr) {
+                pending.push_back(best);
+            }
+            best = node;
+            node = node->left;
+        }
+    }
+    return best == nullptr ? end() : iterator(this, best, std::move(pending));
+}
+
+/*
+  -----------------------------------------------------
+  End implementations for the PersistentAVLTree class.
+  -----------------------------------------------------
+*/
+
+#endif
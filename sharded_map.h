@@ -0,0 +1,371 @@
+#ifndef SHARDED_MAP_H
+#define SHARDED_MAP_H
+
+#include <cstddef>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <utility>
+#include <stdexcept>
+#include <functional>
+#include "avlbst.h"
+
+/**
+* An ordered map whose key space is cut into ranges, each held by its own
+* AVLTree behind its own mutex, so that writers to different ranges run
+* in parallel. Point operations lock just the shard owning the key.
+* for_each and scan walk the shards in key order, one lock at a time,
+* so a long scan never blocks the whole map (and sees each shard, not the
+* map, at a single point in time).
+*
+* rebalance() moves half of the busiest shard into its less busy
+* neighbour when the load is skewed. The move is an O(log n) split and
+* concat of the two trees. The shard boundaries live in an immutable
+* table that is swapped atomically; an operation that routed by an old
+* table notices after taking the shard lock and routes again.
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class ShardedAVLMap
+{
+public:
+    typedef std::pair<const Key, Value> value_type;
+
+    explicit ShardedAVLMap(const std::vector<Key>& boundaries = std::vector<Key>(),
+                           const Compare& comp = Compare());
+    ShardedAVLMap(const ShardedAVLMap&) = delete;
+    ShardedAVLMap& operator=(const ShardedAVLMap&) = delete;
+
+    void insert(const value_type& keyValuePair);
+    void remove(const Key& key);
+    bool find(const Key& key, Value& value) const;
+    bool contains(const Key& key) const;
+    bool empty() const;
+    std::size_t size() const;
+
+    // Visitors run under a shard lock and must not call back into the map.
+    template<typename Visit>
+    void for_each(Visit visit) const;
+    template<typename Visit>
+    void scan(const Key& lo, const Key& hi, Visit visit) const;
+
+    bool rebalance(double skew = 2.0);
+    std::size_t shardCount() const;
+    std::size_t shardSize(std::size_t shard) const;
+    std::vector<Key> boundaries() const;
+
+private:
+    typedef AVLTree<Key, Value, std::allocator<value_type>, AVLNode<Key, Value, SubtreeSize>, Compare> ShardTree;
+
+    struct Shard
+    {
+        explicit Shard(const Compare& comp) : tree(comp), count(0), ops(0) { }
+        std::mutex lock;
+        ShardTree tree;
+        std::size_t count;
+        std::atomic<std::size_t> ops;   // operations since the last rebalance
+    };
+
+    // Shard i holds the keys in [keys[i - 1], keys[i]).
+    struct Bounds
+    {
+        std::vector<Key> keys;
+    };
+
+    std::size_t route(const Bounds& bounds, const Key& key) const;
+    std::size_t lockShardFor(const Key& key) const;
+    template<typename Visit>
+    void scanFrom(std::unique_ptr<Key> cursor, const Key* hi, Visit& visit) const;
+
+    std::vector<std::unique_ptr<Shard> > shards_;
+    std::atomic<const Bounds*> bounds_;
+    // Replaced tables are kept until destruction, as a router may still be
+    // reading one; rebalances are rare, so this stays small.
+    std::vector<std::unique_ptr<const Bounds> > tables_;
+    std::mutex rebalanceLock_;
+    Compare comp_;
+};
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the ShardedAVLMap class.
+  ---------------------------------------------------
+*/
+
+/**
+* Makes boundaries.size() + 1 shards; the boundaries must be strictly
+* increasing (std::invalid_argument otherwise).
+*/
+template<typename Key, typename Value, typename Compare>
+ShardedAVLMap<Key, Value, Compare>::ShardedAVLMap(const std::vector<Key>& boundaries, const Compare& comp) :
+    bounds_(nullptr), comp_(comp)
+{
+    for(std::size_t i = 1; i < boundaries.size(); ++i) {
+        if(!comp_(boundaries[i - 1], boundaries[i])) {
+            throw std::invalid_argument("ShardedAVLMap: boundaries are not strictly increasing");
+        }
+    }
+    for(std::size_t i = 0; i <= boundaries.size(); ++i) {
+        shards_.push_back(std::unique_ptr<Shard>(new Shard(comp_)));
+    }
+    Bounds* bounds = new Bounds();
+    bounds->keys = boundaries;
+    tables_.push_back(std::unique_ptr<const Bounds>(bounds));
+    bounds_.store(bounds);
+}
+
+/**
+* Inserts the item, overwriting the value if the key is already present.
+*/
+template<typename Key, typename Value, typename Compare>
+void ShardedAVLMap<Key, Value, Compare>::insert(const value_type& keyValuePair)
+{
+    Shard& shard = *shards_[lockShardFor(keyValuePair.first)];
+    std::lock_guard<std::mutex> guard(shard.lock, std::adopt_lock);
+    if(shard.tree.insert_or_assign(keyValuePair.first, keyValuePair.second).second) {
+        ++shard.count;
+    }
+}
+
+template<typename Key, typename Value, typename Compare>
+void ShardedAVLMap<Key, Value, Compare>::remove(const Key& key)
+{
+    Shard& shard = *shards_[lockShardFor(key)];
+    std::lock_guard<std::mutex> guard(shard.lock, std::adopt_lock);
+    if(shard.tree.find(key) != shard.tree.end()) {
+        shard.tree.remove(key);
+        --shard.count;
+    }
+}
+
+/**
+* Copies the value for key into value and returns true, or returns false.
+*/
+template<typename Key, typename Value, typename Compare>
+bool ShardedAVLMap<Key, Value, Compare>::find(const Key& key, Value& value) const
+{
+    Shard& shard = *shards_[lockShardFor(key)];
+    std::lock_guard<std::mutex> guard(shard.lock, std::adopt_lock);
+    typename ShardTree::iterator it = shard.tree.find(key);
+    if(it == shard.tree.end()) {
+        return false;
+    }
+    value = it->second;
+    return true;
+}
+
+template<typename Key, typename Value, typename Compare>
+bool ShardedAVLMap<Key, Value, Compare>::contains(const Key& key) const
+{
+    Shard& shard = *shards_[lockShardFor(key)];
+    std::lock_guard<std::mutex> guard(shard.lock, std::adopt_lock);
+    return shard.tree.find(key) != shard.tree.end();
+}
+
+template<typename Key, typename Value, typename Compare>
+bool ShardedAVLMap<Key, Value, Compare>::empty() const
+{
+    return size() == 0;
+}
+
+/**
+* Sums the shard sizes, locking one shard at a time.
+*/
+template<typename Key, typename Value, typename Compare>
+std::size_t ShardedAVLMap<Key, Value, Compare>::size() const
+{
+    std::size_t total = 0;
+    for(std::size_t i = 0; i < shards_.size(); ++i) {
+        total += shardSize(i);
+    }
+    return total;
+}
+
+/**
+* Calls visit(item) for every item in key order.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename Visit>
+void ShardedAVLMap<Key, Value, Compare>::for_each(Visit visit) const
+{
+    scanFrom(std::unique_ptr<Key>(), nullptr, visit);
+}
+
+/**
+* Calls visit(item) for every item with a key in [lo, hi), in key order.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename Visit>
+void ShardedAVLMap<Key, Value, Compare>::scan(const Key& lo, const Key& hi, Visit visit) const
+{
+    scanFrom(std::unique_ptr<Key>(new Key(lo)), &hi, visit);
+}
+
+/**
+* If the busiest shard has seen more than skew times the average number
+* of operations since the last call, moves half of its items into the
+* less busy of its neighbours and shifts the boundary between them.
+* Returns whether anything moved. Operation counts start over either way.
+*/
+template<typename Key, typename Value, typename Compare>
+bool ShardedAVLMap<Key, Value, Compare>::rebalance(double skew)
+{
+    std::lock_guard<std::mutex> rebalancing(rebalanceLock_);
+    std::vector<std::size_t> ops(shards_.size());
+    std::size_t total = 0;
+    std::size_t hot = 0;
+    for(std::size_t i = 0; i < shards_.size(); ++i) {
+        ops[i] = shards_[i]->ops.exchange(0, std::memory_order_relaxed);
+        total += ops[i];
+        if(ops[i] > ops[hot]) {
+            hot = i;
+        }
+    }
+    if(shards_.size() < 2 || total == 0 ||
+       static_cast<double>(ops[hot]) <= skew * static_cast<double>(total) / shards_.size()) {
+        return false;
+    }
+    bool toRight = hot == 0 || (hot + 1 < shards_.size() && ops[hot + 1] < ops[hot - 1]);
+    std::size_t lower = toRight ? hot : hot - 1;
+    Shard& left = *shards_[lower];
+    Shard& right = *shards_[lower + 1];
+    std::lock_guard<std::mutex> leftGuard(left.lock);
+    std::lock_guard<std::mutex> rightGuard(right.lock);
+
+    Shard& from = toRight ? left : right;
+    if(from.count < 2) {
+        return false;
+    }
+    // The key from which the upper part starts: the upper half when moving
+    // right, everything past the lower half when moving left.
+    std::size_t keep = toRight ? from.count - from.count / 2 : from.count / 2;
+    Key cut = from.tree.select(keep)->first;
+    ShardTree upper = from.tree.split(cut);
+    std::size_t upperCount = from.count - keep;
+    if(toRight) {
+        right.tree.concat(upper);
+        right.count += upperCount;
+        left.count = keep;
+    }
+    else {
+        left.tree.concat(right.tree);
+        right.tree = std::move(upper);
+        left.count += keep;
+        right.count = upperCount;
+    }
+
+    const Bounds* current = bounds_.load(std::memory_order_relaxed);
+    Bounds* next = new Bounds(*current);
+    next->keys[lower] = cut;
+    tables_.push_back(std::unique_ptr<const Bounds>(next));
+    bounds_.store(next, std::memory_order_release);
+    return true;
+}
+
+template<typename Key, typename Value, typename Compare>
+std::size_t ShardedAVLMap<Key, Value, Compare>::shardCount() const
+{
+    return shards_.size();
+}
+
+template<typename Key, typename Value, typename Compare>
+std::size_t ShardedAVLMap<Key, Value, Compare>::shardSize(std::size_t shard) const
+{
+    std::lock_guard<std::mutex> guard(shards_[shard]->lock);
+    return shards_[shard]->count;
+}
+
+template<typename Key, typename Value, typename Compare>
+std::vector<Key> ShardedAVLMap<Key, Value, Compare>::boundaries() const
+{
+    return bounds_.load(std::memory_order_acquire)->keys;
+}
+
+/**
+* The shard whose range holds key: the number of boundaries not above it.
+*/
+template<typename Key, typename Value, typename Compare>
+std::size_t ShardedAVLMap<Key, Value, Compare>::route(const Bounds& bounds, const Key& key) const
+{
+    std::size_t lo = 0;
+    std::size_t hi = bounds.keys.size();
+    while(lo < hi) {
+        std::size_t mid = (lo + hi) / 2;
+        if(comp_(key, bounds.keys[mid])) {
+            hi = mid;
+        }
+        else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+/**
+* Locks the shard that owns key and returns its index. A rebalance publishes its
+* new table while holding both shards it touches, so an unchanged table
+* after locking means the route is still right.
+*/
+template<typename Key, typename Value, typename Compare>
+std::size_t ShardedAVLMap<Key, Value, Compare>::lockShardFor(const Key& key) const
+{
+    for(;;) {
+        const Bounds* bounds = bounds_.load(std::memory_order_acquire);
+        std::size_t index = route(*bounds, key);
+        Shard& shard = *shards_[index];
+        shard.lock.lock();
+        if(bounds_.load(std::memory_order_acquire) == bounds) {
+            shard.ops.fetch_add(1, std::memory_order_relaxed);
+            return index;
+        }
+        shard.lock.unlock();
+    }
+}
+
+/**
+* Visits keys from *cursor (or the start if there is none) up to *hi (or
+* the end), shard by shard. Each step routes by the cursor afresh, so a
+* rebalance between steps neither repeats nor skips a key.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename Visit>
+void ShardedAVLMap<Key, Value, Compare>::scanFrom(std::unique_ptr<Key> cursor, const Key* hi, Visit& visit) const
+{
+    for(;;) {
+        std::size_t index = 0;
+        if(cursor) {
+            index = lockShardFor(*cursor);
+        }
+        else {
+            // Shard 0 always starts at the beginning; no route to check.
+            shards_[0]->lock.lock();
+        }
+        Shard& shard = *shards_[index];
+        std::lock_guard<std::mutex> guard(shard.lock, std::adopt_lock);
+        // Holding the shard pins both of its boundaries in any table.
+        const Bounds* bounds = bounds_.load(std::memory_order_acquire);
+        typename ShardTree::iterator it = cursor ? shard.tree.lower_bound(*cursor) : shard.tree.begin();
+        for(; it != shard.tree.end(); ++it) {
+            if(hi != nullptr && !comp_(it->first, *hi)) {
+                return;
+            }
+            visit(*it);
+        }
+        if(index + 1 == shards_.size()) {
+            return;
+        }
+        const Key& next = bounds->keys[index];
+        if(hi != nullptr && !comp_(next, *hi)) {
+            return;
+        }
+        cursor.reset(new Key(next));
+    }
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the ShardedAVLMap class.
+  -------------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,437 @@
+#ifndef SIMD_INDEX_H
+#define SIMD_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <utility>
+#include <vector>
+#include <stdexcept>
+#include <type_traits>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/**
+* A read-only lookup index for integral keys, built from a search tree (or
+* a sorted range) in linear time.
+*
+* The keys are stored as a static B+ tree whose nodes are one cache line
+* of B keys (16 for 32-bit keys, 8 for 64-bit ones) with B + 1 children.
+* The bottom layer is simply the sorted keys; each key of an inner node is
+* the smallest key under the child to its right. A lookup reads one line
+* per layer and finds the child to follow by counting the keys below the
+* search key, with SSE2 / SSE4.2 / AVX2 vector compares when the build
+* enables them (e.g. -mavx2 or -march=native) and a scalar loop otherwise.
+* The count at the bottom layer is directly the position in the sorted
+* items, which are kept in a plain array for the values and iteration.
+*/
+template <typename Key, typename Value>
+class SimdSearchIndex
+{
+    static_assert(std::is_integral<Key>::value, "SimdSearchIndex needs an integral key type");
+
+public:
+    // Keys per node: one 64-byte cache line.
+    static const std::size_t B = 64 / sizeof(Key);
+
+    SimdSearchIndex();
+    template<typename Tree>
+    explicit SimdSearchIndex(const Tree& tree);
+    template<typename RandomIt>
+    SimdSearchIndex(RandomIt first, RandomIt last, bool checkSorted = true);
+    SimdSearchIndex(const SimdSearchIndex& other);
+    SimdSearchIndex(SimdSearchIndex&& other) noexcept;
+    SimdSearchIndex& operator=(const SimdSearchIndex& other);
+    SimdSearchIndex& operator=(SimdSearchIndex&& other) noexcept;
+
+    bool empty() const;
+    std::size_t size() const;
+    std::size_t memoryUsage() const;
+
+    typedef typename std::vector<std::pair<const Key, Value> >::const_iterator iterator;
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(Key key) const;
+    iterator lower_bound(Key key) const;
+    iterator upper_bound(Key key) const;
+    Value const & operator[](Key key) const;
+
+private:
+    void build();
+    std::size_t lowerBoundPos(Key key) const;
+    static unsigned countLess(const Key* node, Key key);
+    static unsigned countLess(const Key* node, Key key, std::integral_constant<std::size_t, 4>);
+    static unsigned countLess(const Key* node, Key key, std::integral_constant<std::size_t, 8>);
+    template<std::size_t Size>
+    static unsigned countLess(const Key* node, Key key, std::integral_constant<std::size_t, Size>);
+    const Key* layer(std::size_t h) const;
+    void alignStorage(std::size_t keys);
+
+    std::vector<std::pair<const Key, Value> > items_;
+    // Layer h starts at node layerStart_[h]; layer 0 holds the leaves and
+    // the root is the only node of the last layer.
+    std::vector<std::size_t> layerStart_;
+    // Node storage, over-allocated so that nodes_ + offset_ is line aligned.
+    std::vector<Key> nodes_;
+    std::size_t offset_;
+};
+
+/*
+  -----------------------------------------------------
+  Begin implementations for the SimdSearchIndex class.
+  -----------------------------------------------------
+*/
+
+template<typename Key, typename Value>
+SimdSearchIndex<Key, Value>::SimdSearchIndex() :
+    offset_(0)
+{
+
+}
+
+/**
+* Builds the index from a tree's current contents (anything with a
+* begin()/end()). The tree must iterate in strictly increasing < order,
+* so a tree ordered by e.g. std::greater throws std::invalid_argument.
+* O(n).
+*/
+template<typename Key, typename Value>
+template<typename Tree>
+SimdSearchIndex<Key, Value>::SimdSearchIndex(const Tree& tree) :
+    offset_(0)
+{
+    for(typename Tree::iterator it = tree.begin(); it != tree.end(); ++it) {
+        if(!items_.empty() && !(items_.back().first < it->first)) {
+            throw std::invalid_argument("SimdSearchIndex: tree keys are not strictly increasing");
+        }
+        items_.push_back(*it);
+    }
+    build();
+}
+
+/**
+* Builds the index from [first, last), which must be in strictly
+* increasing key order (checked unless checkSorted is false;
+* std::invalid_argument otherwise). O(n).
+*/
+template<typename Key, typename Value>
+template<typename RandomIt>
+SimdSearchIndex<Key, Value>::SimdSearchIndex(RandomIt first, RandomIt last, bool checkSorted) :
+    offset_(0)
+{
+    if(checkSorted && first != last) {
+        for(RandomIt it = first + 1; it != last; ++it) {
+            if(!((it - 1)->first < it->first)) {
+                throw std::invalid_argument("SimdSearchIndex: keys are not strictly increasing");
+            }
+        }
+    }
+    items_.assign(first, last);
+    build();
+}
+
+/**
+* Copies re-align the node storage, since a copied vector need not have
+* the same address modulo a cache line.
+*/
+template<typename Key, typename Value>
+SimdSearchIndex<Key, Value>::SimdSearchIndex(const SimdSearchIndex& other) :
+    items_(other.items_), layerStart_(other.layerStart_), offset_(0)
+{
+    std::size_t keys = layerStart_.empty() ? 0 : layerStart_.back() * B;
+    alignStorage(keys);
+    if(keys != 0) {
+        std::memcpy(nodes_.data() + offset_, other.nodes_.data() + other.offset_, keys * sizeof(Key));
+    }
+}
+
+template<typename Key, typename Value>
+SimdSearchIndex<Key, Value>::SimdSearchIndex(SimdSearchIndex&& other) noexcept :
+    items_(std::move(other.items_)), layerStart_(std::move(other.layerStart_)),
+    nodes_(std::move(other.nodes_)), offset_(other.offset_)
+{
+    other.layerStart_.clear();
+    other.offset_ = 0;
+}
+
+template<typename Key, typename Value>
+SimdSearchIndex<Key, Value>& SimdSearchIndex<Key, Value>::operator=(const SimdSearchIndex& other)
+{
+    if(this != &other) {
+        SimdSearchIndex copy(other);
+        *this = std::move(copy);
+    }
+    return *this;
+}
+
+template<typename Key, typename Value>
+SimdSearchIndex<Key, Value>& SimdSearchIndex<Key, Value>::operator=(SimdSearchIndex&& other) noexcept
+{
+    if(this != &other) {
+        items_ = std::move(other.items_);
+        layerStart_ = std::move(other.layerStart_);
+        nodes_ = std::move(other.nodes_);
+        offset_ = other.offset_;
+        other.items_.clear();
+        other.layerStart_.clear();
+        other.nodes_.clear();
+        other.offset_ = 0;
+    }
+    return *this;
+}
+
+template<typename Key, typename Value>
+bool SimdSearchIndex<Key, Value>::empty() const
+{
+    return items_.empty();
+}
+
+template<typename Key, typename Value>
+std::size_t SimdSearchIndex<Key, Value>::size() const
+{
+    return items_.size();
+}
+
+/**
+* Bytes held by the node and item arrays.
+*/
+template<typename Key, typename Value>
+std::size_t SimdSearchIndex<Key, Value>::memoryUsage() const
+{
+    return nodes_.capacity() * sizeof(Key) + items_.capacity() * sizeof(std::pair<const Key, Value>);
+}
+
+template<typename Key, typename Value>
+typename SimdSearchIndex<Key, Value>::iterator SimdSearchIndex<Key, Value>::begin() const
+{
+    return items_.begin();
+}
+
+template<typename Key, typename Value>
+typename SimdSearchIndex<Key, Value>::iterator SimdSearchIndex<Key, Value>::end() const
+{
+    return items_.end();
+}
+
+template<typename Key, typename Value>
+typename SimdSearchIndex<Key, Value>::iterator SimdSearchIndex<Key, Value>::find(Key key) const
+{
+    std::size_t pos = lowerBoundPos(key);
+    if(pos == items_.size() || items_[pos].first != key) {
+        return items_.end();
+    }
+    return items_.begin() + pos;
+}
+
+template<typename Key, typename Value>
+typename SimdSearchIndex<Key, Value>::iterator SimdSearchIndex<Key, Value>::lower_bound(Key key) const
+{
+    return items_.begin() + lowerBoundPos(key);
+}
+
+template<typename Key, typename Value>
+typename SimdSearchIndex<Key, Value>::iterator SimdSearchIndex<Key, Value>::upper_bound(Key key) const
+{
+    if(key == std::numeric_limits<Key>::max()) {
+        return items_.end();
+    }
+    return items_.begin() + lowerBoundPos(key + 1);
+}
+
+/**
+ * @precondition The key exists in the index
+ * Returns the value associated with the key
+ */
+template<typename Key, typename Value>
+Value const & SimdSearchIndex<Key, Value>::operator[](Key key) const
+{
+    iterator it = find(key);
+    if(it == end()) throw std::out_of_range("Invalid key");
+    return it->second;
+}
+
+/**
+* Lays out the layers for the items now in items_. A leaf is B sorted
+* keys; each layer above has one node per B + 1 nodes below, up to a
+* single root. Slots past the end are padded with the largest key, which
+* no search counts as below it.
+*/
+template<typename Key, typename Value>
+void SimdSearchIndex<Key, Value>::build()
+{
+    const std::size_t n = items_.size();
+    const Key pad = std::numeric_limits<Key>::max();
+    layerStart_.clear();
+    if(n == 0) {
+        nodes_.clear();
+        offset_ = 0;
+        return;
+    }
+    std::vector<std::size_t> counts(1, (n + B - 1) / B);
+    while(counts.back() > 1) {
+        counts.push_back((counts.back() + B) / (B + 1));
+    }
+    layerStart_.push_back(0);
+    for(std::size_t h = 0; h < counts.size(); ++h) {
+        layerStart_.push_back(layerStart_.back() + counts[h]);
+    }
+    alignStorage(layerStart_.back() * B);
+    Key* base = nodes_.data() + offset_;
+
+    for(std::size_t i = 0; i < counts[0] * B; ++i) {
+        base[i] = i < n ? items_[i].first : pad;
+    }
+    for(std::size_t h = 1; h < counts.size(); ++h) {
+        Key* nodes = base + layerStart_[h] * B;
+        for(std::size_t k = 0; k < counts[h]; ++k) {
+            for(std::size_t j = 0; j < B; ++j) {
+                // Smallest key under child j + 1: follow first children down.
+                std::size_t child = k * (B + 1) + j + 1;
+                if(child >= counts[h - 1]) {
+                    nodes[k * B + j] = pad;
+                    continue;
+                }
+                for(std::size_t down = h - 1; down > 0; --down) {
+                    child *= B + 1;
+                }
+                nodes[k * B + j] = items_[child * B].first;
+            }
+        }
+    }
+}
+
+/**
+* Position in items_ of the first key not less than key. At each inner
+* node the number of keys below key is the child to take; at the leaf it
+* is the offset, and a full count runs on into the next leaf, which is
+* where the answer is then.
+*/
+template<typename Key, typename Value>
+std::size_t SimdSearchIndex<Key, Value>::lowerBoundPos(Key key) const
+{
+    if(items_.empty()) {
+        return 0;
+    }
+    std::size_t k = 0;
+    for(std::size_t h = layerStart_.size() - 2; h > 0; --h) {
+        k = k * (B + 1) + countLess(layer(h) + k * B, key);
+    }
+    std::size_t pos = k * B + countLess(layer(0) + k * B, key);
+    return pos < items_.size() ? pos : items_.size();
+}
+
+template<typename Key, typename Value>
+unsigned SimdSearchIndex<Key, Value>::countLess(const Key* node, Key key)
+{
+    return countLess(node, key, std::integral_constant<std::size_t, sizeof(Key)>());
+}
+
+/**
+* Number of the B keys of node that are below key, 32-bit keys. Each
+* compare yields -1 per lane below key; subtracting those and summing the
+* lanes gives the count without movemask/popcount. The vector compares
+* are signed, so unsigned keys get their top bit flipped.
+*/
+template<typename Key, typename Value>
+unsigned SimdSearchIndex<Key, Value>::countLess(const Key* node, Key key, std::integral_constant<std::size_t, 4>)
+{
+#if defined(__AVX2__)
+    const __m256i flip = _mm256_set1_epi32(std::is_signed<Key>::value ? 0 : INT32_MIN);
+    const __m256i x = _mm256_xor_si256(_mm256_set1_epi32(static_cast<int>(key)), flip);
+    const __m256i* p = reinterpret_cast<const __m256i*>(node);
+    __m256i lt = _mm256_add_epi32(_mm256_cmpgt_epi32(x, _mm256_xor_si256(_mm256_load_si256(p), flip)),
+                                  _mm256_cmpgt_epi32(x, _mm256_xor_si256(_mm256_load_si256(p + 1), flip)));
+    __m128i acc = _mm_add_epi32(_mm256_castsi256_si128(lt), _mm256_extracti128_si256(lt, 1));
+#elif defined(__SSE2__)
+    const __m128i flip = _mm_set1_epi32(std::is_signed<Key>::value ? 0 : INT32_MIN);
+    const __m128i x = _mm_xor_si128(_mm_set1_epi32(static_cast<int>(key)), flip);
+    const __m128i* p = reinterpret_cast<const __m128i*>(node);
+    __m128i acc = _mm_add_epi32(
+        _mm_add_epi32(_mm_cmpgt_epi32(x, _mm_xor_si128(_mm_load_si128(p), flip)),
+                      _mm_cmpgt_epi32(x, _mm_xor_si128(_mm_load_si128(p + 1), flip))),
+        _mm_add_epi32(_mm_cmpgt_epi32(x, _mm_xor_si128(_mm_load_si128(p + 2), flip)),
+                      _mm_cmpgt_epi32(x, _mm_xor_si128(_mm_load_si128(p + 3), flip))));
+#endif
+#if defined(__SSE2__)
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+    return static_cast<unsigned>(-_mm_cvtsi128_si32(acc));
+#else
+    return countLess(node, key, std::integral_constant<std::size_t, 0>());
+#endif
+}
+
+/**
+* Same for 64-bit keys, which need AVX2 or SSE4.2 for a 64-bit compare.
+*/
+template<typename Key, typename Value>
+unsigned SimdSearchIndex<Key, Value>::countLess(const Key* node, Key key, std::integral_constant<std::size_t, 8>)
+{
+#if defined(__AVX2__)
+    const __m256i flip = _mm256_set1_epi64x(std::is_signed<Key>::value ? 0 : INT64_MIN);
+    const __m256i x = _mm256_xor_si256(_mm256_set1_epi64x(static_cast<long long>(key)), flip);
+    const __m256i* p = reinterpret_cast<const __m256i*>(node);
+    __m256i lt = _mm256_add_epi64(_mm256_cmpgt_epi64(x, _mm256_xor_si256(_mm256_load_si256(p), flip)),
+                                  _mm256_cmpgt_epi64(x, _mm256_xor_si256(_mm256_load_si256(p + 1), flip)));
+    __m128i acc = _mm_add_epi64(_mm256_castsi256_si128(lt), _mm256_extracti128_si256(lt, 1));
+#elif defined(__SSE4_2__)
+    const __m128i flip = _mm_set1_epi64x(std::is_signed<Key>::value ? 0 : INT64_MIN);
+    const __m128i x = _mm_xor_si128(_mm_set1_epi64x(static_cast<long long>(key)), flip);
+    const __m128i* p = reinterpret_cast<const __m128i*>(node);
+    __m128i acc = _mm_add_epi64(
+        _mm_add_epi64(_mm_cmpgt_epi64(x, _mm_xor_si128(_mm_load_si128(p), flip)),
+                      _mm_cmpgt_epi64(x, _mm_xor_si128(_mm_load_si128(p + 1), flip))),
+        _mm_add_epi64(_mm_cmpgt_epi64(x, _mm_xor_si128(_mm_load_si128(p + 2), flip)),
+                      _mm_cmpgt_epi64(x, _mm_xor_si128(_mm_load_si128(p + 3), flip))));
+#endif
+#if defined(__AVX2__) || defined(__SSE4_2__)
+    acc = _mm_add_epi64(acc, _mm_unpackhi_epi64(acc, acc));
+    return static_cast<unsigned>(-_mm_cvtsi128_si64(acc));
+#else
+    return countLess(node, key, std::integral_constant<std::size_t, 0>());
+#endif
+}
+
+/**
+* Scalar fallback, also used for 8- and 16-bit keys. Branch-free, so the
+* compiler is free to vectorize it.
+*/
+template<typename Key, typename Value>
+template<std::size_t Size>
+unsigned SimdSearchIndex<Key, Value>::countLess(const Key* node, Key key, std::integral_constant<std::size_t, Size>)
+{
+    unsigned count = 0;
+    for(std::size_t j = 0; j < B; ++j) {
+        count += node[j] < key;
+    }
+    return count;
+}
+
+template<typename Key, typename Value>
+const Key* SimdSearchIndex<Key, Value>::layer(std::size_t h) const
+{
+    return nodes_.data() + offset_ + layerStart_[h] * B;
+}
+
+/**
+* Sizes nodes_ for the given number of keys plus one line of slack, and
+* sets offset_ so that the nodes start on a 64-byte boundary.
+*/
+template<typename Key, typename Value>
+void SimdSearchIndex<Key, Value>::alignStorage(std::size_t keys)
+{
+    nodes_.assign(keys + B, Key());
+    std::uintptr_t address = reinterpret_cast<std::uintptr_t>(nodes_.data());
+    offset_ = ((64 - address % 64) % 64) / sizeof(Key);
+}
+
+/*
+  ---------------------------------------------------
+  End implementations for the SimdSearchIndex class.
+  ---------------------------------------------------
+*/
+
+#endif
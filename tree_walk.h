@@ -0,0 +1,292 @@
+#ifndef TREE_WALK_H
+#define TREE_WALK_H
+
+#include <cstddef>
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+/**
+* An in-order walk over a binary tree shared by a small work-stealing
+* team of threads, for the trees' parallel_for_each and parallel_reduce.
+*
+* The work is cut into segments: a segment is either a whole subtree or
+* one node followed by its right subtree, so each covers a contiguous
+* run of keys. A worker walks its segment with a stack of pending
+* ancestors like scan_cursor does. While some other worker is idle it
+* hands off the oldest of those ancestors (the one nearest the segment's
+* root, i.e. the largest and last part of what is left) as a new segment
+* on its own deque, where idle workers steal from the other end. Nothing
+* is split up front, so a lopsided BST shares out as well as an AVL tree.
+*
+* Segments are kept in a list in key order: a handed-off segment goes
+* right after the one it came from, ahead of that one's earlier
+* hand-offs. Slot is per-segment state (a partial result) and every
+* worker has one more of its own, for results whose order does not
+* matter. The calling thread is worker 0; when a thread cannot be
+* started the others just do its share.
+*/
+template<typename NodeT, typename Slot>
+class TreeWalk
+{
+public:
+    struct Segment
+    {
+        Segment(NodeT* n, bool w) : node(n), whole(w), next(nullptr), slot() { }
+
+        NodeT* node;
+        bool whole;     // the subtree of node, or node and its right subtree
+        Segment* next;  // the segment that follows in key order
+        Slot slot;
+    };
+
+    TreeWalk(NodeT* root, unsigned threads);
+    ~TreeWalk();
+
+    // Calls visit(node, segmentSlot, workerSlot) for every node, then
+    // rethrows the first exception any call threw (the walk stops early).
+    template<typename Visit>
+    void run(Visit& visit);
+
+    // After run: the segments in key order, and the workers' own slots.
+    Segment* segments() const;
+    std::size_t workerCount() const;
+    Slot& workerSlot(std::size_t worker);
+
+private:
+    TreeWalk(const TreeWalk&);
+    TreeWalk& operator=(const TreeWalk&);
+
+    struct Worker
+    {
+        Worker() : queued(0), slot() { }
+
+        std::mutex lock;
+        std::deque<Segment*> pending;   // own end at the back
+        std::atomic<std::size_t> queued;
+        std::vector<NodeT*> stack;
+        Slot slot;
+    };
+
+    template<typename Visit>
+    void work(std::size_t self, Visit& visit);
+    template<typename Visit>
+    void walkSegment(Segment* segment, Worker& worker, Visit& visit);
+    Segment* take(std::size_t self);
+
+    Segment* head_;
+    std::vector<std::unique_ptr<Worker> > workers_;
+    std::atomic<std::size_t> outstanding_;  // segments not yet finished
+    std::atomic<unsigned> idle_;            // workers looking for work
+    std::atomic<bool> stop_;
+    std::mutex errorLock_;
+    std::exception_ptr error_;
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the TreeWalk class.
+  -------------------------------------------------
+*/
+
+/**
+* Prepares a walk over the tree rooted at root (which may be empty) by
+* up to threads threads.
+*/
+template<typename NodeT, typename Slot>
+TreeWalk<NodeT, Slot>::TreeWalk(NodeT* root, unsigned threads) :
+    head_(nullptr), outstanding_(0), idle_(0), stop_(false)
+{
+    if(threads == 0) {
+        threads = 1;
+    }
+    for(unsigned i = 0; i < threads; ++i) {
+        workers_.push_back(std::unique_ptr<Worker>(new Worker()));
+    }
+    if(root != nullptr) {
+        head_ = new Segment(root, true);
+        workers_[0]->pending.push_back(head_);
+        workers_[0]->queued = 1;
+        outstanding_ = 1;
+    }
+}
+
+template<typename NodeT, typename Slot>
+TreeWalk<NodeT, Slot>::~TreeWalk()
+{
+    while(head_ != nullptr) {
+        Segment* next = head_->next;
+        delete head_;
+        head_ = next;
+    }
+}
+
+/**
+* Starts the other workers, works alongside them and waits for all.
+*/
+template<typename NodeT, typename Slot>
+template<typename Visit>
+void TreeWalk<NodeT, Slot>::run(Visit& visit)
+{
+    std::vector<std::thread> team;
+    for(std::size_t i = 1; i < workers_.size(); ++i) {
+        try {
+            team.push_back(std::thread([this, i, &visit]() { work(i, visit); }));
+        }
+        catch(const std::system_error&) {
+            break;
+        }
+        catch(const std::bad_alloc&) {
+            break;
+        }
+    }
+    work(0, visit);
+    for(std::size_t i = 0; i < team.size(); ++i) {
+        team[i].join();
+    }
+    if(error_) {
+        std::rethrow_exception(error_);
+    }
+}
+
+template<typename NodeT, typename Slot>
+typename TreeWalk<NodeT, Slot>::Segment* TreeWalk<NodeT, Slot>::segments() const
+{
+    return head_;
+}
+
+template<typename NodeT, typename Slot>
+std::size_t TreeWalk<NodeT, Slot>::workerCount() const
+{
+    return workers_.size();
+}
+
+template<typename NodeT, typename Slot>
+Slot& TreeWalk<NodeT, Slot>::workerSlot(std::size_t worker)
+{
+    return workers_[worker]->slot;
+}
+
+/**
+* A worker's loop: take a segment (own newest first, then the others'
+* oldest) and walk it, until every segment is finished.
+*/
+template<typename NodeT, typename Slot>
+template<typename Visit>
+void TreeWalk<NodeT, Slot>::work(std::size_t self, Visit& visit)
+{
+    bool idle = false;
+    while(!stop_ && outstanding_ != 0) {
+        Segment* segment = take(self);
+        if(segment == nullptr) {
+            if(!idle) {
+                ++idle_;
+                idle = true;
+            }
+            std::this_thread::yield();
+            continue;
+        }
+        if(idle) {
+            --idle_;
+            idle = false;
+        }
+        try {
+            walkSegment(segment, *workers_[self], visit);
+        }
+        catch(...) {
+            std::lock_guard<std::mutex> guard(errorLock_);
+            if(!error_) {
+                error_ = std::current_exception();
+            }
+            stop_ = true;
+        }
+        --outstanding_;
+    }
+    if(idle) {
+        --idle_;
+    }
+}
+
+/**
+* Visits the nodes of segment in order, handing off its oldest pending
+* ancestor whenever more workers are idle than segments are waiting here.
+*/
+template<typename NodeT, typename Slot>
+template<typename Visit>
+void TreeWalk<NodeT, Slot>::walkSegment(Segment* segment, Worker& worker, Visit& visit)
+{
+    std::vector<NodeT*>& stack = worker.stack;
+    stack.clear();
+    std::size_t bottom = 0;     // stack entries below this were handed off
+    NodeT* node = segment->whole ? segment->node : nullptr;
+    if(!segment->whole) {
+        stack.push_back(segment->node);
+    }
+    for(;;) {
+        for(; node != nullptr; node = node->getLeft()) {
+            stack.push_back(node);
+        }
+        if(stack.size() == bottom || stop_) {
+            return;
+        }
+        if(stack.size() - bottom > 1 &&
+           idle_.load(std::memory_order_relaxed) > worker.queued.load(std::memory_order_relaxed)) {
+            Segment* tail = new Segment(stack[bottom], false);
+            ++bottom;
+            tail->next = segment->next;
+            segment->next = tail;
+            ++outstanding_;
+            std::lock_guard<std::mutex> guard(worker.lock);
+            worker.pending.push_back(tail);
+            ++worker.queued;
+        }
+        NodeT* current = stack.back();
+        stack.pop_back();
+        visit(current, segment->slot, worker.slot);
+        node = current->getRight();
+    }
+}
+
+/**
+* Pops the newest segment off this worker's deque, or failing that
+* steals the oldest one of another worker.
+*/
+template<typename NodeT, typename Slot>
+typename TreeWalk<NodeT, Slot>::Segment* TreeWalk<NodeT, Slot>::take(std::size_t self)
+{
+    for(std::size_t i = 0; i < workers_.size(); ++i) {
+        Worker& victim = *workers_[(self + i) % workers_.size()];
+        if(victim.queued == 0) {
+            continue;
+        }
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if(victim.pending.empty()) {
+            continue;
+        }
+        Segment* segment;
+        if(i == 0) {
+            segment = victim.pending.back();
+            victim.pending.pop_back();
+        }
+        else {
+            segment = victim.pending.front();
+            victim.pending.pop_front();
+        }
+        --victim.queued;
+        return segment;
+    }
+    return nullptr;
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the TreeWalk class.
+  -----------------------------------------------
+*/
+
+#endif